@@ -0,0 +1,544 @@
+#pragma warning( disable : 4996 )
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include "LM_BinIndex.h"
+
+#define LM_BIN_LINE_SIZE		256
+
+struct LM_BinEntry
+{
+	unsigned long long	low;
+	unsigned long long	high;
+	int					order;		// line order in the file, breaks ties
+	LM_BinRecord		record;
+};
+
+// Right pads a digit prefix to LM_BIN_DIGITS so prefixes of any length
+// compare as plain integers. Returns false on a non-digit.
+static bool LM_BinKey(unsigned long long * key, const char * digits, int length, int padDigit)
+{
+	*key = 0;
+
+	for (int i = 0; i < LM_BIN_DIGITS; i++)
+	{
+		int digit = padDigit;
+
+		if (i < length)
+		{
+			if (digits[i] < '0' || digits[i] > '9')
+				return false;
+
+			digit = digits[i] - '0';
+		}
+
+		*key = *key * 10 + digit;
+	}
+
+	return true;
+}
+
+// Splits off the next comma separated field, trimming the line ending.
+static char * LM_NextField(char ** line)
+{
+	char * field = *line;
+
+	if (!field)
+		return NULL;
+
+	char * comma = strchr(field, ',');
+
+	if (comma)
+	{
+		*comma = 0;
+		*line = comma + 1;
+	}
+	else
+	{
+		field[strcspn(field, "\r\n")] = 0;
+		*line = NULL;
+	}
+
+	return field;
+}
+
+static void LM_CopyField(char * destination, const char * field, size_t size)
+{
+	destination[0] = 0;
+
+	if (field)
+	{
+		strncpy(destination, field, size - 1);
+		destination[size - 1] = 0;
+	}
+}
+
+static int LM_CompareBinEntries(const void * a, const void * b)
+{
+	const LM_BinEntry * entryA = (const LM_BinEntry *)a;
+	const LM_BinEntry * entryB = (const LM_BinEntry *)b;
+
+	if (entryA->low != entryB->low)
+		return entryA->low < entryB->low ? -1 : 1;
+
+	return entryA->order - entryB->order;
+}
+
+static int LM_CompareBounds(const void * a, const void * b)
+{
+	unsigned long long boundA = *(const unsigned long long *)a;
+	unsigned long long boundB = *(const unsigned long long *)b;
+
+	return (boundA < boundB) ? -1 : (boundA > boundB) ? 1 : 0;
+}
+
+// Min-heap of entry indexes ordered by range width, then file order.
+static bool LM_BinHeapLess(const LM_BinEntry * entries, int a, int b)
+{
+	unsigned long long widthA = entries[a].high - entries[a].low;
+	unsigned long long widthB = entries[b].high - entries[b].low;
+
+	if (widthA != widthB)
+		return widthA < widthB;
+
+	return entries[a].order < entries[b].order;
+}
+
+static void LM_BinHeapPush(int * heap, int * heapSize, const LM_BinEntry * entries, int entry)
+{
+	int i = (*heapSize)++;
+
+	for (; i > 0 && LM_BinHeapLess(entries, entry, heap[(i - 1) / 2]); i = (i - 1) / 2)
+		heap[i] = heap[(i - 1) / 2];
+
+	heap[i] = entry;
+}
+
+static void LM_BinHeapPop(int * heap, int * heapSize, const LM_BinEntry * entries)
+{
+	int last = heap[--(*heapSize)];
+	int i = 0;
+
+	while (2 * i + 1 < *heapSize)
+	{
+		int child = 2 * i + 1;
+
+		if (child + 1 < *heapSize && LM_BinHeapLess(entries, heap[child + 1], heap[child]))
+			child++;
+
+		if (!LM_BinHeapLess(entries, heap[child], last))
+			break;
+
+		heap[i] = heap[child];
+		i = child;
+	}
+
+	heap[i] = last;
+}
+
+// Sweeps the sorted range bounds keeping the ranges that cover the current
+// point in a heap; the narrowest one on top owns the segment that starts
+// there. Adjacent segments owned by the same range are merged.
+static bool LM_BuildBinSegments(LM_BinIndex * index, const LM_BinEntry * entries, int count)
+{
+	unsigned long long * bounds = (unsigned long long *)malloc((2 * count + 1) * sizeof(unsigned long long));
+	int * heap = (int *)malloc((count + 1) * sizeof(int));
+
+	index->lows = (unsigned long long *)malloc((2 * count + 1) * sizeof(unsigned long long));
+	index->highs = (unsigned long long *)malloc((2 * count + 1) * sizeof(unsigned long long));
+	index->recordIndexes = (int *)malloc((2 * count + 1) * sizeof(int));
+
+	if (!bounds || !heap || !index->lows || !index->highs || !index->recordIndexes)
+	{
+		free(bounds);
+		free(heap);
+		return false;
+	}
+
+	int boundCount = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		bounds[boundCount++] = entries[i].low;
+		bounds[boundCount++] = entries[i].high + 1;
+	}
+
+	qsort(bounds, boundCount, sizeof(unsigned long long), LM_CompareBounds);
+
+	int heapSize = 0;
+	int nextEntry = 0;
+
+	index->segmentCount = 0;
+
+	for (int i = 0; i < boundCount; i++)
+	{
+		if (i > 0 && bounds[i] == bounds[i - 1])
+			continue;
+
+		unsigned long long point = bounds[i];
+
+		while (nextEntry < count && entries[nextEntry].low <= point)
+			LM_BinHeapPush(heap, &heapSize, entries, nextEntry++);
+
+		while (heapSize > 0 && entries[heap[0]].high < point)
+			LM_BinHeapPop(heap, &heapSize, entries);
+
+		if (heapSize == 0)
+			continue;
+
+		int owner = heap[0];
+		int segment = index->segmentCount;
+
+		if (	segment > 0
+			&&	index->recordIndexes[segment - 1] == owner
+			&&	index->highs[segment - 1] + 1 == point)
+		{
+			segment--;
+		}
+		else
+		{
+			index->lows[segment] = point;
+			index->recordIndexes[segment] = owner;
+			index->segmentCount++;
+		}
+
+		int nextBound = i + 1;
+		while (bounds[nextBound] == point)
+			nextBound++;
+
+		// the owner ends on a bound, so it covers everything up to the next one
+		index->highs[segment] = bounds[nextBound] - 1;
+	}
+
+	free(bounds);
+	free(heap);
+
+	return true;
+}
+
+LM_BinIndex * LM_LoadBinIndex(const char * path)
+{
+	FILE * file = fopen(path, "r");
+
+	if (!file)
+		return NULL;
+
+	LM_BinEntry * entries = NULL;
+	int count = 0;
+	int capacity = 0;
+	int lineNumber = 0;
+
+	char line[LM_BIN_LINE_SIZE];
+
+	while (fgets(line, sizeof(line), file))
+	{
+		lineNumber++;
+
+		if (line[0] < '0' || line[0] > '9')
+			continue;
+
+		char * remaining = line;
+		char * low = LM_NextField(&remaining);
+		char * high = LM_NextField(&remaining);
+
+		if (count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 1024;
+
+			LM_BinEntry * grown = (LM_BinEntry *)realloc(entries, capacity * sizeof(LM_BinEntry));
+			if (!grown)
+			{
+				free(entries);
+				fclose(file);
+				return NULL;
+			}
+			entries = grown;
+		}
+
+		LM_BinEntry * entry = &entries[count];
+
+		if (	!high
+			||	!LM_BinKey(&entry->low, low, (int)strlen(low), 0)
+			||	!LM_BinKey(&entry->high, high, (int)strlen(high), 9)
+			||	entry->high < entry->low)
+		{
+			fprintf(stderr, "Skipping malformed BIN range on line %d of %s.\n", lineNumber, path);
+			continue;
+		}
+
+		LM_CopyField(entry->record.issuer, LM_NextField(&remaining), LM_BIN_ISSUER_SIZE);
+		LM_CopyField(entry->record.network, LM_NextField(&remaining), LM_BIN_NETWORK_SIZE);
+		LM_CopyField(entry->record.cardType, LM_NextField(&remaining), LM_BIN_CARDTYPE_SIZE);
+
+		entry->order = count++;
+	}
+
+	fclose(file);
+
+	qsort(entries, count, sizeof(LM_BinEntry), LM_CompareBinEntries);
+
+	LM_BinIndex * index = (LM_BinIndex *)calloc(1, sizeof(LM_BinIndex));
+
+	if (index)
+	{
+		index->recordCount = count;
+		index->records = (LM_BinRecord *)malloc((count + 1) * sizeof(LM_BinRecord));
+
+		if (!index->records || !LM_BuildBinSegments(index, entries, count))
+		{
+			LM_FreeBinIndex(index);
+			index = NULL;
+		}
+	}
+
+	if (index)
+	{
+		for (int i = 0; i < count; i++)
+			index->records[i] = entries[i].record;
+	}
+
+	free(entries);
+
+	return index;
+}
+
+void LM_FreeBinIndex(LM_BinIndex * index)
+{
+	if (!index)
+		return;
+
+	free(index->lows);
+	free(index->highs);
+	free(index->recordIndexes);
+	free(index->records);
+	free(index);
+}
+
+const LM_BinRecord * LM_LookupBin(const LM_BinIndex * index, const char * pan, int length)
+{
+	unsigned long long key;
+
+	if (!index || !LM_BinKey(&key, pan, length, 0))
+		return NULL;
+
+	// last segment starting at or below the key
+	int lower = 0;
+	int upper = index->segmentCount;
+
+	while (lower < upper)
+	{
+		int middle = (lower + upper) / 2;
+
+		if (index->lows[middle] <= key)
+			lower = middle + 1;
+		else
+			upper = middle;
+	}
+
+	if (lower == 0 || index->highs[lower - 1] < key)
+		return NULL;
+
+	return &index->records[index->recordIndexes[lower - 1]];
+}
+
+static long long LM_FileModifiedTime(const char * path)
+{
+	struct stat fileStatus;
+
+	if (stat(path, &fileStatus) != 0)
+		return -1;
+
+	return (long long)fileStatus.st_mtime;
+}
+
+static LM_BinIndex * LM_ExchangeBinIndex(LM_BinIndex * volatile * slot, LM_BinIndex * index)
+{
+#ifdef WIN32
+	return (LM_BinIndex *)InterlockedExchangePointer((PVOID volatile *)slot, index);
+#else
+	return __atomic_exchange_n(slot, index, __ATOMIC_ACQ_REL);
+#endif
+}
+
+const LM_BinIndex * LM_AcquireBinIndex(LM_BinTable * table)
+{
+#ifdef WIN32
+	return table->index;		// volatile reads have acquire semantics under MSVC
+#else
+	return __atomic_load_n(&table->index, __ATOMIC_ACQUIRE);
+#endif
+}
+
+struct LM_BinReloader
+{
+	LM_BinTable *		table;
+#ifdef WIN32
+	HANDLE				thread;
+	HANDLE				closing;		// an event set to stop the thread
+#else
+	pthread_t			thread;
+	pthread_mutex_t		mutex;
+	pthread_cond_t		condition;
+	bool				closing;
+#endif
+};
+
+// Waits out one check interval. Returns false once the table is closing.
+static bool LM_WaitBinReloader(LM_BinReloader * reloader)
+{
+#ifdef WIN32
+	return WaitForSingleObject(reloader->closing, LM_BIN_CHECKINTERVAL * 1000) == WAIT_TIMEOUT;
+#else
+	struct timespec until;
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += LM_BIN_CHECKINTERVAL;
+
+	pthread_mutex_lock(&reloader->mutex);
+
+	while (!reloader->closing && pthread_cond_timedwait(&reloader->condition, &reloader->mutex, &until) != ETIMEDOUT)
+		;
+
+	bool running = !reloader->closing;
+	pthread_mutex_unlock(&reloader->mutex);
+
+	return running;
+#endif
+}
+
+#ifdef WIN32
+static DWORD WINAPI LM_BinReloaderMain(LPVOID argument)
+#else
+static void * LM_BinReloaderMain(void * argument)
+#endif
+{
+	LM_BinReloader * reloader = (LM_BinReloader *)argument;
+	LM_BinTable * table = reloader->table;
+
+	while (LM_WaitBinReloader(reloader))
+	{
+		long long modifiedTime = LM_FileModifiedTime(table->path);
+
+		if (modifiedTime == table->modifiedTime)
+			continue;
+
+		LM_BinIndex * index = LM_LoadBinIndex(table->path);
+
+		if (!index)
+			continue;
+
+		table->modifiedTime = modifiedTime;
+
+		// an index loaded before and never published is nobody's but ours
+		LM_FreeBinIndex(LM_ExchangeBinIndex(&table->pending, index));
+	}
+
+	return 0;
+}
+
+static LM_BinReloader * LM_StartBinReloader(LM_BinTable * table)
+{
+	LM_BinReloader * reloader = (LM_BinReloader *)calloc(1, sizeof(LM_BinReloader));
+
+	if (!reloader)
+		return NULL;
+
+	reloader->table = table;
+
+#ifdef WIN32
+	reloader->closing = CreateEvent(NULL, TRUE, FALSE, NULL);
+	reloader->thread = reloader->closing ? CreateThread(NULL, 0, LM_BinReloaderMain, reloader, 0, NULL) : NULL;
+
+	if (!reloader->thread)
+	{
+		if (reloader->closing)
+			CloseHandle(reloader->closing);
+
+		free(reloader);
+		return NULL;
+	}
+#else
+	pthread_mutex_init(&reloader->mutex, NULL);
+	pthread_cond_init(&reloader->condition, NULL);
+
+	if (pthread_create(&reloader->thread, NULL, LM_BinReloaderMain, reloader) != 0)
+	{
+		pthread_cond_destroy(&reloader->condition);
+		pthread_mutex_destroy(&reloader->mutex);
+		free(reloader);
+		return NULL;
+	}
+#endif
+
+	return reloader;
+}
+
+static void LM_StopBinReloader(LM_BinReloader * reloader)
+{
+#ifdef WIN32
+	SetEvent(reloader->closing);
+	WaitForSingleObject(reloader->thread, INFINITE);
+	CloseHandle(reloader->thread);
+	CloseHandle(reloader->closing);
+#else
+	pthread_mutex_lock(&reloader->mutex);
+	reloader->closing = true;
+	pthread_cond_signal(&reloader->condition);
+	pthread_mutex_unlock(&reloader->mutex);
+
+	pthread_join(reloader->thread, NULL);
+	pthread_cond_destroy(&reloader->condition);
+	pthread_mutex_destroy(&reloader->mutex);
+#endif
+
+	free(reloader);
+}
+
+bool LM_OpenBinTable(LM_BinTable * table, const char * path)
+{
+	table->path = path;
+	table->modifiedTime = LM_FileModifiedTime(path);
+	table->index = LM_LoadBinIndex(path);
+	table->pending = NULL;
+	table->reloader = NULL;
+
+	if (!table->index)
+		return false;
+
+	// without a reloader the table still works, it just never changes
+	table->reloader = LM_StartBinReloader(table);
+
+	return true;
+}
+
+void LM_CloseBinTable(LM_BinTable * table)
+{
+	if (table->reloader)
+		LM_StopBinReloader(table->reloader);
+
+	table->reloader = NULL;
+
+	LM_FreeBinIndex(LM_ExchangeBinIndex(&table->pending, NULL));
+	LM_FreeBinIndex(LM_ExchangeBinIndex(&table->index, NULL));
+}
+
+LM_BinIndex * LM_RefreshBinTable(LM_BinTable * table)
+{
+	LM_BinIndex * index = LM_ExchangeBinIndex(&table->pending, NULL);
+
+	if (!index)
+		return NULL;
+
+	return LM_ExchangeBinIndex(&table->index, index);
+}
@@ -0,0 +1,68 @@
+#ifndef LM_BININDEX_H_
+#define LM_BININDEX_H_
+
+#define LM_BIN_DIGITS			12		// PAN digits significant for a range lookup
+
+#define LM_BIN_ISSUER_SIZE		48
+#define LM_BIN_NETWORK_SIZE		16
+#define LM_BIN_CARDTYPE_SIZE	16
+
+struct LM_BinRecord
+{
+	char	issuer[LM_BIN_ISSUER_SIZE];
+	char	network[LM_BIN_NETWORK_SIZE];
+	char	cardType[LM_BIN_CARDTYPE_SIZE];
+};
+
+// Overlapping and nested ranges are flattened at load time into disjoint
+// segments, each pointing at the narrowest range covering it, so a lookup is
+// one binary search over the low bounds with nothing to scan afterwards.
+struct LM_BinIndex
+{
+	int						segmentCount;
+	unsigned long long *	lows;
+	unsigned long long *	highs;
+	int *					recordIndexes;
+	int						recordCount;
+	LM_BinRecord *			records;
+};
+
+// Loads a CSV of "low,high,issuer,network,card type" lines, where low and
+// high are BIN prefixes of any length up to LM_BIN_DIGITS. Lines starting
+// with '#' or a non-digit (a header) are skipped. Returns NULL on failure.
+LM_BinIndex * LM_LoadBinIndex(const char * path);
+void LM_FreeBinIndex(LM_BinIndex * index);
+
+// Returns the narrowest range containing the PAN, or NULL. Of two equally
+// narrow ranges the one listed first in the file wins.
+const LM_BinRecord * LM_LookupBin(const LM_BinIndex * index, const char * pan, int length);
+
+#define LM_BIN_CHECKINTERVAL	5		// seconds between checks for a changed table file
+
+struct LM_BinReloader;
+
+// A BIN table that can be replaced while it is in use. A reloader thread
+// checks the file every LM_BIN_CHECKINTERVAL seconds and builds a changed
+// table's index off to the side; the decoder publishes it between swipes
+// with one atomic pointer exchange, so a large table never stalls a swipe.
+// Lookups read the current index with acquire semantics. Replace the file
+// by renaming over it so a reload never sees it half written.
+struct LM_BinTable
+{
+	LM_BinIndex * volatile	index;
+	LM_BinIndex * volatile	pending;		// loaded by the reloader, not yet published
+	const char *			path;
+	long long				modifiedTime;	// the reloader's once it is running
+	LM_BinReloader *		reloader;
+};
+
+bool LM_OpenBinTable(LM_BinTable * table, const char * path);
+void LM_CloseBinTable(LM_BinTable * table);
+
+// Publishes an index the reloader has loaded, if there is one. The replaced
+// index is returned to the caller to free once no lookup can still hold it.
+LM_BinIndex * LM_RefreshBinTable(LM_BinTable * table);
+
+const LM_BinIndex * LM_AcquireBinIndex(LM_BinTable * table);
+
+#endif /*LM_BININDEX_H_*/
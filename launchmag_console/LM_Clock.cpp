@@ -0,0 +1,101 @@
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <stdio.h>
+
+#include "LM_Clock.h"
+
+#define LM_SLEEP_SPINTIME		(2 * LM_NANOSECONDS_PER_MILLISECOND)
+
+long long LM_MonotonicTime()
+{
+#ifdef WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if (!frequency.QuadPart)
+		QueryPerformanceFrequency(&frequency);
+
+	QueryPerformanceCounter(&counter);
+
+	return (counter.QuadPart / frequency.QuadPart) * LM_NANOSECONDS_PER_SECOND
+		+ ((counter.QuadPart % frequency.QuadPart) * LM_NANOSECONDS_PER_SECOND) / frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (long long)now.tv_sec * LM_NANOSECONDS_PER_SECOND + now.tv_nsec;
+#endif
+}
+
+long long LM_WallClockTime()
+{
+#ifdef WIN32
+	// FILETIME counts 100 ns intervals since 1601
+	FILETIME fileTime;
+	GetSystemTimeAsFileTime(&fileTime);
+
+	long long intervals = ((long long)fileTime.dwHighDateTime << 32) | fileTime.dwLowDateTime;
+
+	return (intervals - 116444736000000000LL) * 100;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	return (long long)now.tv_sec * LM_NANOSECONDS_PER_SECOND + now.tv_nsec;
+#endif
+}
+
+void LM_SleepUntil(long long deadline)
+{
+	long long remaining;
+
+	while ((remaining = deadline - LM_MonotonicTime()) > 0)
+	{
+		if (remaining > LM_SLEEP_SPINTIME)
+		{
+#ifdef WIN32
+			Sleep((DWORD)((remaining - LM_SLEEP_SPINTIME) / LM_NANOSECONDS_PER_MILLISECOND));
+#else
+			struct timespec duration;
+			duration.tv_sec = (time_t)((remaining - LM_SLEEP_SPINTIME) / LM_NANOSECONDS_PER_SECOND);
+			duration.tv_nsec = (long)((remaining - LM_SLEEP_SPINTIME) % LM_NANOSECONDS_PER_SECOND);
+			nanosleep(&duration, NULL);
+#endif
+		}
+	}
+}
+
+bool LM_ParseUtcTime(const char * text, long long * time)
+{
+	int year, month, day;
+	int hour = 0, minute = 0, second = 0;
+	char separator;
+	int consumed = 0;
+
+	int fields = sscanf(text, "%d-%d-%d%c%d:%d%n:%d%n", &year, &month, &day, &separator, &hour, &minute, &consumed, &second, &consumed);
+
+	if (	(fields != 3 && fields != 6 && fields != 7)
+		||	(fields > 3 && separator != ' ' && separator != 'T')
+		||	(fields > 3 && text[consumed] != 0)
+		||	month < 1 || month > 12 || day < 1 || day > 31
+		||	hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 60)
+	{
+		return false;
+	}
+
+	// days from civil date, counting March as the first month of the year
+	int shiftedYear = year - (month <= 2);
+	int era = (shiftedYear >= 0 ? shiftedYear : shiftedYear - 399) / 400;
+	int yearOfEra = shiftedYear - era * 400;
+	int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	long long days = (long long)era * 146097 + dayOfEra - 719468;
+
+	*time = ((days * 24 + hour) * 60 + minute) * 60 * LM_NANOSECONDS_PER_SECOND + second * LM_NANOSECONDS_PER_SECOND;
+
+	return true;
+}
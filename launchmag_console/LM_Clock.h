@@ -0,0 +1,22 @@
+#ifndef LM_CLOCK_H_
+#define LM_CLOCK_H_
+
+#define LM_NANOSECONDS_PER_MILLISECOND		1000000LL
+#define LM_NANOSECONDS_PER_SECOND			1000000000LL
+
+// Nanoseconds from an arbitrary fixed point; never goes backwards.
+long long LM_MonotonicTime();
+
+// Nanoseconds since the Unix epoch, for timestamps kept across runs.
+long long LM_WallClockTime();
+
+// Waits for a LM_MonotonicTime() deadline. Sleeps while the deadline is far
+// off and spins for the last stretch, since sleeps are too coarse to pace
+// bytes a millisecond apart.
+void LM_SleepUntil(long long deadline);
+
+// Parses "YYYY-MM-DD", "YYYY-MM-DD HH:MM" or "YYYY-MM-DD HH:MM:SS" as UTC
+// ('T' may separate date and time) into nanoseconds since the Unix epoch.
+bool LM_ParseUtcTime(const char * text, long long * time);
+
+#endif /*LM_CLOCK_H_*/
@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#include "LM_CommandChannel.h"
+
+const int LM_BAUDRATES[LM_BAUD_COUNT] = { 9600, 19200, 38400, 57600 };
+
+const char * LM_STATUSNAMES[] = { "ok", "unknown command", "bad argument", "not built into the firmware", "bad check byte" };
+
+int LM_BaudRate(int baudIndex)
+{
+	if (baudIndex < 0 || baudIndex >= LM_BAUD_COUNT)
+		return -1;
+
+	return LM_BAUDRATES[baudIndex];
+}
+
+int LM_BaudIndex(int baudRate)
+{
+	for (int i = 0; i < LM_BAUD_COUNT; i++)
+	{
+		if (LM_BAUDRATES[i] == baudRate)
+			return i;
+	}
+
+	return -1;
+}
+
+#ifdef WIN32
+
+bool LM_SetPortBaud(LM_CommandPort * port, int baudRate)
+{
+	DCB dcb;
+	dcb.DCBlength = sizeof(DCB);
+
+	if (!::GetCommState((HANDLE)port->handle, &dcb))
+		return false;
+
+	dcb.BaudRate = DWORD(baudRate);
+
+	if (!::SetCommState((HANDLE)port->handle, &dcb))
+		return false;
+
+	port->baudRate = baudRate;
+	return true;
+}
+
+static bool LM_WritePort(LM_CommandPort * port, const unsigned char * bytes, int count)
+{
+	DWORD written = 0;
+
+	return ::WriteFile((HANDLE)port->handle, bytes, DWORD(count), &written, NULL) && written == DWORD(count);
+}
+
+int LM_ReadPortByte(LM_CommandPort * port, int timeout)
+{
+	COMMTIMEOUTS saved;
+
+	if (!::GetCommTimeouts((HANDLE)port->handle, &saved))
+		return -1;
+
+	// return with the first byte, or none once the constant has passed
+	COMMTIMEOUTS timeouts = saved;
+	timeouts.ReadIntervalTimeout = MAXDWORD;
+	timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+	timeouts.ReadTotalTimeoutConstant = (timeout > 0) ? DWORD(timeout) : 1;
+
+	unsigned char byte;
+	DWORD read = 0;
+	bool received = ::SetCommTimeouts((HANDLE)port->handle, &timeouts) && ::ReadFile((HANDLE)port->handle, &byte, 1, &read, NULL) && read == 1;
+
+	::SetCommTimeouts((HANDLE)port->handle, &saved);
+
+	return received ? byte : -1;
+}
+
+#else
+
+static speed_t LM_TermiosSpeed(int baudRate)
+{
+	switch (baudRate)
+	{
+	case 9600:	return B9600;
+	case 19200:	return B19200;
+	case 38400:	return B38400;
+	case 57600:	return B57600;
+	}
+
+	return B0;
+}
+
+static bool LM_ConfigureSerial(int fd, int baudRate)
+{
+	speed_t speed = LM_TermiosSpeed(baudRate);
+	struct termios settings;
+
+	if (speed == B0 || tcgetattr(fd, &settings) < 0)
+		return false;
+
+	cfmakeraw(&settings);
+	settings.c_cflag |= CLOCAL | CREAD;
+	settings.c_cflag &= ~(CSTOPB | PARENB);
+	settings.c_cc[VMIN] = 1;
+	settings.c_cc[VTIME] = 0;
+	cfsetispeed(&settings, speed);
+	cfsetospeed(&settings, speed);
+
+	// a pty takes the settings but ignores the rate
+	return tcsetattr(fd, TCSANOW, &settings) == 0;
+}
+
+int LM_OpenSerialDevice(const char * path, int baudRate)
+{
+	int fd = open(path, O_RDWR | O_NOCTTY);
+
+	if (fd < 0)
+		return -1;
+
+	if (!LM_ConfigureSerial(fd, baudRate))
+	{
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+
+	return fd;
+}
+
+bool LM_SetPortBaud(LM_CommandPort * port, int baudRate)
+{
+	// what the reader sent at the old rate has been read by now
+	if (!LM_ConfigureSerial(port->fd, baudRate))
+		return false;
+
+	port->baudRate = baudRate;
+	return true;
+}
+
+static bool LM_WritePort(LM_CommandPort * port, const unsigned char * bytes, int count)
+{
+	while (count > 0)
+	{
+		ssize_t written = write(port->fd, bytes, count);
+
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		bytes += written;
+		count -= (int)written;
+	}
+
+	return true;
+}
+
+int LM_ReadPortByte(LM_CommandPort * port, int timeout)
+{
+	struct pollfd poller;
+	poller.fd = port->fd;
+	poller.events = POLLIN;
+
+	for (;;)
+	{
+		int ready = poll(&poller, 1, timeout);
+
+		if (ready < 0 && errno == EINTR)
+			continue;
+
+		if (ready <= 0)
+			return -1;
+
+		unsigned char byte;
+		ssize_t count = read(port->fd, &byte, 1);
+
+		if (count == 1)
+			return byte;
+
+		if (count < 0 && errno == EINTR)
+			continue;
+
+		return -1;
+	}
+}
+
+#endif
+
+bool LM_SendCommand(LM_CommandPort * port, int command, int argument)
+{
+	unsigned char bytes[LM_COMMAND_LENGTH];
+
+	bytes[0] = LM_COMMAND_SYNC;
+	bytes[1] = (unsigned char)command;
+	bytes[2] = (unsigned char)argument;
+	bytes[3] = (unsigned char)(command ^ argument);
+
+	if (command == LM_COMMAND_BAUD)
+		port->pendingBaudRate = LM_BaudRate(argument);
+
+	return LM_WritePort(port, bytes, LM_COMMAND_LENGTH);
+}
+
+bool LM_QueueCommand(LM_CommandPort * port, int command, int argument)
+{
+	if (port->queuedCount >= LM_COMMAND_MAXQUEUED)
+		return false;
+
+	port->queued[port->queuedCount][0] = (unsigned char)command;
+	port->queued[port->queuedCount][1] = (unsigned char)argument;
+	port->queuedCount++;
+	return true;
+}
+
+bool LM_SendNextCommand(LM_CommandPort * port)
+{
+	if (port->awaitingReply || port->sentCount >= port->queuedCount)
+		return true;
+
+	const unsigned char * next = port->queued[port->sentCount++];
+
+	port->awaitingReply = true;
+	return LM_SendCommand(port, next[0], next[1]);
+}
+
+void LM_InitializeReplyParser(LM_ReplyParser * parser)
+{
+	parser->expected = LM_REPLY_IDLE;
+	parser->length = 0;
+}
+
+bool LM_ParseReplyByte(LM_ReplyParser * parser, int inputByte, bool * complete)
+{
+	*complete = false;
+
+	if (parser->expected == LM_REPLY_IDLE)
+	{
+		if (inputByte != LM_REPLY_MARKER)
+			return false;
+
+		parser->expected = LM_REPLY_COUNT;
+		parser->length = 0;
+		return true;
+	}
+
+	if (parser->expected == LM_REPLY_COUNT)
+	{
+		// a count no reply could have means the marker was noise
+		if (inputByte < 2 || inputByte >= LM_REPLY_MAXLENGTH)
+		{
+			parser->expected = LM_REPLY_IDLE;
+			return false;
+		}
+
+		parser->expected = inputByte;
+		return true;
+	}
+
+	parser->bytes[parser->length++] = (unsigned char)inputByte;
+
+	if (--parser->expected == 0)
+	{
+		parser->expected = LM_REPLY_IDLE;
+		*complete = true;
+	}
+
+	return true;
+}
+
+static void LM_PrintTrackMask(FILE * file, int mask)
+{
+	if ((mask & (LM_TRACKMASK_TRACK1 | LM_TRACKMASK_TRACK2)) == (LM_TRACKMASK_TRACK1 | LM_TRACKMASK_TRACK2))
+		fprintf(file, "tracks 1 and 2");
+	else if (mask & LM_TRACKMASK_TRACK1)
+		fprintf(file, "track 1");
+	else if (mask & LM_TRACKMASK_TRACK2)
+		fprintf(file, "track 2");
+	else
+		fprintf(file, "no tracks");
+}
+
+void LM_HandleCommandReply(FILE * file, const LM_ReplyParser * parser, LM_CommandPort * port)
+{
+	int command = parser->bytes[0];
+	int status = parser->bytes[1];
+	const unsigned char * payload = parser->bytes + 2;
+	int payloadLength = parser->length - 2;
+
+	if (port)
+		port->awaitingReply = false;
+
+	if (status != LM_STATUS_OK)
+	{
+		fprintf(file, "Reader refused command 0x%02X: %s.\n", command,
+			(status < (int)(sizeof(LM_STATUSNAMES) / sizeof(LM_STATUSNAMES[0]))) ? LM_STATUSNAMES[status] : "unknown status");
+		return;
+	}
+
+	switch (command)
+	{
+	case LM_COMMAND_VERSION:
+		if (payloadLength < 6)
+			break;
+
+		fprintf(file, "Reader firmware %d.%d, sending ", payload[0], payload[1]);
+		LM_PrintTrackMask(file, payload[3]);
+		fprintf(file, " at %d baud, %s framing", LM_BaudRate(payload[4]), (payload[5] == LM_FRAMING_LEGACY) ? "legacy" : "unknown");
+
+		if (payload[2] & LM_FEATURE_TIMINGCAPTURE)
+			fprintf(file, ", timing capture %s", (payload[2] & LM_FEATURE_TIMINGON) ? "on" : "off");
+
+		fprintf(file, "\n");
+		return;
+
+	case LM_COMMAND_OVERFLOWS:
+		if (payloadLength < 4)
+			break;
+
+		fprintf(file, "Reader buffer overflows: Track 1 %d bytes dropped, Track 2 %d bytes dropped",
+			payload[0] | (payload[1] << 8), payload[2] | (payload[3] << 8));
+
+		if (payloadLength >= 6)
+			fprintf(file, ", commands %d bytes dropped", payload[4] | (payload[5] << 8));
+
+		fprintf(file, "\n");
+		return;
+
+	case LM_COMMAND_BAUD:
+		if (port && port->pendingBaudRate > 0)
+		{
+			if (LM_SetPortBaud(port, port->pendingBaudRate))
+				fprintf(file, "Reader and serial port now at %d baud.\n", port->baudRate);
+			else
+				fprintf(file, "Reader is now at %d baud, but the serial port could not follow.\n", port->pendingBaudRate);
+
+			port->pendingBaudRate = 0;
+		}
+		return;
+
+	case LM_COMMAND_TRACKS:
+	case LM_COMMAND_TIMING:
+	case LM_COMMAND_FRAMING:
+		fprintf(file, "Reader took command 0x%02X.\n", command);
+		return;
+	}
+
+	fprintf(file, "Reader sent a short or unknown reply to command 0x%02X.\n", command);
+}
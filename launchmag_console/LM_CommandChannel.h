@@ -0,0 +1,80 @@
+#ifndef LM_COMMANDCHANNEL_H_
+#define LM_COMMANDCHANNEL_H_
+
+#include <stdio.h>
+
+#include "../launchmag_firmware/LM_Commands.h"
+
+// The host end of the command channel of firmware built with
+// LM_COMMANDCHANNEL (see LM_Commands.h): commands go out on the serial
+// port the packets come in on, and their replies are picked out of the
+// packet stream by LM_ProcessByte. Commands go one at a time, each once the
+// reply to the one before has come, as the reader takes its commands into a
+// few bytes of buffer while it may be busy sending.
+
+#define LM_COMMAND_MAXQUEUED	8
+#define LM_COMMAND_REPLYTIMEOUT	1000	// milliseconds a reader has to answer a command
+
+struct LM_CommandPort
+{
+#ifdef WIN32
+	void *		handle;				// the HANDLE of the COM port
+#else
+	int			fd;
+#endif
+	int			baudRate;
+	int			pendingBaudRate;	// sent with LM_COMMAND_BAUD, taken up when the reader says so
+	unsigned char	queued[LM_COMMAND_MAXQUEUED][2];	// command and argument
+	int			queuedCount;
+	int			sentCount;
+	bool		awaitingReply;
+};
+
+// Bits per second for an LM_BAUD_ index, or -1.
+int LM_BaudRate(int baudIndex);
+
+// LM_BAUD_ index for a rate, or -1 if the firmware has no such rate.
+int LM_BaudIndex(int baudRate);
+
+#ifndef WIN32
+// Opens a serial device, or the slave end of a pty, raw 8N1 at baudRate.
+// Returns the descriptor, or -1 with errno set.
+int LM_OpenSerialDevice(const char * path, int baudRate);
+#endif
+
+bool LM_SetPortBaud(LM_CommandPort * port, int baudRate);
+
+bool LM_SendCommand(LM_CommandPort * port, int command, int argument);
+
+// Queues a command for LM_SendNextCommand. Returns false with the queue full.
+bool LM_QueueCommand(LM_CommandPort * port, int command, int argument);
+
+// Sends the next queued command unless one is still waiting on its reply.
+// Returns false only if the port could not be written.
+bool LM_SendNextCommand(LM_CommandPort * port);
+
+// Reads one byte straight from the port, waiting up to timeout
+// milliseconds. Returns -1 on a timeout or error.
+int LM_ReadPortByte(LM_CommandPort * port, int timeout);
+
+#define LM_REPLY_IDLE		-2		// not in a reply
+#define LM_REPLY_COUNT		-1		// the marker came, the count is next
+
+struct LM_ReplyParser
+{
+	int				expected;		// bytes of the reply still to come, or LM_REPLY_
+	int				length;
+	unsigned char	bytes[LM_REPLY_MAXLENGTH];	// command, status and payload
+};
+
+void LM_InitializeReplyParser(LM_ReplyParser * parser);
+
+// Returns true if the byte belongs to a reply, leaving the packet parser to
+// take it otherwise. *complete is set once the reply is whole.
+bool LM_ParseReplyByte(LM_ReplyParser * parser, int inputByte, bool * complete);
+
+// Prints a whole reply and follows a baud rate change the reader accepted,
+// leaving the port free for the next queued command.
+void LM_HandleCommandReply(FILE * file, const LM_ReplyParser * parser, LM_CommandPort * port);
+
+#endif /*LM_COMMANDCHANNEL_H_*/
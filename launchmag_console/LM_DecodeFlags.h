@@ -0,0 +1,12 @@
+#ifndef LM_DECODEFLAGS_H_
+#define LM_DECODEFLAGS_H_
+
+#define LM_DECODEFLAG_LRCVALID		0x0001	// LRC character present and column parity matched
+#define LM_DECODEFLAG_CORRECTED		0x0002	// a single bit error was repaired using the LRC
+#define LM_DECODEFLAG_REVERSED		0x0004	// card was swiped in the reverse direction
+#define LM_DECODEFLAG_SALVAGED		0x0008	// start sentinel was located with bit errors
+#define LM_DECODEFLAG_LUHNCHECKED	0x0010	// a PAN was parsed and its check digit tested
+#define LM_DECODEFLAG_LUHNVALID		0x0020	// the PAN check digit is correct
+#define LM_DECODEFLAG_DUPLICATE		0x0040	// same card seen on this device within the dedupe window
+
+#endif /*LM_DECODEFLAGS_H_*/
@@ -0,0 +1,53 @@
+#include <memory.h>
+
+#include "LM_DedupeCache.h"
+
+void LM_InitializeDedupeCache(LM_DedupeCache * cache, long long window)
+{
+	memset(cache->slots, 0, sizeof(cache->slots));
+	cache->window = window;
+}
+
+// 64 bit FNV-1a over the track number and decoded characters.
+static unsigned long long LM_HashSwipe(int track, const char * data, int length)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+
+	hash = (hash ^ (unsigned char)track) * 1099511628211ULL;
+
+	for (int i = 0; i < length; i++)
+		hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+
+	return hash;
+}
+
+bool LM_CheckDuplicate(LM_DedupeCache * cache, int deviceId, int track, const char * data, int length, long long now)
+{
+	unsigned long long hash = LM_HashSwipe(track, data, length);
+
+	// mix the device in for the slot only, the stored hash stays comparable
+	unsigned int home = (unsigned int)((hash ^ ((unsigned long long)deviceId * 0x9E3779B97F4A7C15ULL)) >> 32);
+
+	LM_DedupeSlot * reuse = NULL;
+
+	for (int probe = 0; probe < LM_DEDUPE_MAXPROBES; probe++)
+	{
+		LM_DedupeSlot * slot = &cache->slots[(home + probe) & (LM_DEDUPE_SLOTS - 1)];
+
+		bool expired = !slot->used || now - slot->time > cache->window;
+
+		if (!expired && slot->hash == hash && slot->deviceId == deviceId)
+			return true;
+
+		// unused slots first, then the oldest, which is expired if any is
+		if (!reuse || (reuse->used && (!slot->used || slot->time < reuse->time)))
+			reuse = slot;
+	}
+
+	reuse->hash = hash;
+	reuse->deviceId = deviceId;
+	reuse->time = now;
+	reuse->used = true;
+
+	return false;
+}
@@ -0,0 +1,30 @@
+#ifndef LM_DEDUPECACHE_H_
+#define LM_DEDUPECACHE_H_
+
+#define LM_DEDUPE_SLOTS			1024	// power of two
+#define LM_DEDUPE_MAXPROBES		8
+
+struct LM_DedupeSlot
+{
+	unsigned long long	hash;
+	long long			time;			// when the swipe was first seen
+	int					deviceId;
+	bool				used;
+};
+
+// Remembers recent swipes for a fixed window. Open addressing with a bounded
+// probe run keeps every check to at most LM_DEDUPE_MAXPROBES slots: expired
+// slots are reused in place and a full run evicts its oldest entry.
+struct LM_DedupeCache
+{
+	LM_DedupeSlot	slots[LM_DEDUPE_SLOTS];
+	long long		window;				// nanoseconds
+};
+
+void LM_InitializeDedupeCache(LM_DedupeCache * cache, long long window);
+
+// Returns true if the same content was seen from the same device within the
+// window of the first sighting; otherwise records the swipe and returns false.
+bool LM_CheckDuplicate(LM_DedupeCache * cache, int deviceId, int track, const char * data, int length, long long now);
+
+#endif /*LM_DEDUPECACHE_H_*/
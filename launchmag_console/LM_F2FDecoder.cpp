@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "LM_F2FDecoder.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LM_F2F_SSE2
+#endif
+
+#define LM_WAV_FORMAT_PCM			0x0001
+#define LM_WAV_FORMAT_FLOAT			0x0003
+#define LM_WAV_FORMAT_EXTENSIBLE	0xFFFE
+
+#define LM_F2F_BLOCKSIZE			256		// samples per block of the amplitude envelope
+#define LM_F2F_ENVELOPEBLOCKS		8		// blocks either side that set a block's threshold
+#define LM_F2F_THRESHOLD			0.3f	// of the local peak amplitude
+#define LM_F2F_NOISEBLOCKS			0.2		// share of blocks, quietest first, taken to hold only noise
+#define LM_F2F_NOISEMARGIN			3.0f	// how far above the noise a pulse must rise
+#define LM_F2F_PULSERELEASE			0.5f	// a pulse is over once it falls to this share of its peak
+#define LM_F2F_MAXGAP				0.05	// seconds without a transition that always end a swipe
+#define LM_F2F_GAPPERIODS			8		// bit periods without a transition that end a swipe
+#define LM_F2F_LEADINGINTERVALS		8		// intervals the first bit period is taken from
+#define LM_F2F_SHORTINTERVAL		0.75	// of the bit period; shorter intervals are half a 1 bit
+#define LM_F2F_PERIODGAIN			0.25	// how far each bit pulls the bit period toward its own length
+#define LM_F2F_MINBITS				32		// fewer bits than this are taken for noise
+
+static unsigned int LM_ReadLittleEndian(const unsigned char * bytes, int size)
+{
+	unsigned int value = 0;
+
+	for (int i = size - 1; i >= 0; i--)
+		value = (value << 8) | bytes[i];
+
+	return value;
+}
+
+static float LM_ConvertSample(const unsigned char * bytes, int format, int bitsPerSample)
+{
+	if (format == LM_WAV_FORMAT_FLOAT)
+	{
+		float value;
+		memcpy(&value, bytes, sizeof(value));
+		return value;
+	}
+
+	if (bitsPerSample == 8)
+		return (bytes[0] - 128) / 128.0f;
+
+	// sign extend from the top byte
+	int bytesPerSample = bitsPerSample / 8;
+	int value = (int)(LM_ReadLittleEndian(bytes, bytesPerSample) << (32 - bitsPerSample));
+
+	return value / 2147483648.0f;
+}
+
+bool LM_ReadWavFile(const char * path, LM_PcmSamples * pcm)
+{
+	memset(pcm, 0, sizeof(*pcm));
+
+	FILE * file = fopen(path, "rb");
+
+	if (!file)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	unsigned char * bytes = (size > 12) ? (unsigned char *)malloc(size) : NULL;
+
+	if (!bytes || fread(bytes, 1, size, file) != (size_t)size)
+	{
+		free(bytes);
+		fclose(file);
+		return false;
+	}
+
+	fclose(file);
+
+	int format = 0;
+	int channels = 0;
+	int bitsPerSample = 0;
+	const unsigned char * data = NULL;
+	size_t dataSize = 0;
+
+	if (memcmp(bytes, "RIFF", 4) == 0 && memcmp(bytes + 8, "WAVE", 4) == 0)
+	{
+		long position = 12;
+
+		while (position + 8 <= size)
+		{
+			const unsigned char * chunk = bytes + position;
+			size_t chunkSize = LM_ReadLittleEndian(chunk + 4, 4);
+			size_t available = (size_t)(size - position - 8);
+
+			if (chunkSize > available)
+				chunkSize = available;		// recorders that were cut off leave the size unset
+
+			if (memcmp(chunk, "fmt ", 4) == 0 && chunkSize >= 16)
+			{
+				format = LM_ReadLittleEndian(chunk + 8, 2);
+				channels = LM_ReadLittleEndian(chunk + 10, 2);
+				pcm->sampleRate = LM_ReadLittleEndian(chunk + 12, 4);
+				bitsPerSample = LM_ReadLittleEndian(chunk + 22, 2);
+
+				if (format == LM_WAV_FORMAT_EXTENSIBLE && chunkSize >= 26)
+					format = LM_ReadLittleEndian(chunk + 32, 2);
+			}
+			else if (memcmp(chunk, "data", 4) == 0)
+			{
+				data = chunk + 8;
+				dataSize = chunkSize;
+			}
+
+			position += 8 + chunkSize + (chunkSize & 1);
+		}
+	}
+
+	bool supported =
+			data
+		&&	channels >= 1
+		&&	pcm->sampleRate
+		&&	((format == LM_WAV_FORMAT_PCM && bitsPerSample % 8 == 0 && bitsPerSample >= 8 && bitsPerSample <= 32)
+			||	(format == LM_WAV_FORMAT_FLOAT && bitsPerSample == 32));
+
+	if (supported)
+	{
+		size_t frameSize = (size_t)channels * (bitsPerSample / 8);
+
+		pcm->count = dataSize / frameSize;
+		pcm->samples = (float *)malloc((pcm->count ? pcm->count : 1) * sizeof(float));
+
+		if (pcm->samples)
+		{
+			for (size_t i = 0; i < pcm->count; i++)
+				pcm->samples[i] = LM_ConvertSample(data + i * frameSize, format, bitsPerSample);
+		}
+		else
+			supported = false;
+	}
+
+	free(bytes);
+
+	return supported;
+}
+
+void LM_FreePcmSamples(LM_PcmSamples * pcm)
+{
+	free(pcm->samples);
+	pcm->samples = NULL;
+	pcm->count = 0;
+}
+
+// Takes out any DC offset and smooths with a 1 2 3 2 1 kernel, which keeps
+// the pulses and flattens sample noise that would make false peaks.
+static void LM_FilterSamples(float * filtered, const float * samples, size_t count)
+{
+	double total = 0;
+
+	for (size_t i = 0; i < count; i++)
+		total += samples[i];
+
+	const float mean = count ? (float)(total / count) : 0.0f;
+	const float scale = 1.0f / 9.0f;
+
+	size_t i = 0;
+
+	for (; i < count && i < 2; i++)
+		filtered[i] = samples[i] - mean;
+
+#ifdef LM_F2F_SSE2
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 three = _mm_set1_ps(3.0f);
+	const __m128 scales = _mm_set1_ps(scale);
+	const __m128 means = _mm_set1_ps(mean);
+
+	for (; i + 4 + 2 <= count; i += 4)
+	{
+		__m128 outer = _mm_add_ps(_mm_loadu_ps(samples + i - 2), _mm_loadu_ps(samples + i + 2));
+		__m128 inner = _mm_add_ps(_mm_loadu_ps(samples + i - 1), _mm_loadu_ps(samples + i + 1));
+		__m128 sum = _mm_add_ps(_mm_add_ps(outer, _mm_mul_ps(inner, two)), _mm_mul_ps(_mm_loadu_ps(samples + i), three));
+
+		_mm_storeu_ps(filtered + i, _mm_sub_ps(_mm_mul_ps(sum, scales), means));
+	}
+#endif
+
+	for (; i + 2 < count; i++)
+	{
+		float sum = samples[i - 2] + samples[i + 2] + 2.0f * (samples[i - 1] + samples[i + 1]) + 3.0f * samples[i];
+		filtered[i] = sum * scale - mean;
+	}
+
+	for (; i < count; i++)
+		filtered[i] = samples[i] - mean;
+}
+
+static float LM_BlockPeak(const float * samples, size_t count)
+{
+	size_t i = 0;
+	float peak = 0.0f;
+
+#ifdef LM_F2F_SSE2
+	const __m128 signs = _mm_set1_ps(-0.0f);
+	__m128 peaks = _mm_setzero_ps();
+
+	for (; i + 4 <= count; i += 4)
+		peaks = _mm_max_ps(peaks, _mm_andnot_ps(signs, _mm_loadu_ps(samples + i)));
+
+	float lanes[4];
+	_mm_storeu_ps(lanes, peaks);
+
+	for (int lane = 0; lane < 4; lane++)
+		peak = (lanes[lane] > peak) ? lanes[lane] : peak;
+#endif
+
+	for (; i < count; i++)
+	{
+		float magnitude = fabsf(samples[i]);
+		peak = (magnitude > peak) ? magnitude : peak;
+	}
+
+	return peak;
+}
+
+struct LM_Transitions
+{
+	double *	positions;		// in samples, between samples where interpolated
+	size_t		count;
+	size_t		capacity;
+};
+
+static bool LM_AddTransition(LM_Transitions * transitions, double position)
+{
+	if (transitions->count == transitions->capacity)
+	{
+		size_t capacity = transitions->capacity ? transitions->capacity * 2 : 4096;
+		double * positions = (double *)realloc(transitions->positions, capacity * sizeof(double));
+
+		if (!positions)
+			return false;
+
+		transitions->positions = positions;
+		transitions->capacity = capacity;
+	}
+
+	transitions->positions[transitions->count++] = position;
+
+	return true;
+}
+
+// Refines a pulse's position with a parabola through its peak sample and
+// the two either side.
+static double LM_InterpolatePeak(const float * samples, size_t count, size_t peak)
+{
+	if (peak == 0 || peak + 1 >= count)
+		return (double)peak;
+
+	double before = fabs(samples[peak - 1]);
+	double at = fabs(samples[peak]);
+	double after = fabs(samples[peak + 1]);
+	double curvature = before - 2 * at + after;
+
+	return (curvature < 0) ? peak + 0.5 * (before - after) / curvature : (double)peak;
+}
+
+static int LM_CompareFloats(const void * a, const void * b)
+{
+	float valueA = *(const float *)a;
+	float valueB = *(const float *)b;
+
+	return (valueA < valueB) ? -1 : (valueA > valueB) ? 1 : 0;
+}
+
+// The loudest of the quietest blocks, which a recording of a few swipes
+// with pauses between them leaves to noise.
+static float LM_NoiseLevel(const float * blockPeaks, size_t blockCount)
+{
+	if (!blockCount)
+		return 0.0f;
+
+	float * sorted = (float *)malloc(blockCount * sizeof(float));
+
+	if (!sorted)
+		return 0.0f;
+
+	memcpy(sorted, blockPeaks, blockCount * sizeof(float));
+	qsort(sorted, blockCount, sizeof(float), LM_CompareFloats);
+
+	float level = sorted[(size_t)(blockCount * LM_F2F_NOISEBLOCKS)];
+
+	free(sorted);
+
+	return level;
+}
+
+// Finds the pulses: each is the extreme of a run above the threshold, and
+// each has the opposite polarity to the one before. Blocks quieter than
+// their threshold hold no pulse and are skipped whole.
+static void LM_FindTransitions(const float * samples, size_t count, LM_Transitions * transitions)
+{
+	size_t blockCount = (count + LM_F2F_BLOCKSIZE - 1) / LM_F2F_BLOCKSIZE;
+	float * blockPeaks = (float *)malloc((blockCount ? blockCount : 1) * sizeof(float));
+
+	if (!blockPeaks)
+		return;
+
+	for (size_t block = 0; block < blockCount; block++)
+	{
+		size_t start = block * LM_F2F_BLOCKSIZE;
+		size_t length = (count - start < LM_F2F_BLOCKSIZE) ? count - start : LM_F2F_BLOCKSIZE;
+
+		blockPeaks[block] = LM_BlockPeak(samples + start, length);
+	}
+
+	const float noiseFloor = LM_NoiseLevel(blockPeaks, blockCount) * LM_F2F_NOISEMARGIN;
+
+	int polarity = 0;			// of the next pulse, 0 when either will do
+	bool pending = false;		// a pulse is being followed to its peak
+	size_t pulse = 0;
+	float pulsePeak = 0.0f;
+
+	for (size_t block = 0; block < blockCount; block++)
+	{
+		size_t first = (block > LM_F2F_ENVELOPEBLOCKS) ? block - LM_F2F_ENVELOPEBLOCKS : 0;
+		size_t last = (block + LM_F2F_ENVELOPEBLOCKS < blockCount) ? block + LM_F2F_ENVELOPEBLOCKS : blockCount - 1;
+		float envelope = 0.0f;
+
+		for (size_t neighbour = first; neighbour <= last; neighbour++)
+			envelope = (blockPeaks[neighbour] > envelope) ? blockPeaks[neighbour] : envelope;
+
+		float threshold = envelope * LM_F2F_THRESHOLD;
+
+		if (threshold < noiseFloor)
+			threshold = noiseFloor;
+
+		if (blockPeaks[block] < threshold || threshold <= 0.0f)
+		{
+			if (pending)
+				LM_AddTransition(transitions, LM_InterpolatePeak(samples, count, pulse));
+
+			pending = false;
+			polarity = 0;
+			continue;
+		}
+
+		size_t end = (block + 1) * LM_F2F_BLOCKSIZE;
+
+		if (end > count)
+			end = count;
+
+		for (size_t i = block * LM_F2F_BLOCKSIZE; i < end; i++)
+		{
+			float sample = samples[i];
+
+			if (polarity == 0)
+			{
+				if (sample > threshold)
+					polarity = 1;
+				else if (sample < -threshold)
+					polarity = -1;
+				else
+					continue;
+			}
+
+			float value = polarity * sample;
+
+			if (pending)
+			{
+				if (value > pulsePeak)
+				{
+					pulse = i;
+					pulsePeak = value;
+				}
+				else if (value < pulsePeak * LM_F2F_PULSERELEASE)
+				{
+					LM_AddTransition(transitions, LM_InterpolatePeak(samples, count, pulse));
+					pending = false;
+					polarity = -polarity;
+				}
+			}
+			else if (value > threshold)
+			{
+				pending = true;
+				pulse = i;
+				pulsePeak = value;
+			}
+		}
+	}
+
+	if (pending)
+		LM_AddTransition(transitions, LM_InterpolatePeak(samples, count, pulse));
+
+	free(blockPeaks);
+}
+
+static double LM_MedianInterval(const double * positions, int count)
+{
+	double intervals[LM_F2F_LEADINGINTERVALS];
+
+	for (int i = 0; i < count; i++)
+	{
+		double interval = positions[i + 1] - positions[i];
+		int j = i;
+
+		for (; j > 0 && intervals[j - 1] > interval; j--)
+			intervals[j] = intervals[j - 1];
+
+		intervals[j] = interval;
+	}
+
+	return intervals[count / 2];
+}
+
+// Decodes one swipe from the transitions that start it and returns how many
+// transitions it took, so the next swipe starts after them.
+static size_t LM_DecodeSwipe(const double * positions, size_t count, double maxGap, unsigned int sampleRate, LM_F2FSwipeCallback callback, void * context, LM_F2FStats * stats)
+{
+	// the first interval may be cut short as the card meets the head
+	if (count < LM_F2F_LEADINGINTERVALS + 2)
+		return count;
+
+	double period = LM_MedianInterval(positions + 1, LM_F2F_LEADINGINTERVALS);
+
+	static char bits[LM_F2F_MAXBITS / 8];
+	memset(bits, 0, sizeof(bits));
+
+	int bitCount = 0;
+	size_t i = 0;
+
+	while (i + 1 < count)
+	{
+		double interval = positions[i + 1] - positions[i];
+
+		if (interval > maxGap || interval > period * LM_F2F_GAPPERIODS)
+			break;
+
+		int bit = 0;
+		double length = interval;
+
+		if (interval < period * LM_F2F_SHORTINTERVAL && i + 2 < count)
+		{
+			bit = 1;
+			length = positions[i + 2] - positions[i];
+			i += 2;
+		}
+		else
+			i += 1;
+
+		period += (length - period) * LM_F2F_PERIODGAIN;
+
+		if (bitCount < LM_F2F_MAXBITS)
+		{
+			if (bit)
+				bits[bitCount / 8] |= 0x80 >> (bitCount % 8);
+
+			bitCount++;
+		}
+	}
+
+	if (bitCount >= LM_F2F_MINBITS)
+	{
+		stats->swipeCount++;
+		callback(bits, bitCount, positions[0] / sampleRate, context);
+	}
+
+	return i + 1;
+}
+
+void LM_DecodeF2F(LM_PcmSamples * pcm, LM_F2FSwipeCallback callback, void * context, LM_F2FStats * stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	float * filtered = (float *)malloc((pcm->count ? pcm->count : 1) * sizeof(float));
+
+	if (!filtered)
+		return;
+
+	LM_FilterSamples(filtered, pcm->samples, pcm->count);
+
+	free(pcm->samples);
+	pcm->samples = filtered;
+
+	LM_Transitions transitions;
+	memset(&transitions, 0, sizeof(transitions));
+
+	LM_FindTransitions(pcm->samples, pcm->count, &transitions);
+
+	stats->transitionCount = transitions.count;
+
+	const double maxGap = LM_F2F_MAXGAP * pcm->sampleRate;
+
+	for (size_t start = 0; start < transitions.count; )
+		start += LM_DecodeSwipe(transitions.positions + start, transitions.count - start, maxGap, pcm->sampleRate, callback, context, stats);
+
+	free(transitions.positions);
+}
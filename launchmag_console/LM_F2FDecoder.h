@@ -0,0 +1,45 @@
+#ifndef LM_F2FDECODER_H_
+#define LM_F2FDECODER_H_
+
+#include <stddef.h>
+
+// Decodes swipes from a recording of the raw signal of a magnetic read head,
+// taken through an audio input or an ADC, rather than from the clock and
+// data lines of a reader chip.
+//
+// The head gives a pulse at every flux transition, alternating in polarity.
+// F2F (Aiken biphase) puts a transition at every bit boundary and another
+// in the middle of each 1 bit, so a 0 is one long interval between pulses
+// and a 1 two short ones. The signal is smoothed, pulses above a threshold
+// that follows the local amplitude are taken as transitions, and the bit
+// period is tracked as it goes, starting from the clocking zeros ahead of
+// the data, so swipes that speed up or slow down still decode. A pause of
+// several bit periods ends a swipe.
+
+#define LM_F2F_MAXBITS			16384		// bits kept per swipe
+
+struct LM_PcmSamples
+{
+	float *			samples;		// first channel only, full scale is 1
+	size_t			count;
+	unsigned int	sampleRate;
+};
+
+// Reads integer PCM of 8 to 32 bits or 32 bit float from a WAV file.
+bool LM_ReadWavFile(const char * path, LM_PcmSamples * pcm);
+void LM_FreePcmSamples(LM_PcmSamples * pcm);
+
+// Called once per swipe with its bits packed first bit first, high bit of
+// each byte first, as the reader sends them.
+typedef void (*LM_F2FSwipeCallback)(const char * bits, int bitCount, double startSeconds, void * context);
+
+struct LM_F2FStats
+{
+	long long	transitionCount;
+	long long	swipeCount;
+};
+
+// Smooths pcm in place and calls back for each swipe in order.
+void LM_DecodeF2F(LM_PcmSamples * pcm, LM_F2FSwipeCallback callback, void * context, LM_F2FStats * stats);
+
+#endif /*LM_F2FDECODER_H_*/
@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#endif
+
+#include "LM_Metrics.h"
+#include "LM_Clock.h"
+#include "LM_Socket.h"
+
+#ifdef WIN32
+#define LM_THREADLOCAL		__declspec(thread)
+#else
+#define LM_THREADLOCAL		__thread
+#endif
+
+#define LM_METRICS_TEXTSIZE			(64 * 1024)
+#define LM_METRICS_REQUESTSIZE		4096
+#define LM_METRICS_REQUESTTIMEOUT	1		// seconds a client has to send its request
+#define LM_METRICS_BACKLOG			16
+
+// Upper bounds of the decode time buckets in nanoseconds.
+static const long long LM_METRICS_DECODEBOUNDS[LM_METRICS_DECODEBUCKETS] = {
+	1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+	1000000, 2500000, 5000000, 10000000,
+};
+
+static const char * LM_METRICS_TRACKLABELS[LM_METRICS_TRACKS] = { "1", "2", "3" };
+
+static LM_THREADLOCAL LM_MetricsSlot * LM_threadSlot;
+static LM_THREADLOCAL const LM_Metrics * LM_threadSlotOwner;
+
+void LM_InitializeMetrics(LM_Metrics * metrics)
+{
+	memset(metrics, 0, sizeof(*metrics));
+	metrics->started = LM_WallClockTime();
+}
+
+LM_MetricsSlot * LM_MetricsThreadSlot(LM_Metrics * metrics)
+{
+	if (LM_threadSlotOwner == metrics)
+		return LM_threadSlot;
+
+#ifdef WIN32
+	long index = _InterlockedIncrement(&metrics->slotCount) - 1;
+#else
+	long index = __atomic_fetch_add(&metrics->slotCount, 1, __ATOMIC_RELAXED);
+#endif
+
+	LM_threadSlotOwner = metrics;
+	LM_threadSlot = (index < LM_METRICS_MAXSLOTS) ? &metrics->slots[index] : NULL;
+
+	return LM_threadSlot;
+}
+
+void LM_CountDecodeTime(LM_MetricsSlot * slot, long long nanoseconds)
+{
+	int bucket = 0;
+
+	while (bucket < LM_METRICS_DECODEBUCKETS && nanoseconds > LM_METRICS_DECODEBOUNDS[bucket])
+		bucket++;
+
+	LM_CountMetric(&slot->decodeBuckets[bucket], 1);
+	LM_CountMetric(&slot->decodeCount, 1);
+	LM_CountMetric(&slot->decodeSum, nanoseconds > 0 ? nanoseconds : 0);
+}
+
+// Sums one counter across the slots in use; offset is its place in a slot.
+static uint64_t LM_SumMetric(const LM_Metrics * metrics, size_t offset)
+{
+	long slotCount = metrics->slotCount;
+	uint64_t total = 0;
+
+	if (slotCount > LM_METRICS_MAXSLOTS)
+		slotCount = LM_METRICS_MAXSLOTS;
+
+	for (long i = 0; i < slotCount; i++)
+	{
+		const volatile uint64_t * counter = (const volatile uint64_t *)((const char *)&metrics->slots[i] + offset);
+#ifdef WIN32
+		total += *counter;
+#else
+		total += __atomic_load_n(counter, __ATOMIC_RELAXED);
+#endif
+	}
+
+	return total;
+}
+
+#define LM_METRIC_OFFSET(member)	offsetof(LM_MetricsSlot, member)
+
+struct LM_MetricsText
+{
+	char *	end;
+	size_t	left;
+	bool	overflow;
+};
+
+static void LM_AppendMetrics(LM_MetricsText * text, const char * format, ...)
+{
+	va_list arguments;
+	va_start(arguments, format);
+	int length = vsnprintf(text->end, text->left, format, arguments);
+	va_end(arguments);
+
+	if (length < 0 || (size_t)length >= text->left)
+	{
+		text->overflow = true;
+		text->left = 0;
+		return;
+	}
+
+	text->end += length;
+	text->left -= length;
+}
+
+static void LM_AppendTrackCounter(LM_MetricsText * text, const LM_Metrics * metrics, const char * name, const char * help, size_t offset)
+{
+	LM_AppendMetrics(text, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+
+	for (int track = 0; track < LM_METRICS_TRACKS; track++)
+	{
+		LM_AppendMetrics(text, "%s{track=\"%s\"} %llu\n", name, LM_METRICS_TRACKLABELS[track],
+			(unsigned long long)LM_SumMetric(metrics, offset + track * sizeof(uint64_t)));
+	}
+}
+
+static void LM_AppendCounter(LM_MetricsText * text, const LM_Metrics * metrics, const char * name, const char * help, size_t offset)
+{
+	LM_AppendMetrics(text, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name,
+		(unsigned long long)LM_SumMetric(metrics, offset));
+}
+
+size_t LM_FormatMetrics(const LM_Metrics * metrics, char * buffer, size_t size)
+{
+	LM_MetricsText text = { buffer, size, false };
+
+	LM_AppendMetrics(&text, "# HELP launchmag_start_time_seconds When the console started counting.\n"
+		"# TYPE launchmag_start_time_seconds gauge\nlaunchmag_start_time_seconds %lld\n", metrics->started / LM_NANOSECONDS_PER_SECOND);
+
+	LM_AppendCounter(&text, metrics, "launchmag_bytes_total", "Packet bytes received from the reader.", LM_METRIC_OFFSET(bytes));
+	LM_AppendTrackCounter(&text, metrics, "launchmag_swipes_total", "Tracks read, successful or not.", LM_METRIC_OFFSET(swipes));
+	LM_AppendTrackCounter(&text, metrics, "launchmag_read_errors_total", "Tracks that failed parity, LRC or sentinel checks.", LM_METRIC_OFFSET(readErrors));
+	LM_AppendTrackCounter(&text, metrics, "launchmag_reversed_swipes_total", "Tracks read in the reverse direction.", LM_METRIC_OFFSET(reversed));
+	LM_AppendTrackCounter(&text, metrics, "launchmag_corrected_swipes_total", "Tracks with a bit error repaired using the LRC.", LM_METRIC_OFFSET(corrected));
+	LM_AppendTrackCounter(&text, metrics, "launchmag_salvaged_swipes_total", "Tracks whose start sentinel was found despite bit errors.", LM_METRIC_OFFSET(salvaged));
+	LM_AppendTrackCounter(&text, metrics, "launchmag_read_quality_points_total", "Sum of read quality scores, 0 to 100 per track; over swipes_total, the average.", LM_METRIC_OFFSET(qualityPoints));
+	LM_AppendTrackCounter(&text, metrics, "launchmag_track_buffer_overflows_total", "Tracks longer than the track buffer.", LM_METRIC_OFFSET(overflows));
+	LM_AppendCounter(&text, metrics, "launchmag_duplicate_swipes_total", "Repeat swipes within the dedupe window.", LM_METRIC_OFFSET(duplicates));
+	LM_AppendCounter(&text, metrics, "launchmag_luhn_failures_total", "PANs whose check digit was wrong.", LM_METRIC_OFFSET(luhnFailures));
+
+	LM_AppendMetrics(&text, "# HELP launchmag_decode_seconds Time to decode a track after its STOP byte.\n# TYPE launchmag_decode_seconds histogram\n");
+
+	uint64_t cumulative = 0;
+
+	for (int bucket = 0; bucket <= LM_METRICS_DECODEBUCKETS; bucket++)
+	{
+		cumulative += LM_SumMetric(metrics, LM_METRIC_OFFSET(decodeBuckets) + bucket * sizeof(uint64_t));
+
+		if (bucket < LM_METRICS_DECODEBUCKETS)
+			LM_AppendMetrics(&text, "launchmag_decode_seconds_bucket{le=\"%g\"} %llu\n", LM_METRICS_DECODEBOUNDS[bucket] / 1e9, (unsigned long long)cumulative);
+		else
+			LM_AppendMetrics(&text, "launchmag_decode_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)cumulative);
+	}
+
+	LM_AppendMetrics(&text, "launchmag_decode_seconds_sum %.9f\nlaunchmag_decode_seconds_count %llu\n",
+		LM_SumMetric(metrics, LM_METRIC_OFFSET(decodeSum)) / 1e9,
+		(unsigned long long)LM_SumMetric(metrics, LM_METRIC_OFFSET(decodeCount)));
+
+	return text.overflow ? 0 : (size_t)(text.end - buffer);
+}
+
+#ifdef WIN32
+
+LM_MetricsServer * LM_OpenMetricsServer(const LM_Metrics *, const char *)
+{
+	return NULL;
+}
+
+void LM_CloseMetricsServer(LM_MetricsServer *)
+{
+}
+
+#else
+
+struct LM_MetricsServer
+{
+	const LM_Metrics *	metrics;
+	int					listenSocket;
+	int					wakePipe[2];		// wakes the server thread to stop
+	pthread_t			thread;
+	char				path[sizeof(((struct sockaddr_un *)0)->sun_path)];	// empty for TCP
+	char				text[LM_METRICS_TEXTSIZE];
+};
+
+// Reads the request up to its blank line and answers it, whatever it asked.
+static void LM_AnswerScrape(LM_MetricsServer * server, int client)
+{
+	struct timeval timeout = { LM_METRICS_REQUESTTIMEOUT, 0 };
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	char request[LM_METRICS_REQUESTSIZE];
+	size_t received = 0;
+
+	while (received < sizeof(request) - 1)
+	{
+		ssize_t count = recv(client, request + received, sizeof(request) - 1 - received, 0);
+
+		if (count <= 0)
+			break;
+
+		received += count;
+		request[received] = 0;
+
+		if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+			break;
+	}
+
+	size_t length = LM_FormatMetrics(server->metrics, server->text, sizeof(server->text));
+	char header[256];
+
+	int headerLength = snprintf(header, sizeof(header),
+		"HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+		length ? "200 OK" : "500 Internal Server Error", (unsigned long)length);
+
+	if (LM_SendAll(client, header, headerLength))
+		LM_SendAll(client, server->text, length);
+}
+
+static void * LM_MetricsServerMain(void * argument)
+{
+	LM_MetricsServer * server = (LM_MetricsServer *)argument;
+
+	for (;;)
+	{
+		struct pollfd descriptors[2];
+
+		descriptors[0].fd = server->wakePipe[0];
+		descriptors[0].events = POLLIN;
+		descriptors[1].fd = server->listenSocket;
+		descriptors[1].events = POLLIN;
+
+		if (poll(descriptors, 2, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		if (descriptors[0].revents)
+			break;
+
+		if (descriptors[1].revents & POLLIN)
+		{
+			int client = accept(server->listenSocket, NULL, NULL);
+
+			if (client < 0)
+				continue;
+
+			LM_NoSigPipe(client);
+			LM_AnswerScrape(server, client);
+			close(client);
+		}
+	}
+
+	return NULL;
+}
+
+static int LM_ListenMetrics(LM_MetricsServer * server, const char * address)
+{
+	bool isPort = *address && strspn(address, "0123456789") == strlen(address);
+
+	if (isPort)
+	{
+		long port = strtol(address, NULL, 10);
+
+		if (port < 1 || port > 65535)
+			return -1;
+
+		int listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (listenSocket < 0)
+			return -1;
+
+		int one = 1;
+		setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		struct sockaddr_in inet;
+		memset(&inet, 0, sizeof(inet));
+		inet.sin_family = AF_INET;
+		inet.sin_port = htons((unsigned short)port);
+		inet.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		if (	bind(listenSocket, (struct sockaddr *)&inet, sizeof(inet)) != 0
+			||	listen(listenSocket, LM_METRICS_BACKLOG) != 0)
+		{
+			close(listenSocket);
+			return -1;
+		}
+
+		return listenSocket;
+	}
+
+	if (strlen(address) >= sizeof(server->path))
+		return -1;
+
+	int listenSocket = LM_ListenUnixSocket(address, LM_METRICS_BACKLOG);
+
+	if (listenSocket < 0)
+		return -1;
+
+	strcpy(server->path, address);
+
+	return listenSocket;
+}
+
+LM_MetricsServer * LM_OpenMetricsServer(const LM_Metrics * metrics, const char * address)
+{
+	LM_MetricsServer * server = (LM_MetricsServer *)calloc(1, sizeof(LM_MetricsServer));
+
+	if (!server)
+		return NULL;
+
+	server->metrics = metrics;
+	server->wakePipe[0] = server->wakePipe[1] = -1;
+	server->listenSocket = LM_ListenMetrics(server, address);
+
+	if (	server->listenSocket < 0
+		||	!LM_OpenWakePipe(server->wakePipe)
+		||	pthread_create(&server->thread, NULL, LM_MetricsServerMain, server) != 0)
+	{
+		if (server->listenSocket >= 0)
+			close(server->listenSocket);
+
+		LM_CloseWakePipe(server->wakePipe);
+
+		if (server->path[0])
+			unlink(server->path);
+
+		free(server);
+		return NULL;
+	}
+
+	return server;
+}
+
+void LM_CloseMetricsServer(LM_MetricsServer * server)
+{
+	LM_WakeThread(server->wakePipe);
+	pthread_join(server->thread, NULL);
+
+	close(server->listenSocket);
+	LM_CloseWakePipe(server->wakePipe);
+
+	if (server->path[0])
+		unlink(server->path);
+
+	free(server);
+}
+
+#endif
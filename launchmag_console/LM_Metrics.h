@@ -0,0 +1,77 @@
+#ifndef LM_METRICS_H_
+#define LM_METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef WIN32
+#include <intrin.h>
+#endif
+
+// Reader health and decoder counters, served in the Prometheus text format.
+//
+// Every thread that counts gets a slot of its own, on its own cache lines,
+// and is the only writer of it, so counting is a plain load and store with
+// no lock and no shared cache line. A scrape sums the slots; it may see a
+// swipe counted in one metric and not yet in the next, never a torn value.
+
+#define LM_METRICS_MAXSLOTS			64		// threads beyond this are not counted
+#define LM_METRICS_TRACKS			3
+#define LM_METRICS_DECODEBUCKETS	13		// finite decode time buckets, +Inf is implied
+
+struct LM_MetricsSlot
+{
+	volatile uint64_t	bytes;
+	volatile uint64_t	swipes[LM_METRICS_TRACKS];
+	volatile uint64_t	readErrors[LM_METRICS_TRACKS];		// parity, LRC or sentinel failures
+	volatile uint64_t	reversed[LM_METRICS_TRACKS];
+	volatile uint64_t	corrected[LM_METRICS_TRACKS];
+	volatile uint64_t	salvaged[LM_METRICS_TRACKS];
+	volatile uint64_t	overflows[LM_METRICS_TRACKS];		// track buffer overflows
+	volatile uint64_t	qualityPoints[LM_METRICS_TRACKS];	// sum of read quality scores
+	volatile uint64_t	duplicates;
+	volatile uint64_t	luhnFailures;
+	volatile uint64_t	decodeBuckets[LM_METRICS_DECODEBUCKETS + 1];
+	volatile uint64_t	decodeCount;
+	volatile uint64_t	decodeSum;								// nanoseconds
+	char				padding[64];						// keeps the next slot off this one's last line
+};
+
+struct LM_Metrics
+{
+	long long			started;			// LM_WallClockTime() when counting began
+	volatile long		slotCount;
+	LM_MetricsSlot		slots[LM_METRICS_MAXSLOTS];
+};
+
+void LM_InitializeMetrics(LM_Metrics * metrics);
+
+// The calling thread's slot, taken on first use. NULL once all slots are
+// taken, in which case the thread counts nothing.
+LM_MetricsSlot * LM_MetricsThreadSlot(LM_Metrics * metrics);
+
+// For the owning thread only.
+inline void LM_CountMetric(volatile uint64_t * counter, uint64_t amount)
+{
+#ifdef WIN32
+	*counter = *counter + amount;		// aligned 64 bit accesses are atomic on x64
+#else
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+#endif
+}
+
+void LM_CountDecodeTime(LM_MetricsSlot * slot, long long nanoseconds);
+
+// Writes the exposition text into buffer; returns its length, or 0 if it
+// did not fit.
+size_t LM_FormatMetrics(const LM_Metrics * metrics, char * buffer, size_t size);
+
+struct LM_MetricsServer;
+
+// Answers every HTTP request on address with the metrics. An address of
+// digits alone is a TCP port on 127.0.0.1; anything else is the path of a
+// Unix domain socket. Returns NULL on failure, and always on Windows.
+LM_MetricsServer * LM_OpenMetricsServer(const LM_Metrics * metrics, const char * address);
+void LM_CloseMetricsServer(LM_MetricsServer * server);
+
+#endif /*LM_METRICS_H_*/
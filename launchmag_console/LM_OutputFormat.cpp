@@ -0,0 +1,497 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "LM_OutputFormat.h"
+#include "LM_DecodeFlags.h"
+#include "LM_Clock.h"
+
+#define LM_OUTPUT_RECORDOVERHEAD	512		// bytes a record takes besides its data
+#define LM_OUTPUT_ESCAPEDCHAR		6		// longest escape of one data character, \u00XX
+#define LM_OUTPUT_MAXDATA			((LM_OUTPUT_BUFFERSIZE - LM_OUTPUT_RECORDOVERHEAD) / LM_OUTPUT_ESCAPEDCHAR)
+
+#define LM_NANOSECONDS_PER_DAY		(86400 * LM_NANOSECONDS_PER_SECOND)
+
+static const char LM_CSV_HEADER[] = "time,timestamp_ns,device,track,valid,error,direction,flags,confidence,"
+	"quality,leading_zeros,trailing_zeros,parity_errors,lrc,attempts,plausible_length,decode_ns,data";
+static char * LM_FormatText(char * end, const char * text);
+
+static const char LM_CSV_TIMINGHEADER[] = ",start_ns,last_data_ns,stop_ns,decoded_ns";
+
+bool LM_ParseOutputFormat(const char * name, LM_OutputFormat * format)
+{
+	static const struct
+	{
+		const char *		name;
+		LM_OutputFormat		format;
+	} formats[] = {
+		{ "text",	LM_OUTPUTFORMAT_TEXT },
+		{ "jsonl",	LM_OUTPUTFORMAT_JSONL },
+		{ "csv",	LM_OUTPUTFORMAT_CSV },
+		{ "binary",	LM_OUTPUTFORMAT_BINARY },
+	};
+
+	for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+	{
+		if (strcmp(name, formats[i].name) == 0)
+		{
+			*format = formats[i].format;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void LM_OpenOutputWriter(LM_OutputWriter * writer, FILE * file, LM_OutputFormat format, bool flushEachRecord, bool timingFields)
+{
+	writer->file = file;
+	writer->format = format;
+	writer->flushEachRecord = flushEachRecord;
+	writer->timingFields = timingFields;
+	writer->timed = false;
+	writer->encodeTime = 0;
+	writer->recordCount = 0;
+	writer->size = 0;
+
+	if (format == LM_OUTPUTFORMAT_CSV)
+	{
+		char * end = LM_FormatText(writer->buffer, LM_CSV_HEADER);
+
+		if (timingFields)
+			end = LM_FormatText(end, LM_CSV_TIMINGHEADER);
+
+		*end++ = '\n';
+		writer->size = end - writer->buffer;
+	}
+}
+
+void LM_CloseOutputWriter(LM_OutputWriter * writer)
+{
+	LM_FlushOutputWriter(writer);
+}
+
+void LM_FlushOutputWriter(LM_OutputWriter * writer)
+{
+	if (writer->size)
+	{
+		fwrite(writer->buffer, 1, writer->size, writer->file);
+		writer->size = 0;
+	}
+
+	fflush(writer->file);
+}
+
+static char * LM_FormatUnsigned(char * end, unsigned long long value)
+{
+	char digits[20];
+	int count = 0;
+
+	do
+	{
+		digits[count++] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value);
+
+	while (count)
+		*end++ = digits[--count];
+
+	return end;
+}
+
+static char * LM_FormatInteger(char * end, long long value)
+{
+	if (value < 0)
+	{
+		*end++ = '-';
+		return LM_FormatUnsigned(end, 0ULL - (unsigned long long)value);
+	}
+
+	return LM_FormatUnsigned(end, (unsigned long long)value);
+}
+
+static char * LM_FormatDigits(char * end, int value, int width)
+{
+	for (int i = width - 1; i >= 0; i--)
+	{
+		end[i] = (char)('0' + value % 10);
+		value /= 10;
+	}
+
+	return end + width;
+}
+
+static char * LM_FormatText(char * end, const char * text)
+{
+	while (*text)
+		*end++ = *text++;
+
+	return end;
+}
+
+// ISO 8601 UTC with milliseconds. Swipes come in bursts on the same day, so
+// the date is worked out once per day.
+static char * LM_FormatTime(char * end, long long timestamp)
+{
+	static long long cachedDay = -1;
+	static char cachedDate[11];
+
+	long long day = timestamp / LM_NANOSECONDS_PER_DAY;
+	long long rest = timestamp % LM_NANOSECONDS_PER_DAY;
+
+	if (rest < 0)
+	{
+		day--;
+		rest += LM_NANOSECONDS_PER_DAY;
+	}
+
+	if (day != cachedDay)
+	{
+		// days since 1970-01-01 to a civil date
+		long long z = day + 719468;
+		long long era = (z >= 0 ? z : z - 146096) / 146097;
+		long long dayOfEra = z - era * 146097;
+		long long yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+		long long dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+		long long monthIndex = (5 * dayOfYear + 2) / 153;
+		int dayOfMonth = (int)(dayOfYear - (153 * monthIndex + 2) / 5 + 1);
+		int month = (int)(monthIndex < 10 ? monthIndex + 3 : monthIndex - 9);
+		int year = (int)(yearOfEra + era * 400 + (month <= 2));
+
+		char * date = LM_FormatDigits(cachedDate, year, 4);
+		*date++ = '-';
+		date = LM_FormatDigits(date, month, 2);
+		*date++ = '-';
+		LM_FormatDigits(date, dayOfMonth, 2);
+
+		cachedDay = day;
+	}
+
+	int seconds = (int)(rest / LM_NANOSECONDS_PER_SECOND);
+
+	memcpy(end, cachedDate, 10);
+	end += 10;
+	*end++ = 'T';
+	end = LM_FormatDigits(end, seconds / 3600, 2);
+	*end++ = ':';
+	end = LM_FormatDigits(end, (seconds / 60) % 60, 2);
+	*end++ = ':';
+	end = LM_FormatDigits(end, seconds % 60, 2);
+	*end++ = '.';
+	end = LM_FormatDigits(end, (int)((rest % LM_NANOSECONDS_PER_SECOND) / LM_NANOSECONDS_PER_MILLISECOND), 3);
+	*end++ = 'Z';
+
+	return end;
+}
+
+static char * LM_FormatJsonString(char * end, const char * data, int length)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	*end++ = '"';
+
+	for (int i = 0; i < length; i++)
+	{
+		unsigned char character = (unsigned char)data[i];
+
+		if (character == '"' || character == '\\')
+		{
+			*end++ = '\\';
+			*end++ = (char)character;
+		}
+		else if (character < 0x20 || character >= 0x7F)
+		{
+			end = LM_FormatText(end, "\\u00");
+			*end++ = hex[character >> 4];
+			*end++ = hex[character & 0x0F];
+		}
+		else
+			*end++ = (char)character;
+	}
+
+	*end++ = '"';
+
+	return end;
+}
+
+// Data is always quoted, since track 1 may hold commas and quotes.
+static char * LM_FormatCsvString(char * end, const char * data, int length)
+{
+	*end++ = '"';
+
+	for (int i = 0; i < length; i++)
+	{
+		if (data[i] == '"')
+			*end++ = '"';
+
+		*end++ = data[i];
+	}
+
+	*end++ = '"';
+
+	return end;
+}
+
+static const char * LM_OutputDirection(const LM_OutputRecord * record)
+{
+	return (record->flags & LM_DECODEFLAG_REVERSED) ? "reverse" : "forward";
+}
+
+// A stamp or count, or null where there is none.
+static char * LM_FormatJsonStamp(char * end, const char * name, long long stamp)
+{
+	end = LM_FormatText(end, name);
+
+	return (stamp >= 0) ? LM_FormatInteger(end, stamp) : LM_FormatText(end, "null");
+}
+
+static char * LM_FormatCsvStamp(char * end, long long stamp)
+{
+	*end++ = ',';
+
+	return (stamp >= 0) ? LM_FormatInteger(end, stamp) : end;
+}
+
+static char * LM_FormatJsonQuality(char * end, const LM_OutputRecord * record)
+{
+	const LM_ReadQuality * quality = record->quality;
+
+	end = LM_FormatText(end, ",\"quality\":");
+	end = LM_FormatInteger(end, quality->score);
+	end = LM_FormatJsonStamp(end, ",\"leading_zeros\":", quality->leadingZeros);
+	end = LM_FormatJsonStamp(end, ",\"trailing_zeros\":", quality->trailingZeros);
+	end = LM_FormatJsonStamp(end, ",\"parity_errors\":", quality->parityErrors);
+	end = LM_FormatText(end, ",\"lrc\":");
+	end = LM_FormatText(end, !record->valid ? "null" : (record->flags & LM_DECODEFLAG_LRCVALID) ? "true" : "false");
+	end = LM_FormatText(end, ",\"attempts\":");
+	end = LM_FormatInteger(end, quality->attempts);
+	end = LM_FormatText(end, ",\"plausible_length\":");
+	end = LM_FormatText(end, !record->valid ? "null" : quality->plausibleLength ? "true" : "false");
+
+	return end;
+}
+
+// Empty fields on a read error, like the error column on a good read.
+static char * LM_FormatCsvQuality(char * end, const LM_OutputRecord * record)
+{
+	const LM_ReadQuality * quality = record->quality;
+
+	end = LM_FormatInteger(end, quality->score);
+	end = LM_FormatCsvStamp(end, quality->leadingZeros);
+	end = LM_FormatCsvStamp(end, quality->trailingZeros);
+	end = LM_FormatCsvStamp(end, quality->parityErrors);
+	end = LM_FormatText(end, !record->valid ? "," : (record->flags & LM_DECODEFLAG_LRCVALID) ? ",1" : ",0");
+	*end++ = ',';
+	end = LM_FormatInteger(end, quality->attempts);
+	end = LM_FormatText(end, !record->valid ? "," : quality->plausibleLength ? ",1" : ",0");
+	*end++ = ',';
+
+	return end;
+}
+
+static uint8_t LM_BinaryCount(int count)
+{
+	return (count < 0) ? 255 : (count > 254) ? 254 : (uint8_t)count;
+}
+
+// Rounded to tenths, the precision of every speed figure.
+static char * LM_FormatTenths(char * end, double value)
+{
+	long long tenths = (long long)(value * 10.0 + (value < 0 ? -0.5 : 0.5));
+
+	if (tenths < 0)
+	{
+		*end++ = '-';
+		tenths = -tenths;
+	}
+
+	end = LM_FormatInteger(end, tenths / 10);
+	*end++ = '.';
+	*end++ = (char)('0' + tenths % 10);
+
+	return end;
+}
+
+static char * LM_FormatJsonRecord(char * end, const LM_OutputWriter * writer, const LM_OutputRecord * record, int length)
+{
+	end = LM_FormatText(end, "{\"time\":\"");
+	end = LM_FormatTime(end, record->timestamp);
+	end = LM_FormatText(end, "\",\"timestamp_ns\":");
+	end = LM_FormatInteger(end, record->timestamp);
+	end = LM_FormatText(end, ",\"device\":");
+	end = LM_FormatUnsigned(end, record->deviceId);
+	end = LM_FormatText(end, ",\"track\":");
+	end = LM_FormatInteger(end, record->track + 1);
+	end = LM_FormatText(end, record->valid ? ",\"valid\":true,\"error\":null" : ",\"valid\":false,\"error\":\"read error\"");
+	end = LM_FormatText(end, ",\"direction\":\"");
+	end = LM_FormatText(end, LM_OutputDirection(record));
+	end = LM_FormatText(end, "\",\"corrected\":");
+	end = LM_FormatText(end, (record->flags & LM_DECODEFLAG_CORRECTED) ? "true" : "false");
+	end = LM_FormatText(end, ",\"salvaged\":");
+	end = LM_FormatText(end, (record->flags & LM_DECODEFLAG_SALVAGED) ? "true" : "false");
+	end = LM_FormatText(end, ",\"luhn\":");
+	end = LM_FormatText(end, !(record->flags & LM_DECODEFLAG_LUHNCHECKED) ? "null" : (record->flags & LM_DECODEFLAG_LUHNVALID) ? "true" : "false");
+	end = LM_FormatText(end, ",\"duplicate\":");
+	end = LM_FormatText(end, (record->flags & LM_DECODEFLAG_DUPLICATE) ? "true" : "false");
+	end = LM_FormatText(end, ",\"flags\":");
+	end = LM_FormatInteger(end, record->flags);
+	end = LM_FormatText(end, ",\"confidence\":");
+	end = LM_FormatInteger(end, record->confidence);
+	end = LM_FormatJsonQuality(end, record);
+	end = LM_FormatText(end, ",\"decode_ns\":");
+
+	if (record->decodeTime >= 0)
+		end = LM_FormatInteger(end, record->decodeTime);
+	else
+		end = LM_FormatText(end, "null");
+
+	if (writer->timingFields && record->timing)
+	{
+		end = LM_FormatJsonStamp(end, ",\"start_ns\":", record->timing->start);
+		end = LM_FormatJsonStamp(end, ",\"last_data_ns\":", record->timing->lastData);
+		end = LM_FormatJsonStamp(end, ",\"stop_ns\":", record->timing->stop);
+		end = LM_FormatJsonStamp(end, ",\"decoded_ns\":", record->timing->decoded);
+	}
+
+	if (record->speed)
+	{
+		end = LM_FormatText(end, ",\"speed_mm_s\":");
+		end = LM_FormatTenths(end, record->speed->meanSpeed);
+		end = LM_FormatText(end, ",\"speed_min_mm_s\":");
+		end = LM_FormatTenths(end, record->speed->minSpeed);
+		end = LM_FormatText(end, ",\"speed_max_mm_s\":");
+		end = LM_FormatTenths(end, record->speed->maxSpeed);
+		end = LM_FormatText(end, ",\"acceleration_mm_s2\":");
+		end = LM_FormatTenths(end, record->speed->acceleration);
+		end = LM_FormatText(end, ",\"jitter_pct\":");
+		end = LM_FormatTenths(end, record->speed->jitter);
+	}
+
+	end = LM_FormatText(end, ",\"data\":");
+
+	if (record->valid)
+		end = LM_FormatJsonString(end, record->data, length);
+	else
+		end = LM_FormatText(end, "null");
+
+	end = LM_FormatText(end, "}\n");
+
+	return end;
+}
+
+static char * LM_FormatCsvRecord(char * end, const LM_OutputWriter * writer, const LM_OutputRecord * record, int length)
+{
+	end = LM_FormatTime(end, record->timestamp);
+	*end++ = ',';
+	end = LM_FormatInteger(end, record->timestamp);
+	*end++ = ',';
+	end = LM_FormatUnsigned(end, record->deviceId);
+	*end++ = ',';
+	end = LM_FormatInteger(end, record->track + 1);
+	end = LM_FormatText(end, record->valid ? ",1,," : ",0,read error,");
+	end = LM_FormatText(end, LM_OutputDirection(record));
+	*end++ = ',';
+	end = LM_FormatInteger(end, record->flags);
+	*end++ = ',';
+	end = LM_FormatInteger(end, record->confidence);
+	*end++ = ',';
+	end = LM_FormatCsvQuality(end, record);
+
+	if (record->decodeTime >= 0)
+		end = LM_FormatInteger(end, record->decodeTime);
+
+	*end++ = ',';
+
+	if (record->valid)
+		end = LM_FormatCsvString(end, record->data, length);
+
+	if (writer->timingFields)
+	{
+		const LM_SwipeTiming * timing = record->timing;
+
+		end = LM_FormatCsvStamp(end, timing ? timing->start : -1);
+		end = LM_FormatCsvStamp(end, timing ? timing->lastData : -1);
+		end = LM_FormatCsvStamp(end, timing ? timing->stop : -1);
+		end = LM_FormatCsvStamp(end, timing ? timing->decoded : -1);
+	}
+
+	*end++ = '\n';
+
+	return end;
+}
+
+static char * LM_FormatBinaryRecord(char * end, const LM_OutputRecord * record, int length)
+{
+	LM_OutputBinaryRecord binary;
+	memset(&binary, 0, sizeof(binary));
+
+	binary.timestamp = record->timestamp;
+	binary.decodeTime = record->decodeTime;
+	binary.deviceId = record->deviceId;
+	binary.flags = (uint16_t)record->flags;
+	binary.track = (uint8_t)record->track;
+	binary.valid = record->valid;
+	binary.confidence = (uint8_t)record->confidence;
+	binary.quality = (uint8_t)record->quality->score;
+	binary.leadingZeros = LM_BinaryCount(record->quality->leadingZeros);
+	binary.trailingZeros = LM_BinaryCount(record->quality->trailingZeros);
+	binary.attempts = LM_BinaryCount(record->quality->attempts);
+
+	if (record->valid)
+	{
+		if (length > LM_OUTPUT_BINARYDATA)
+		{
+			length = LM_OUTPUT_BINARYDATA;
+			binary.truncated = 1;
+		}
+
+		binary.length = (uint16_t)length;
+		memcpy(binary.data, record->data, length);
+	}
+
+	memcpy(end, &binary, sizeof(binary));
+
+	return end + sizeof(binary);
+}
+
+void LM_WriteOutputRecord(LM_OutputWriter * writer, const LM_OutputRecord * record)
+{
+	long long started = writer->timed ? LM_MonotonicTime() : 0;
+
+	int length = record->length;
+
+	if (length > LM_OUTPUT_MAXDATA)
+		length = LM_OUTPUT_MAXDATA;
+
+	if (writer->size + LM_OUTPUT_RECORDOVERHEAD + (size_t)length * LM_OUTPUT_ESCAPEDCHAR > LM_OUTPUT_BUFFERSIZE)
+	{
+		fwrite(writer->buffer, 1, writer->size, writer->file);
+		writer->size = 0;
+	}
+
+	char * start = writer->buffer + writer->size;
+	char * end = start;
+
+	switch (writer->format)
+	{
+	case LM_OUTPUTFORMAT_JSONL:
+		end = LM_FormatJsonRecord(start, writer, record, length);
+		break;
+	case LM_OUTPUTFORMAT_CSV:
+		end = LM_FormatCsvRecord(start, writer, record, length);
+		break;
+	case LM_OUTPUTFORMAT_BINARY:
+		end = LM_FormatBinaryRecord(start, record, length);
+		break;
+	default:
+		break;
+	}
+
+	writer->size += end - start;
+	writer->recordCount++;
+
+	if (writer->timed)
+		writer->encodeTime += LM_MonotonicTime() - started;
+
+	if (writer->flushEachRecord)
+		LM_FlushOutputWriter(writer);
+}
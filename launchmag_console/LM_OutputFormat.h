@@ -0,0 +1,86 @@
+#ifndef LM_OUTPUTFORMAT_H_
+#define LM_OUTPUTFORMAT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "LM_SwipeLatency.h"
+#include "LM_SwipeSpeed.h"
+#include "LM_ReadQuality.h"
+
+// Machine readable output. Every encoder formats one swipe into the
+// writer's buffer by hand, without printf, and the buffer goes out in one
+// write, so consumers never see half a record.
+
+enum LM_OutputFormat
+{
+	LM_OUTPUTFORMAT_TEXT = 0,		// the labelled console text, printed elsewhere
+	LM_OUTPUTFORMAT_JSONL,
+	LM_OUTPUTFORMAT_CSV,
+	LM_OUTPUTFORMAT_BINARY,
+};
+
+#define LM_OUTPUT_BUFFERSIZE		65536
+#define LM_OUTPUT_BINARYDATA		224		// decoded characters kept per binary record
+
+// What a record carries, whatever the encoding.
+struct LM_OutputRecord
+{
+	long long		timestamp;			// nanoseconds since the Unix epoch
+	long long		decodeTime;			// STOP byte to decoded in nanoseconds, or -1 if unknown
+	unsigned int	deviceId;
+	int				track;				// LM_Track
+	bool			valid;				// false on a read error
+	int				flags;				// LM_DECODEFLAG_*
+	int				confidence;
+	const char *	data;
+	int				length;
+	const LM_SwipeTiming *	timing;		// stamps of each stage, or NULL
+	const LM_SwipeSpeed *	speed;		// from timing packets, or NULL; JSON only
+	const LM_ReadQuality *	quality;
+};
+
+// The binary encoding, little endian, 256 bytes per swipe.
+struct LM_OutputBinaryRecord
+{
+	int64_t		timestamp;
+	int64_t		decodeTime;
+	uint32_t	deviceId;
+	uint16_t	flags;
+	uint16_t	length;
+	uint8_t		track;
+	uint8_t		valid;
+	uint8_t		confidence;
+	uint8_t		truncated;			// data was longer than LM_OUTPUT_BINARYDATA
+	uint8_t		quality;
+	uint8_t		leadingZeros;		// 254 for that many or more, 255 on a read error
+	uint8_t		trailingZeros;
+	uint8_t		attempts;
+	char		data[LM_OUTPUT_BINARYDATA];
+};
+
+struct LM_OutputWriter
+{
+	FILE *				file;
+	LM_OutputFormat		format;
+	bool				flushEachRecord;	// write every record at once, for live input
+	bool				timingFields;		// JSON and CSV records carry the stage stamps
+	bool				timed;				// keep the time spent encoding
+	long long			encodeTime;
+	long long			recordCount;
+	size_t				size;
+	char				buffer[LM_OUTPUT_BUFFERSIZE];
+};
+
+// Returns false for an unknown format name.
+bool LM_ParseOutputFormat(const char * name, LM_OutputFormat * format);
+
+// Writes the CSV header line, if the format has one. The binary format has
+// no room for the stage stamps and leaves them out.
+void LM_OpenOutputWriter(LM_OutputWriter * writer, FILE * file, LM_OutputFormat format, bool flushEachRecord, bool timingFields);
+void LM_CloseOutputWriter(LM_OutputWriter * writer);
+
+void LM_WriteOutputRecord(LM_OutputWriter * writer, const LM_OutputRecord * record);
+void LM_FlushOutputWriter(LM_OutputWriter * writer);
+
+#endif /*LM_OUTPUTFORMAT_H_*/
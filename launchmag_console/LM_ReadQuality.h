@@ -0,0 +1,21 @@
+#ifndef LM_READQUALITY_H_
+#define LM_READQUALITY_H_
+
+// How cleanly a track read. The decoder fills it in for every swipe from
+// what it looks at anyway, so it costs a few comparisons and a count of the
+// clocking bits. A score of 100 is full clocking either side of the data, no
+// parity failure, an LRC that checks and a plausible length; a read error
+// scores 0. A lane whose average falls has a head or card path to look at
+// before its reads start failing.
+
+struct LM_ReadQuality
+{
+	int		score;				// 0 to 100
+	int		leadingZeros;		// zero bits ahead of the start sentinel, -1 on a read error
+	int		trailingZeros;		// after the LRC, or the end sentinel without one, -1 on a read error
+	int		parityErrors;		// characters that failed parity, -1 on a read error
+	int		attempts;			// decodes tried: forward, reversed, then each salvage alignment
+	bool	plausibleLength;	// characters within what the format allows
+};
+
+#endif /*LM_READQUALITY_H_*/
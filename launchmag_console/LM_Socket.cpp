@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#include "LM_Socket.h"
+
+#ifndef WIN32
+
+#define LM_SOCKET_DISCARDSIZE		256
+
+bool LM_SetNonBlocking(int descriptor)
+{
+	int flags = fcntl(descriptor, F_GETFL, 0);
+
+	return flags >= 0 && fcntl(descriptor, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+void LM_NoSigPipe(int socket)
+{
+#ifdef SO_NOSIGPIPE
+	int one = 1;
+	setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#else
+	(void)socket;
+#endif
+}
+
+bool LM_SendAll(int socket, const char * data, size_t length)
+{
+	while (length)
+	{
+		ssize_t sent = send(socket, data, length, MSG_NOSIGNAL);
+
+		if (sent < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return false;
+		}
+
+		data += sent;
+		length -= sent;
+	}
+
+	return true;
+}
+
+// Removes a socket file left at the address by a server that is gone.
+// Returns false if a server still answers there. Anything but a socket is
+// left for bind to fail on.
+static bool LM_RemoveStaleSocket(const struct sockaddr_un * address)
+{
+	struct stat status;
+
+	if (lstat(address->sun_path, &status) != 0 || !S_ISSOCK(status.st_mode))
+		return true;
+
+	int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (probe < 0 || !LM_SetNonBlocking(probe))
+	{
+		if (probe >= 0)
+			close(probe);
+
+		return true;
+	}
+
+	int result = connect(probe, (const struct sockaddr *)address, sizeof(*address));
+	int error = errno;
+
+	close(probe);
+
+	// a full backlog is a server too; only a refusal means nobody listens
+	if (result == 0 || error == EAGAIN)
+		return false;
+
+	if (error == ECONNREFUSED)
+		unlink(address->sun_path);
+
+	return true;
+}
+
+int LM_ListenUnixSocket(const char * path, int backlog)
+{
+	struct sockaddr_un address;
+
+	if (strlen(path) >= sizeof(address.sun_path))
+		return -1;
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	if (!LM_RemoveStaleSocket(&address))
+	{
+		fprintf(stderr, "Another server is listening on %s.\n", path);
+		return -1;
+	}
+
+	int listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (listenSocket < 0)
+		return -1;
+
+	if (bind(listenSocket, (struct sockaddr *)&address, sizeof(address)) != 0)
+	{
+		close(listenSocket);
+		return -1;
+	}
+
+	if (listen(listenSocket, backlog) != 0)
+	{
+		close(listenSocket);
+		unlink(path);
+		return -1;
+	}
+
+	return listenSocket;
+}
+
+bool LM_OpenWakePipe(int wakePipe[2])
+{
+	if (pipe(wakePipe) != 0)
+	{
+		wakePipe[0] = wakePipe[1] = -1;
+		return false;
+	}
+
+	if (!LM_SetNonBlocking(wakePipe[0]) || !LM_SetNonBlocking(wakePipe[1]))
+	{
+		LM_CloseWakePipe(wakePipe);
+		return false;
+	}
+
+	return true;
+}
+
+void LM_CloseWakePipe(int wakePipe[2])
+{
+	if (wakePipe[0] >= 0)
+	{
+		close(wakePipe[0]);
+		close(wakePipe[1]);
+	}
+
+	wakePipe[0] = wakePipe[1] = -1;
+}
+
+void LM_WakeThread(int wakePipe[2])
+{
+	ssize_t written = write(wakePipe[1], "", 1);
+	(void)written;
+}
+
+void LM_DrainWakePipe(int wakePipe[2])
+{
+	char discard[LM_SOCKET_DISCARDSIZE];
+
+	while (read(wakePipe[0], discard, sizeof(discard)) > 0)
+		;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef LM_SOCKET_H_
+#define LM_SOCKET_H_
+
+#include <stddef.h>
+
+// What the swipe and metrics servers share: Unix domain listening sockets,
+// sends that never raise SIGPIPE, and the pipe that wakes a server thread
+// out of poll. Not built on Windows, where neither server runs.
+
+#ifndef WIN32
+
+#include <sys/socket.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL	0		// LM_NoSigPipe sets SO_NOSIGPIPE on each socket instead
+#endif
+
+bool LM_SetNonBlocking(int descriptor);
+
+// Call on every accepted socket; sends must pass MSG_NOSIGNAL as well.
+void LM_NoSigPipe(int socket);
+
+// Sends all of data on a blocking socket. Returns false once the peer is gone.
+bool LM_SendAll(int socket, const char * data, size_t length);
+
+// Listens on a Unix domain socket at path. A socket file left there by an
+// earlier run is replaced, but not one a running server still answers on.
+// Returns the socket, or -1.
+int LM_ListenUnixSocket(const char * path, int backlog);
+
+// Both ends are non-blocking: waking never blocks, a full pipe means the
+// thread is due to wake anyway.
+bool LM_OpenWakePipe(int wakePipe[2]);
+void LM_CloseWakePipe(int wakePipe[2]);
+void LM_WakeThread(int wakePipe[2]);
+
+// Empties the pipe once poll has woken on it.
+void LM_DrainWakePipe(int wakePipe[2]);
+
+#endif
+
+#endif /*LM_SOCKET_H_*/
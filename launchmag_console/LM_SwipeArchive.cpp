@@ -0,0 +1,483 @@
+#pragma warning( disable : 4996 )
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "LM_SwipeArchive.h"
+
+#define LM_ARCHIVE_PATH_SIZE		1024
+
+static size_t LM_ArchivePadding(size_t length)
+{
+	return (LM_ARCHIVE_ALIGNMENT - (length % LM_ARCHIVE_ALIGNMENT)) % LM_ARCHIVE_ALIGNMENT;
+}
+
+static bool LM_ArchiveIndexPath(char * indexPath, const char * path)
+{
+	if (strlen(path) + sizeof(".idx") > LM_ARCHIVE_PATH_SIZE)
+		return false;
+
+	strcpy(indexPath, path);
+	strcat(indexPath, ".idx");
+
+	return true;
+}
+
+static void LM_InitializeArchiveHeader(LM_ArchiveFileHeader * header, const char * magic)
+{
+	memset(header, 0, sizeof(LM_ArchiveFileHeader));
+	memcpy(header->magic, magic, sizeof(header->magic));
+	header->version = LM_ARCHIVE_VERSION;
+	header->partition = LM_ARCHIVE_PARTITION;
+}
+
+static bool LM_CheckArchiveHeader(FILE * file, const char * magic)
+{
+	LM_ArchiveFileHeader header;
+
+	fseek(file, 0, SEEK_SET);
+
+	return	fread(&header, sizeof(header), 1, file) == 1
+		&&	memcmp(header.magic, magic, sizeof(header.magic)) == 0
+		&&	header.version == LM_ARCHIVE_VERSION;
+}
+
+static bool LM_TruncateFile(FILE * file, long length)
+{
+	fflush(file);
+
+#ifdef WIN32
+	return _chsize(_fileno(file), length) == 0;
+#else
+	return ftruncate(fileno(file), length) == 0;
+#endif
+}
+
+// Opens or creates one of the two archive files for update.
+static FILE * LM_OpenArchiveFile(const char * path, const char * magic, long * size)
+{
+	FILE * file = fopen(path, "r+b");
+
+	if (!file)
+		file = fopen(path, "w+b");
+
+	if (!file)
+		return NULL;
+
+	fseek(file, 0, SEEK_END);
+	*size = ftell(file);
+
+	if (*size == 0)
+	{
+		LM_ArchiveFileHeader header;
+		LM_InitializeArchiveHeader(&header, magic);
+
+		fwrite(&header, sizeof(header), 1, file);
+		fflush(file);
+
+		*size = sizeof(header);
+	}
+	else if (!LM_CheckArchiveHeader(file, magic))
+	{
+		// refuse to append to something that is not an archive
+		fclose(file);
+		return NULL;
+	}
+
+	return file;
+}
+
+bool LM_OpenArchiveWriter(LM_ArchiveWriter * writer, const char * path)
+{
+	memset(writer, 0, sizeof(LM_ArchiveWriter));
+
+	char indexPath[LM_ARCHIVE_PATH_SIZE];
+	long size;
+	long indexSize;
+
+	if (!LM_ArchiveIndexPath(indexPath, path))
+		return false;
+
+	writer->file = LM_OpenArchiveFile(path, LM_ARCHIVE_MAGIC, &size);
+	writer->indexFile = writer->file ? LM_OpenArchiveFile(indexPath, LM_ARCHIVE_INDEXMAGIC, &indexSize) : NULL;
+
+	if (!writer->indexFile)
+	{
+		LM_CloseArchiveWriter(writer);
+		return false;
+	}
+
+	// drop an index entry cut short, then any block the index does not cover
+	long entryCount = (indexSize - (long)sizeof(LM_ArchiveFileHeader)) / (long)sizeof(LM_ArchiveIndexEntry);
+	long validIndexSize = (long)sizeof(LM_ArchiveFileHeader) + entryCount * (long)sizeof(LM_ArchiveIndexEntry);
+
+	writer->offset = sizeof(LM_ArchiveFileHeader);
+
+	if (entryCount > 0)
+	{
+		LM_ArchiveIndexEntry entry;
+
+		fseek(writer->indexFile, validIndexSize - (long)sizeof(entry), SEEK_SET);
+
+		if (fread(&entry, sizeof(entry), 1, writer->indexFile) != 1 || (long)(entry.offset + entry.length) > size)
+		{
+			LM_CloseArchiveWriter(writer);
+			return false;
+		}
+
+		writer->offset = (long)(entry.offset + entry.length);
+	}
+
+	if (	(indexSize > validIndexSize && !LM_TruncateFile(writer->indexFile, validIndexSize))
+		||	(size > writer->offset && !LM_TruncateFile(writer->file, writer->offset)))
+	{
+		LM_CloseArchiveWriter(writer);
+		return false;
+	}
+
+	fseek(writer->file, writer->offset, SEEK_SET);
+	fseek(writer->indexFile, validIndexSize, SEEK_SET);
+
+	return true;
+}
+
+void LM_CloseArchiveWriter(LM_ArchiveWriter * writer)
+{
+	if (writer->file && writer->indexFile)
+		LM_FlushArchiveBlock(writer);
+
+	if (writer->file)
+		fclose(writer->file);
+
+	if (writer->indexFile)
+		fclose(writer->indexFile);
+
+	free(writer->records);
+
+	memset(writer, 0, sizeof(LM_ArchiveWriter));
+}
+
+static bool LM_PanPrefix(uint32_t * prefix, const char * pan, int length)
+{
+	if (length < LM_ARCHIVE_PREFIXDIGITS)
+		return false;
+
+	*prefix = 0;
+
+	for (int i = 0; i < LM_ARCHIVE_PREFIXDIGITS; i++)
+	{
+		if (pan[i] < '0' || pan[i] > '9')
+			return false;
+
+		*prefix = *prefix * 10 + (pan[i] - '0');
+	}
+
+	return true;
+}
+
+void LM_ArchiveSwipe(LM_ArchiveWriter * writer, int64_t timestamp, uint32_t deviceId, int track, bool valid, int flags, int confidence, const char * data, int length, const char * pan, int panLength)
+{
+	if (!valid)
+		length = 0;
+
+	if (	writer->recordCount == LM_ARCHIVE_BLOCKRECORDS
+		||	(writer->recordCount && timestamp / LM_ARCHIVE_PARTITION != writer->firstTimestamp / LM_ARCHIVE_PARTITION))
+	{
+		LM_FlushArchiveBlock(writer);
+	}
+
+	size_t recordSize = sizeof(LM_ArchiveRecord) + length + LM_ArchivePadding(length);
+
+	if (writer->recordsSize + recordSize > writer->recordsCapacity)
+	{
+		size_t capacity = writer->recordsCapacity ? writer->recordsCapacity * 2 : 65536;
+
+		while (capacity < writer->recordsSize + recordSize)
+			capacity *= 2;
+
+		unsigned char * records = (unsigned char *)realloc(writer->records, capacity);
+
+		if (!records)
+			return;
+
+		writer->records = records;
+		writer->recordsCapacity = capacity;
+	}
+
+	LM_ArchiveRecord * record = (LM_ArchiveRecord *)(writer->records + writer->recordsSize);
+
+	memset(record, 0, recordSize);
+	record->timestamp = timestamp;
+	record->deviceId = deviceId;
+	record->flags = (uint16_t)flags;
+	record->length = (uint16_t)length;
+	record->track = (uint8_t)track;
+	record->valid = valid ? 1 : 0;
+	record->confidence = (uint8_t)confidence;
+
+	memcpy(record + 1, data, length);
+
+	uint32_t prefix;
+
+	if (valid && pan && panLength <= 255 && pan - data + panLength <= length)
+	{
+		record->panOffset = (uint8_t)(pan - data);
+		record->panLength = (uint8_t)panLength;
+
+		if (LM_PanPrefix(&prefix, pan, panLength))
+			writer->prefixes[writer->prefixCount++] = prefix;
+	}
+
+	if (!writer->recordCount || timestamp < writer->firstTimestamp)
+		writer->firstTimestamp = timestamp;
+
+	if (!writer->recordCount || timestamp > writer->lastTimestamp)
+		writer->lastTimestamp = timestamp;
+
+	writer->recordsSize += recordSize;
+	writer->recordCount++;
+}
+
+static int LM_ComparePrefixes(const void * a, const void * b)
+{
+	uint32_t prefixA = *(const uint32_t *)a;
+	uint32_t prefixB = *(const uint32_t *)b;
+
+	return (prefixA < prefixB) ? -1 : (prefixA > prefixB) ? 1 : 0;
+}
+
+void LM_FlushArchiveBlock(LM_ArchiveWriter * writer)
+{
+	static const unsigned char padding[LM_ARCHIVE_ALIGNMENT] = { 0 };
+
+	if (!writer->recordCount)
+		return;
+
+	qsort(writer->prefixes, writer->prefixCount, sizeof(uint32_t), LM_ComparePrefixes);
+
+	uint32_t prefixCount = 0;
+
+	for (uint32_t i = 0; i < writer->prefixCount; i++)
+	{
+		if (!prefixCount || writer->prefixes[i] != writer->prefixes[prefixCount - 1])
+			writer->prefixes[prefixCount++] = writer->prefixes[i];
+	}
+
+	size_t prefixSize = prefixCount * sizeof(uint32_t);
+	size_t prefixPadding = LM_ArchivePadding(prefixSize);
+
+	LM_ArchiveBlockHeader header;
+	header.length = (uint32_t)(sizeof(header) + prefixSize + prefixPadding + writer->recordsSize);
+	header.recordCount = writer->recordCount;
+	header.prefixCount = prefixCount;
+	header.reserved = 0;
+	header.firstTimestamp = writer->firstTimestamp;
+	header.lastTimestamp = writer->lastTimestamp;
+
+	fwrite(&header, sizeof(header), 1, writer->file);
+	fwrite(writer->prefixes, sizeof(uint32_t), prefixCount, writer->file);
+	fwrite(padding, 1, prefixPadding, writer->file);
+	fwrite(writer->records, 1, writer->recordsSize, writer->file);
+	fflush(writer->file);
+
+	// the index entry goes out only once the block is complete
+	LM_ArchiveIndexEntry entry;
+	entry.firstTimestamp = writer->firstTimestamp;
+	entry.lastTimestamp = writer->lastTimestamp;
+	entry.offset = (uint64_t)writer->offset;
+	entry.length = header.length;
+	entry.recordCount = writer->recordCount;
+
+	fwrite(&entry, sizeof(entry), 1, writer->indexFile);
+	fflush(writer->indexFile);
+
+	writer->offset += header.length;
+	writer->recordCount = 0;
+	writer->recordsSize = 0;
+	writer->prefixCount = 0;
+}
+
+// True if any prefix in the sorted table starts with the query digits. A
+// query shorter than the table's prefixes matches a range of them; a longer
+// one matches its own leading digits and is refined record by record.
+static bool LM_MatchPrefixTable(const uint32_t * prefixes, uint32_t prefixCount, const char * panPrefix, int panPrefixLength)
+{
+	int digits = panPrefixLength < LM_ARCHIVE_PREFIXDIGITS ? panPrefixLength : LM_ARCHIVE_PREFIXDIGITS;
+	uint32_t low = 0;
+	uint32_t scale = 1;
+
+	for (int i = 0; i < LM_ARCHIVE_PREFIXDIGITS; i++)
+	{
+		low = low * 10 + (i < digits ? panPrefix[i] - '0' : 0);
+
+		if (i >= digits)
+			scale *= 10;
+	}
+
+	uint32_t high = low + scale;
+
+	// first prefix at or above low
+	uint32_t lower = 0;
+	uint32_t upper = prefixCount;
+
+	while (lower < upper)
+	{
+		uint32_t middle = (lower + upper) / 2;
+
+		if (prefixes[middle] < low)
+			lower = middle + 1;
+		else
+			upper = middle;
+	}
+
+	return lower < prefixCount && prefixes[lower] < high;
+}
+
+static bool LM_MatchRecord(const LM_ArchiveRecord * record, const LM_ArchiveQuery * query)
+{
+	if (record->timestamp < query->from || record->timestamp >= query->to)
+		return false;
+
+	if (!query->panPrefix)
+		return true;
+
+	return	record->panLength >= query->panPrefixLength
+		&&	memcmp(LM_ArchiveRecordData(record) + record->panOffset, query->panPrefix, query->panPrefixLength) == 0;
+}
+
+bool LM_QueryArchive(const char * path, const LM_ArchiveQuery * query, LM_ArchiveCallback callback, void * context, LM_ArchiveQueryStats * stats)
+{
+	memset(stats, 0, sizeof(LM_ArchiveQueryStats));
+
+	for (int i = 0; query->panPrefix && i < query->panPrefixLength; i++)
+	{
+		if (query->panPrefix[i] < '0' || query->panPrefix[i] > '9')
+			return false;
+	}
+
+	char indexPath[LM_ARCHIVE_PATH_SIZE];
+
+	if (!LM_ArchiveIndexPath(indexPath, path))
+		return false;
+
+	FILE * file = fopen(path, "rb");
+	FILE * indexFile = fopen(indexPath, "rb");
+	bool success = file && indexFile && LM_CheckArchiveHeader(file, LM_ARCHIVE_MAGIC) && LM_CheckArchiveHeader(indexFile, LM_ARCHIVE_INDEXMAGIC);
+
+	unsigned char * block = NULL;
+	size_t blockCapacity = 0;
+
+	// the index is small enough to scan whole, which also copes with blocks
+	// out of time order after the wall clock was set back
+	LM_ArchiveIndexEntry entry;
+
+	while (success && fread(&entry, sizeof(entry), 1, indexFile) == 1)
+	{
+		stats->blockCount++;
+
+		if (entry.lastTimestamp < query->from || entry.firstTimestamp >= query->to)
+			continue;
+
+		// the header is read into the block buffer, so a shorter entry is corrupt
+		if (entry.length < sizeof(LM_ArchiveBlockHeader))
+		{
+			success = false;
+			break;
+		}
+
+		if (entry.length > blockCapacity)
+		{
+			unsigned char * grown = (unsigned char *)realloc(block, entry.length);
+
+			if (!grown)
+			{
+				success = false;
+				break;
+			}
+
+			block = grown;
+			blockCapacity = entry.length;
+		}
+
+		LM_ArchiveBlockHeader * header = (LM_ArchiveBlockHeader *)block;
+
+		fseek(file, (long)entry.offset, SEEK_SET);
+
+		if (fread(header, sizeof(LM_ArchiveBlockHeader), 1, file) != 1 || header->length != entry.length)
+		{
+			success = false;
+			break;
+		}
+
+		const uint32_t * prefixes = (const uint32_t *)(header + 1);
+		size_t prefixSize = header->prefixCount * sizeof(uint32_t);
+		size_t bodySize = header->length - sizeof(LM_ArchiveBlockHeader);
+		size_t bodyRead = 0;
+
+		if (prefixSize + LM_ArchivePadding(prefixSize) > bodySize)
+		{
+			success = false;
+			break;
+		}
+
+		if (query->panPrefix)
+		{
+			if (fread((void *)prefixes, 1, prefixSize, file) != prefixSize)
+			{
+				success = false;
+				break;
+			}
+
+			if (!LM_MatchPrefixTable(prefixes, header->prefixCount, query->panPrefix, query->panPrefixLength))
+				continue;
+
+			bodyRead = prefixSize;
+		}
+
+		if (fread((unsigned char *)(header + 1) + bodyRead, 1, bodySize - bodyRead, file) != bodySize - bodyRead)
+		{
+			success = false;
+			break;
+		}
+
+		stats->blocksRead++;
+
+		const unsigned char * position = block + sizeof(LM_ArchiveBlockHeader) + prefixSize + LM_ArchivePadding(prefixSize);
+		const unsigned char * end = block + header->length;
+
+		for (uint32_t i = 0; i < header->recordCount && position + sizeof(LM_ArchiveRecord) <= end; i++)
+		{
+			const LM_ArchiveRecord * record = (const LM_ArchiveRecord *)position;
+			size_t recordSize = sizeof(LM_ArchiveRecord) + record->length + LM_ArchivePadding(record->length);
+
+			if (position + recordSize > end || record->panOffset + record->panLength > record->length)
+				break;
+
+			stats->recordsRead++;
+
+			if (LM_MatchRecord(record, query))
+			{
+				stats->recordsMatched++;
+				callback(record, context);
+			}
+
+			position += recordSize;
+		}
+	}
+
+	free(block);
+
+	if (file)
+		fclose(file);
+
+	if (indexFile)
+		fclose(indexFile);
+
+	return success;
+}
@@ -0,0 +1,132 @@
+#ifndef LM_SWIPEARCHIVE_H_
+#define LM_SWIPEARCHIVE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "LM_Clock.h"
+
+// Swipe archive layout, little endian throughout:
+//
+//   archive:  LM_ArchiveFileHeader
+//             LM_ArchiveBlockHeader, prefixes[prefixCount], records ...
+//             ...
+//   index:    LM_ArchiveFileHeader
+//             LM_ArchiveIndexEntry, one per block
+//
+// Decoded swipes are grouped into blocks that never straddle a time
+// partition. Each block carries the sorted, distinct BIN prefixes of its
+// PANs, and the index next to the archive holds the time span and offset of
+// every block. A query reads the index, reads the header and prefix table of
+// the blocks whose span overlaps the range, and reads records only from
+// blocks whose prefix table matches. Nothing else is read from disk.
+//
+// A block is written when it fills, when a swipe falls in the next
+// partition, or when the writer closes. Its index entry is written after it,
+// so an archive cut short by a crash is trimmed back to the last indexed
+// block on the next open. The swipes of the open block are lost in a crash;
+// the swipe log (-o) remains the record of everything received.
+
+#define LM_ARCHIVE_MAGIC			"LMSWARC"
+#define LM_ARCHIVE_INDEXMAGIC		"LMSWIDX"
+#define LM_ARCHIVE_VERSION			1
+#define LM_ARCHIVE_ALIGNMENT		8
+
+#define LM_ARCHIVE_BLOCKRECORDS		4096	// swipes per block at most
+#define LM_ARCHIVE_PARTITION		(15 * 60 * LM_NANOSECONDS_PER_SECOND)	// wall clock time per partition
+#define LM_ARCHIVE_PREFIXDIGITS		6		// PAN digits kept in a block's prefix table
+
+struct LM_ArchiveFileHeader
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	reserved;
+	int64_t		partition;			// nanoseconds
+};
+
+struct LM_ArchiveBlockHeader
+{
+	uint32_t	length;				// whole block including prefixes and records
+	uint32_t	recordCount;
+	uint32_t	prefixCount;
+	uint32_t	reserved;
+	int64_t		firstTimestamp;
+	int64_t		lastTimestamp;
+};
+
+// Followed by length characters of decoded data, padded to
+// LM_ARCHIVE_ALIGNMENT.
+struct LM_ArchiveRecord
+{
+	int64_t		timestamp;			// nanoseconds since the Unix epoch
+	uint32_t	deviceId;
+	uint16_t	flags;				// LM_DECODEFLAG_*
+	uint16_t	length;
+	uint8_t		track;				// LM_Track
+	uint8_t		valid;
+	uint8_t		confidence;
+	uint8_t		panOffset;			// PAN position in the data, if panLength is not 0
+	uint8_t		panLength;
+	uint8_t		reserved[3];
+};
+
+struct LM_ArchiveIndexEntry
+{
+	int64_t		firstTimestamp;
+	int64_t		lastTimestamp;
+	uint64_t	offset;
+	uint32_t	length;
+	uint32_t	recordCount;
+};
+
+inline const char * LM_ArchiveRecordData(const LM_ArchiveRecord * record)
+{
+	return (const char *)(record + 1);
+}
+
+struct LM_ArchiveWriter
+{
+	FILE *			file;
+	FILE *			indexFile;
+	long			offset;				// where the next block goes
+	int64_t			firstTimestamp;
+	int64_t			lastTimestamp;
+	uint32_t		recordCount;
+	unsigned char *	records;
+	size_t			recordsSize;
+	size_t			recordsCapacity;
+	uint32_t		prefixCount;
+	uint32_t		prefixes[LM_ARCHIVE_BLOCKRECORDS];
+};
+
+// The index is kept beside the archive, at the archive path plus ".idx".
+bool LM_OpenArchiveWriter(LM_ArchiveWriter * writer, const char * path);
+void LM_CloseArchiveWriter(LM_ArchiveWriter * writer);
+
+// pan points into data, or is NULL for a swipe with no PAN.
+void LM_ArchiveSwipe(LM_ArchiveWriter * writer, int64_t timestamp, uint32_t deviceId, int track, bool valid, int flags, int confidence, const char * data, int length, const char * pan, int panLength);
+void LM_FlushArchiveBlock(LM_ArchiveWriter * writer);
+
+// Swipes in [from, to) whose PAN starts with panPrefix. A NULL panPrefix
+// matches every swipe, including those without a PAN.
+struct LM_ArchiveQuery
+{
+	long long		from;
+	long long		to;
+	const char *	panPrefix;
+	int				panPrefixLength;
+};
+
+struct LM_ArchiveQueryStats
+{
+	uint32_t	blockCount;
+	uint32_t	blocksRead;			// blocks whose records were read
+	uint64_t	recordsRead;
+	uint64_t	recordsMatched;
+};
+
+typedef void (*LM_ArchiveCallback)(const LM_ArchiveRecord * record, void * context);
+
+bool LM_QueryArchive(const char * path, const LM_ArchiveQuery * query, LM_ArchiveCallback callback, void * context, LM_ArchiveQueryStats * stats);
+
+#endif /*LM_SWIPEARCHIVE_H_*/
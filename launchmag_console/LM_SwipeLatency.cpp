@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+#include "LM_SwipeLatency.h"
+
+static int LM_HighestBit(unsigned long long value)
+{
+#if defined(__GNUC__)
+	return 63 - __builtin_clzll(value);
+#else
+	int bit = 0;
+
+	while (value >>= 1)
+		bit++;
+
+	return bit;
+#endif
+}
+
+static int LM_HistogramBucket(long long value)
+{
+	if (value < LM_HISTOGRAM_SUBBUCKETS)
+		return (int)value;
+
+	int bit = LM_HighestBit((unsigned long long)value);
+	int subBucket = (int)(value >> (bit - (LM_HISTOGRAM_SUBBITS - 1)));
+
+	return LM_HISTOGRAM_SUBBUCKETS + (bit - LM_HISTOGRAM_SUBBITS) * (LM_HISTOGRAM_SUBBUCKETS / 2) + (subBucket - LM_HISTOGRAM_SUBBUCKETS / 2);
+}
+
+// The highest value that lands in a bucket.
+static long long LM_HistogramBucketTop(int bucket)
+{
+	if (bucket < LM_HISTOGRAM_SUBBUCKETS)
+		return bucket;
+
+	int index = bucket - LM_HISTOGRAM_SUBBUCKETS;
+	int shift = index / (LM_HISTOGRAM_SUBBUCKETS / 2) + 1;
+	long long subBucket = LM_HISTOGRAM_SUBBUCKETS / 2 + index % (LM_HISTOGRAM_SUBBUCKETS / 2);
+
+	return ((subBucket + 1) << shift) - 1;
+}
+
+void LM_RecordLatency(LM_LatencyHistogram * histogram, long long value)
+{
+	if (value < 0)
+		value = 0;
+
+	if (!histogram->count || value < histogram->min)
+		histogram->min = value;
+
+	if (value > histogram->max)
+		histogram->max = value;
+
+	histogram->buckets[LM_HistogramBucket(value)]++;
+	histogram->sum += value;
+	histogram->count++;
+}
+
+long long LM_LatencyPercentile(const LM_LatencyHistogram * histogram, double percentile)
+{
+	if (!histogram->count)
+		return 0;
+
+	long long rank = (long long)(percentile / 100.0 * histogram->count + 0.5);
+
+	if (rank < 1)
+		rank = 1;
+
+	long long seen = 0;
+
+	for (int i = 0; i < LM_HISTOGRAM_BUCKETS; i++)
+	{
+		seen += histogram->buckets[i];
+
+		if (seen >= rank)
+		{
+			long long top = LM_HistogramBucketTop(i);
+			return (top < histogram->max) ? top : histogram->max;
+		}
+	}
+
+	return histogram->max;
+}
+
+void LM_InitializeSwipeLatency(LM_SwipeLatency * latency)
+{
+	memset(latency, 0, sizeof(*latency));
+}
+
+static void LM_RecordStage(LM_SwipeLatency * latency, LM_LatencyStage stage, long long from, long long to)
+{
+	if (from >= 0 && to >= 0)
+		LM_RecordLatency(&latency->stages[stage], to - from);
+}
+
+void LM_RecordSwipeTiming(LM_SwipeLatency * latency, const LM_SwipeTiming * timing)
+{
+	LM_RecordStage(latency, LM_LATENCYSTAGE_SERIAL, timing->start, timing->lastData);
+	LM_RecordStage(latency, LM_LATENCYSTAGE_STOP, timing->lastData, timing->stop);
+	LM_RecordStage(latency, LM_LATENCYSTAGE_DECODE, timing->stop, timing->decoded);
+	LM_RecordStage(latency, LM_LATENCYSTAGE_OUTPUT, timing->decoded, timing->flushed);
+	LM_RecordStage(latency, LM_LATENCYSTAGE_TOTAL, timing->start, timing->flushed);
+}
+
+void LM_PrintSwipeLatency(FILE * file, const LM_SwipeLatency * latency)
+{
+	static const char * names[LM_LATENCYSTAGE_COUNT] = {
+		"START to last data",
+		"last data to STOP",
+		"STOP to decoded",
+		"decoded to flushed",
+		"START to flushed",
+	};
+
+	fprintf(file, "\nSwipe latency (us)     %10s %10s %10s %10s %10s %10s %10s %10s\n",
+		"count", "min", "mean", "p50", "p90", "p99", "p99.9", "max");
+
+	for (int i = 0; i < LM_LATENCYSTAGE_COUNT; i++)
+	{
+		const LM_LatencyHistogram * histogram = &latency->stages[i];
+
+		fprintf(file, "  %-20s %10lld", names[i], histogram->count);
+
+		if (!histogram->count)
+		{
+			fprintf(file, "\n");
+			continue;
+		}
+
+		fprintf(file, " %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+			histogram->min / 1000.0,
+			(double)histogram->sum / histogram->count / 1000.0,
+			LM_LatencyPercentile(histogram, 50) / 1000.0,
+			LM_LatencyPercentile(histogram, 90) / 1000.0,
+			LM_LatencyPercentile(histogram, 99) / 1000.0,
+			LM_LatencyPercentile(histogram, 99.9) / 1000.0,
+			histogram->max / 1000.0);
+	}
+
+	fflush(file);
+}
+
+#ifdef WIN32
+
+bool LM_DumpSwipeLatencyOnSignal(LM_SwipeLatency * latency)
+{
+	return false;
+}
+
+#else
+
+static void * LM_LatencySignalMain(void * argument)
+{
+	LM_SwipeLatency * latency = (LM_SwipeLatency *)argument;
+
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+
+	for (;;)
+	{
+		int received;
+
+		if (sigwait(&signals, &received) == 0)
+			LM_PrintSwipeLatency(stderr, latency);
+	}
+
+	return NULL;
+}
+
+bool LM_DumpSwipeLatencyOnSignal(LM_SwipeLatency * latency)
+{
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+
+	if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0)
+		return false;
+
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, LM_LatencySignalMain, latency) != 0)
+		return false;
+
+	pthread_detach(thread);
+
+	return true;
+}
+
+#endif
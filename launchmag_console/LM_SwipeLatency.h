@@ -0,0 +1,69 @@
+#ifndef LM_SWIPELATENCY_H_
+#define LM_SWIPELATENCY_H_
+
+#include <stdio.h>
+
+// Where the time goes between a card entering the reader and its swipe
+// being written out. Each swipe is stamped with LM_MonotonicTime() at five
+// points and the gaps between them go into log-linear histograms, HdrHistogram
+// style: values up to LM_HISTOGRAM_SUBBUCKETS are exact, and above that each
+// power of two is split into LM_HISTOGRAM_SUBBUCKETS / 2 buckets, so any
+// value is kept to within 1/64 of itself whatever its magnitude.
+
+#define LM_HISTOGRAM_SUBBITS		7
+#define LM_HISTOGRAM_SUBBUCKETS		(1 << LM_HISTOGRAM_SUBBITS)
+#define LM_HISTOGRAM_BUCKETS		(LM_HISTOGRAM_SUBBUCKETS + (63 - LM_HISTOGRAM_SUBBITS) * (LM_HISTOGRAM_SUBBUCKETS / 2))
+
+struct LM_LatencyHistogram
+{
+	long long	count;
+	long long	sum;
+	long long	min;
+	long long	max;
+	long long	buckets[LM_HISTOGRAM_BUCKETS];
+};
+
+void LM_RecordLatency(LM_LatencyHistogram * histogram, long long value);
+
+// The highest value equivalent to the one at percentile (0 to 100).
+long long LM_LatencyPercentile(const LM_LatencyHistogram * histogram, double percentile);
+
+// Stamps of one swipe, -1 where the point was not seen (batch decoding
+// reads no clock).
+struct LM_SwipeTiming
+{
+	long long	start;			// START byte
+	long long	lastData;		// last data byte of the track
+	long long	stop;			// STOP byte
+	long long	decoded;		// decoding and annotation done
+	long long	flushed;		// output written
+};
+
+enum LM_LatencyStage
+{
+	LM_LATENCYSTAGE_SERIAL = 0,		// START to last data byte, the card moving past the head
+	LM_LATENCYSTAGE_STOP,			// last data byte to STOP, the firmware closing the track
+	LM_LATENCYSTAGE_DECODE,			// STOP to decoded
+	LM_LATENCYSTAGE_OUTPUT,			// decoded to flushed, the consumer's share
+	LM_LATENCYSTAGE_TOTAL,			// START to flushed
+
+	LM_LATENCYSTAGE_COUNT,
+};
+
+struct LM_SwipeLatency
+{
+	LM_LatencyHistogram		stages[LM_LATENCYSTAGE_COUNT];
+};
+
+void LM_InitializeSwipeLatency(LM_SwipeLatency * latency);
+void LM_RecordSwipeTiming(LM_SwipeLatency * latency, const LM_SwipeTiming * timing);
+void LM_PrintSwipeLatency(FILE * file, const LM_SwipeLatency * latency);
+
+// Prints the histograms to stderr whenever the process gets SIGUSR1. Call
+// before starting any other thread: SIGUSR1 is blocked in the calling thread,
+// and so in every thread it starts, and taken by a thread of its own. The
+// histograms are read without a lock, so a dump taken mid-swipe can be a
+// swipe out between stages. Returns false where there is no SIGUSR1.
+bool LM_DumpSwipeLatencyOnSignal(LM_SwipeLatency * latency);
+
+#endif /*LM_SWIPELATENCY_H_*/
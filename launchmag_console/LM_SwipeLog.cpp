@@ -0,0 +1,304 @@
+#pragma warning( disable : 4996 )
+
+#include <string.h>
+
+#ifdef WIN32
+#include <Windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "LM_SwipeLog.h"
+#include "LM_Clock.h"
+
+static size_t LM_LogPadding(size_t length)
+{
+	return (LM_LOG_ALIGNMENT - (length % LM_LOG_ALIGNMENT)) % LM_LOG_ALIGNMENT;
+}
+
+static void LM_WriteLogRecord(LM_LogWriter * writer, LM_LogRecordHeader * header, size_t headerSize, const void * payload1, size_t payload1Size, const void * payload2, size_t payload2Size)
+{
+	static const unsigned char padding[LM_LOG_ALIGNMENT] = { 0 };
+
+	size_t length = headerSize + payload1Size + payload2Size;
+	size_t paddingSize = LM_LogPadding(length);
+
+	header->length = (uint32_t)(length + paddingSize);
+	header->reserved = 0;
+	header->deviceId = writer->deviceId;
+	header->reserved2 = 0;
+
+	fwrite(header, headerSize, 1, writer->file);
+
+	if (payload1Size)
+		fwrite(payload1, payload1Size, 1, writer->file);
+
+	if (payload2Size)
+		fwrite(payload2, payload2Size, 1, writer->file);
+
+	if (paddingSize)
+		fwrite(padding, paddingSize, 1, writer->file);
+}
+
+// Returns the offset just past the last complete record, or 0 if the file
+// is not a swipe log.
+static size_t LM_LogValidLength(const LM_LogReader * reader)
+{
+	size_t validLength = sizeof(LM_LogFileHeader);
+
+	for (const LM_LogRecordHeader * record = LM_NextLogRecord(reader, NULL); record; record = LM_NextLogRecord(reader, record))
+		validLength = (const unsigned char *)record - reader->base + record->length;
+
+	return validLength;
+}
+
+bool LM_OpenLogWriter(LM_LogWriter * writer, const char * path, uint32_t deviceId)
+{
+	memset(writer, 0, sizeof(LM_LogWriter));
+	writer->deviceId = deviceId;
+
+	size_t validLength = 0;
+	LM_LogReader reader;
+
+	if (LM_OpenLogReader(&reader, path))
+	{
+		validLength = LM_LogValidLength(&reader);
+		LM_CloseLogReader(&reader);
+	}
+
+	writer->file = fopen(path, "ab");
+
+	if (!writer->file)
+		return false;
+
+	fseek(writer->file, 0, SEEK_END);
+	long size = ftell(writer->file);
+
+	if (size > 0 && validLength == 0)
+	{
+		// refuse to append to something that is not a swipe log
+		fclose(writer->file);
+		writer->file = NULL;
+		return false;
+	}
+
+	if ((size_t)size > validLength)
+	{
+		// drop a record left half written by a crash
+#ifdef WIN32
+		_chsize(_fileno(writer->file), (long)validLength);
+#else
+		if (ftruncate(fileno(writer->file), validLength) != 0)
+		{
+			fclose(writer->file);
+			writer->file = NULL;
+			return false;
+		}
+#endif
+		fseek(writer->file, 0, SEEK_END);
+	}
+
+	if (validLength == 0)
+	{
+		LM_LogFileHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, LM_LOG_MAGIC, sizeof(LM_LOG_MAGIC));
+		header.version = LM_LOG_VERSION;
+
+		fwrite(&header, sizeof(header), 1, writer->file);
+		fflush(writer->file);
+	}
+
+	return true;
+}
+
+void LM_CloseLogWriter(LM_LogWriter * writer)
+{
+	if (!writer->file)
+		return;
+
+	LM_FlushLogRaw(writer);
+	fclose(writer->file);
+	writer->file = NULL;
+}
+
+void LM_LogRawByte(LM_LogWriter * writer, unsigned char byte, long long now, long long timestamp)
+{
+	if (writer->rawCount == 0)
+	{
+		writer->rawStarted = now;
+		writer->rawTimestamp = (timestamp >= 0) ? timestamp : LM_WallClockTime();
+	}
+
+	writer->rawOffsets[writer->rawCount] = (uint32_t)((now - writer->rawStarted) / 1000);
+	writer->rawBytes[writer->rawCount] = byte;
+
+	if (++writer->rawCount == LM_LOG_RAWBUFFER_SIZE)
+		LM_FlushLogRaw(writer);
+}
+
+void LM_FlushLogRaw(LM_LogWriter * writer)
+{
+	if (writer->rawCount == 0)
+		return;
+
+	LM_LogRawRecord record;
+	record.header.type = LM_LOGRECORD_RAW;
+	record.header.timestamp = writer->rawTimestamp;
+	record.byteCount = writer->rawCount;
+	record.reserved = 0;
+
+	LM_WriteLogRecord(writer, &record.header, sizeof(record), writer->rawOffsets, writer->rawCount * sizeof(uint32_t), writer->rawBytes, writer->rawCount);
+
+	writer->rawCount = 0;
+}
+
+void LM_LogSwipe(LM_LogWriter * writer, long long timestamp, int track, bool valid, int flags, int confidence, const char * data, int length)
+{
+	LM_LogSwipeRecord record;
+	record.header.type = LM_LOGRECORD_SWIPE;
+	record.header.timestamp = timestamp;
+	record.track = (uint8_t)track;
+	record.valid = valid ? 1 : 0;
+	record.confidence = (uint8_t)confidence;
+	record.reserved = 0;
+	record.flags = (uint16_t)flags;
+	record.length = (uint16_t)(valid ? length : 0);
+
+	LM_WriteLogRecord(writer, &record.header, sizeof(record), data, record.length, NULL, 0);
+
+	fflush(writer->file);
+}
+
+bool LM_OpenLogReader(LM_LogReader * reader, const char * path)
+{
+	memset(reader, 0, sizeof(LM_LogReader));
+
+#ifdef WIN32
+	HANDLE fileHandle = ::CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!::GetFileSizeEx(fileHandle, &size) || size.QuadPart < (LONGLONG)sizeof(LM_LogFileHeader))
+	{
+		::CloseHandle(fileHandle);
+		return false;
+	}
+
+	HANDLE mappingHandle = ::CreateFileMappingA(fileHandle, 0, PAGE_READONLY, 0, 0, 0);
+	if (!mappingHandle)
+	{
+		::CloseHandle(fileHandle);
+		return false;
+	}
+
+	reader->base = (const unsigned char *)::MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (!reader->base)
+	{
+		::CloseHandle(mappingHandle);
+		::CloseHandle(fileHandle);
+		return false;
+	}
+
+	reader->size = (size_t)size.QuadPart;
+	reader->fileHandle = fileHandle;
+	reader->mappingHandle = mappingHandle;
+#else
+	int fileDescriptor = open(path, O_RDONLY);
+	if (fileDescriptor < 0)
+		return false;
+
+	struct stat fileStatus;
+	if (fstat(fileDescriptor, &fileStatus) != 0 || fileStatus.st_size < (off_t)sizeof(LM_LogFileHeader))
+	{
+		close(fileDescriptor);
+		return false;
+	}
+
+	void * base = mmap(NULL, fileStatus.st_size, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+	close(fileDescriptor);
+
+	if (base == MAP_FAILED)
+		return false;
+
+	madvise(base, fileStatus.st_size, MADV_SEQUENTIAL);
+
+	reader->base = (const unsigned char *)base;
+	reader->size = fileStatus.st_size;
+#endif
+
+	const LM_LogFileHeader * header = (const LM_LogFileHeader *)reader->base;
+
+	if (	memcmp(header->magic, LM_LOG_MAGIC, sizeof(LM_LOG_MAGIC)) != 0
+		||	header->version != LM_LOG_VERSION)
+	{
+		LM_CloseLogReader(reader);
+		return false;
+	}
+
+	return true;
+}
+
+void LM_CloseLogReader(LM_LogReader * reader)
+{
+	if (!reader->base)
+		return;
+
+#ifdef WIN32
+	::UnmapViewOfFile(reader->base);
+	::CloseHandle(reader->mappingHandle);
+	::CloseHandle(reader->fileHandle);
+#else
+	munmap((void *)reader->base, reader->size);
+#endif
+
+	reader->base = NULL;
+}
+
+const LM_LogRecordHeader * LM_NextLogRecord(const LM_LogReader * reader, const LM_LogRecordHeader * record)
+{
+	size_t offset = record
+		? (const unsigned char *)record - reader->base + record->length
+		: sizeof(LM_LogFileHeader);
+
+	if (offset + sizeof(LM_LogRecordHeader) > reader->size)
+		return NULL;
+
+	const LM_LogRecordHeader * next = (const LM_LogRecordHeader *)(reader->base + offset);
+
+	if (	next->length < sizeof(LM_LogRecordHeader)
+		||	next->length % LM_LOG_ALIGNMENT
+		||	next->length > reader->size - offset)
+	{
+		return NULL;
+	}
+
+	// the payload must fit the record so callers can index it unchecked
+	if (next->type == LM_LOGRECORD_RAW)
+	{
+		const LM_LogRawRecord * raw = (const LM_LogRawRecord *)next;
+
+		if (	next->length < sizeof(LM_LogRawRecord)
+			||	raw->byteCount > (next->length - sizeof(LM_LogRawRecord)) / (sizeof(uint32_t) + 1))
+		{
+			return NULL;
+		}
+	}
+	else if (next->type == LM_LOGRECORD_SWIPE)
+	{
+		const LM_LogSwipeRecord * swipe = (const LM_LogSwipeRecord *)next;
+
+		if (	next->length < sizeof(LM_LogSwipeRecord)
+			||	swipe->length > next->length - sizeof(LM_LogSwipeRecord))
+		{
+			return NULL;
+		}
+	}
+
+	return next;
+}
@@ -0,0 +1,121 @@
+#ifndef LM_SWIPELOG_H_
+#define LM_SWIPELOG_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Swipe log file layout, little endian throughout:
+//
+//   LM_LogFileHeader
+//   LM_LogRecordHeader + payload, padded to LM_LOG_ALIGNMENT
+//   ...
+//
+// Every record starts on an 8 byte boundary and carries its own padded
+// length, so a reader walks a mapped file by pointer arithmetic alone and
+// hands out pointers into the mapping. A record cut short by a crash mid
+// append ends the walk rather than being misread.
+
+#define LM_LOG_MAGIC				"LMSWLOG"
+#define LM_LOG_VERSION				1
+#define LM_LOG_ALIGNMENT			8
+
+#define LM_LOGRECORD_RAW			1		// packet bytes as received from the reader
+#define LM_LOGRECORD_SWIPE			2		// one decoded track
+
+#define LM_LOG_RAWBUFFER_SIZE		1024	// raw bytes per record before a forced flush
+
+struct LM_LogFileHeader
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	reserved;
+};
+
+struct LM_LogRecordHeader
+{
+	uint32_t	length;				// whole record including header and padding
+	uint16_t	type;
+	uint16_t	reserved;
+	uint32_t	deviceId;
+	uint32_t	reserved2;
+	int64_t		timestamp;			// nanoseconds since the Unix epoch
+};
+
+// Followed by offsets[byteCount] and then bytes[byteCount]. Offsets are the
+// microseconds from the record timestamp at which each byte arrived.
+struct LM_LogRawRecord
+{
+	LM_LogRecordHeader	header;
+	uint32_t			byteCount;
+	uint32_t			reserved;
+};
+
+// Followed by length characters of decoded data, not NUL terminated.
+struct LM_LogSwipeRecord
+{
+	LM_LogRecordHeader	header;
+	uint8_t				track;		// LM_Track
+	uint8_t				valid;
+	uint8_t				confidence;
+	uint8_t				reserved;
+	uint16_t			flags;		// LM_DECODEFLAG_*
+	uint16_t			length;
+};
+
+inline const uint32_t * LM_LogRawOffsets(const LM_LogRawRecord * record)
+{
+	return (const uint32_t *)(record + 1);
+}
+
+inline const unsigned char * LM_LogRawBytes(const LM_LogRawRecord * record)
+{
+	return (const unsigned char *)(LM_LogRawOffsets(record) + record->byteCount);
+}
+
+inline const char * LM_LogSwipeData(const LM_LogSwipeRecord * record)
+{
+	return (const char *)(record + 1);
+}
+
+// Append-only writer. Raw bytes are gathered into one record per swipe and
+// flushed with it, so a crash loses at most the swipe in progress.
+struct LM_LogWriter
+{
+	FILE *			file;
+	uint32_t		deviceId;
+	int64_t			rawTimestamp;
+	long long		rawStarted;			// monotonic time of the first buffered byte
+	uint32_t		rawCount;
+	uint32_t		rawOffsets[LM_LOG_RAWBUFFER_SIZE];
+	unsigned char	rawBytes[LM_LOG_RAWBUFFER_SIZE];
+};
+
+bool LM_OpenLogWriter(LM_LogWriter * writer, const char * path, uint32_t deviceId);
+void LM_CloseLogWriter(LM_LogWriter * writer);
+
+// now times the byte against the others in its record; timestamp is when
+// it was read or recorded, in nanoseconds since the Unix epoch, or -1 for
+// the wall clock.
+void LM_LogRawByte(LM_LogWriter * writer, unsigned char byte, long long now, long long timestamp);
+void LM_FlushLogRaw(LM_LogWriter * writer);
+void LM_LogSwipe(LM_LogWriter * writer, long long timestamp, int track, bool valid, int flags, int confidence, const char * data, int length);
+
+// Read-only view of a log mapped into memory.
+struct LM_LogReader
+{
+	const unsigned char *	base;
+	size_t					size;
+#ifdef WIN32
+	void *					fileHandle;
+	void *					mappingHandle;
+#endif
+};
+
+bool LM_OpenLogReader(LM_LogReader * reader, const char * path);
+void LM_CloseLogReader(LM_LogReader * reader);
+
+// Pass NULL to get the first record. Returns NULL at the end of the log.
+const LM_LogRecordHeader * LM_NextLogRecord(const LM_LogReader * reader, const LM_LogRecordHeader * record);
+
+#endif /*LM_SWIPELOG_H_*/
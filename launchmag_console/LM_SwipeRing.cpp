@@ -0,0 +1,322 @@
+#pragma warning( disable : 4996 )
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "LM_SwipeRing.h"
+#include "LM_Clock.h"
+
+#define LM_RING_NAME_SIZE			256
+
+static size_t LM_RingSize(uint32_t slotCount)
+{
+	return sizeof(LM_RingHeader) + (size_t)slotCount * sizeof(LM_RingSlot);
+}
+
+// Shared memory names are "/name" on POSIX and "Local\name" on Windows.
+static bool LM_RingObjectName(char * objectName, const char * name)
+{
+#ifdef WIN32
+	const char * prefix = "Local\\";
+#else
+	const char * prefix = (name[0] == '/') ? "" : "/";
+#endif
+
+	if (strlen(prefix) + strlen(name) >= LM_RING_NAME_SIZE)
+		return false;
+
+	strcpy(objectName, prefix);
+	strcat(objectName, name);
+
+	return true;
+}
+
+static bool LM_MapRing(LM_RingMapping * mapping, const char * name, bool create, size_t size)
+{
+	char objectName[LM_RING_NAME_SIZE];
+
+	memset(mapping, 0, sizeof(LM_RingMapping));
+
+	if (!LM_RingObjectName(objectName, name))
+		return false;
+
+#ifdef WIN32
+	HANDLE mappingHandle = create
+		? ::CreateFileMappingA(INVALID_HANDLE_VALUE, 0, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)size, objectName)
+		: ::OpenFileMappingA(FILE_MAP_READ, FALSE, objectName);
+
+	if (!mappingHandle)
+		return false;
+
+	mapping->base = ::MapViewOfFile(mappingHandle, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, 0);
+
+	if (!mapping->base)
+	{
+		::CloseHandle(mappingHandle);
+		return false;
+	}
+
+	MEMORY_BASIC_INFORMATION region;
+	::VirtualQuery(mapping->base, &region, sizeof(region));
+
+	mapping->mappingHandle = mappingHandle;
+	mapping->size = create ? size : region.RegionSize;
+#else
+	int descriptor = shm_open(objectName, create ? (O_RDWR | O_CREAT) : O_RDONLY, 0600);
+
+	if (descriptor < 0)
+		return false;
+
+	struct stat status;
+
+	if (create && ftruncate(descriptor, size) != 0)
+	{
+		close(descriptor);
+		return false;
+	}
+
+	if (fstat(descriptor, &status) != 0 || (size_t)status.st_size < sizeof(LM_RingHeader))
+	{
+		close(descriptor);
+		return false;
+	}
+
+	mapping->size = (size_t)status.st_size;
+	mapping->base = mmap(NULL, mapping->size, create ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, descriptor, 0);
+
+	// the mapping stays valid after the descriptor is closed
+	close(descriptor);
+
+	if (mapping->base == MAP_FAILED)
+	{
+		mapping->base = NULL;
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+static void LM_UnmapRing(LM_RingMapping * mapping)
+{
+	if (!mapping->base)
+		return;
+
+#ifdef WIN32
+	::UnmapViewOfFile(mapping->base);
+	::CloseHandle(mapping->mappingHandle);
+#else
+	munmap(mapping->base, mapping->size);
+#endif
+
+	memset(mapping, 0, sizeof(LM_RingMapping));
+}
+
+static uint64_t LM_LoadAcquire(const volatile uint64_t * value)
+{
+#ifdef WIN32
+	return *value;		// volatile reads have acquire semantics under MSVC
+#else
+	return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static void LM_StoreRelease(volatile uint64_t * value, uint64_t newValue)
+{
+#ifdef WIN32
+	*value = newValue;	// volatile writes have release semantics under MSVC
+#else
+	__atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+#endif
+}
+
+// Keeps the seqlock ordering: the odd sequence is visible before the record
+// changes, and the record is read completely before the sequence is checked.
+static void LM_StoreFence()
+{
+#ifdef WIN32
+	MemoryBarrier();
+#else
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+#endif
+}
+
+static void LM_LoadFence()
+{
+#ifdef WIN32
+	MemoryBarrier();
+#else
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+#endif
+}
+
+bool LM_OpenRingProducer(LM_RingProducer * producer, const char * name)
+{
+	memset(producer, 0, sizeof(LM_RingProducer));
+
+	if (!LM_MapRing(&producer->mapping, name, true, LM_RingSize(LM_RING_SLOTS)))
+		return false;
+
+	producer->header = (LM_RingHeader *)producer->mapping.base;
+	producer->slots = (LM_RingSlot *)(producer->header + 1);
+
+	LM_RingHeader * header = producer->header;
+
+	if (	memcmp(header->magic, LM_RING_MAGIC, sizeof(header->magic)) == 0
+		&&	header->version == LM_RING_VERSION
+		&&	header->slotCount == LM_RING_SLOTS
+		&&	header->slotSize == sizeof(LM_RingSlot))
+	{
+		producer->sequence = LM_LoadAcquire(&header->writeSequence);
+	}
+	else
+	{
+		// consumers check the magic, so it is written last
+		memset(header, 0, LM_RingSize(LM_RING_SLOTS));
+		header->version = LM_RING_VERSION;
+		header->slotCount = LM_RING_SLOTS;
+		header->slotSize = sizeof(LM_RingSlot);
+		LM_StoreFence();
+		memcpy(header->magic, LM_RING_MAGIC, sizeof(header->magic));
+	}
+
+	return true;
+}
+
+void LM_CloseRingProducer(LM_RingProducer * producer)
+{
+	// the ring is left in place so consumers can drain it and a restarted
+	// producer can carry on
+	LM_UnmapRing(&producer->mapping);
+}
+
+void LM_PublishSwipe(LM_RingProducer * producer, int64_t timestamp, uint32_t deviceId, int track, bool valid, int flags, int confidence, const char * data, int length)
+{
+	uint64_t sequence = producer->sequence;
+	LM_RingSlot * slot = &producer->slots[sequence & (LM_RING_SLOTS - 1)];
+	LM_RingRecord * record = &slot->record;
+
+	if (!valid)
+		length = 0;
+
+	LM_StoreRelease(&slot->sequence, 2 * sequence + 1);
+	LM_StoreFence();
+
+	record->timestamp = timestamp;
+	record->deviceId = deviceId;
+	record->flags = (uint16_t)flags;
+	record->length = (uint16_t)(length < LM_RING_DATASIZE ? length : LM_RING_DATASIZE);
+	record->track = (uint8_t)track;
+	record->valid = valid ? 1 : 0;
+	record->confidence = (uint8_t)confidence;
+	record->truncated = length > LM_RING_DATASIZE ? 1 : 0;
+	record->reserved = 0;
+	memcpy(record->data, data, record->length);
+	record->published = LM_MonotonicTime();
+
+	LM_StoreRelease(&slot->sequence, 2 * sequence + 2);
+
+	producer->sequence = sequence + 1;
+	LM_StoreRelease(&producer->header->writeSequence, producer->sequence);
+}
+
+bool LM_OpenRingConsumer(LM_RingConsumer * consumer, const char * name)
+{
+	memset(consumer, 0, sizeof(LM_RingConsumer));
+
+	if (!LM_MapRing(&consumer->mapping, name, false, 0))
+		return false;
+
+	const LM_RingHeader * header = (const LM_RingHeader *)consumer->mapping.base;
+
+	if (	memcmp(header->magic, LM_RING_MAGIC, sizeof(header->magic)) != 0
+		||	header->version != LM_RING_VERSION
+		||	header->slotSize != sizeof(LM_RingSlot)
+		||	header->slotCount == 0
+		||	(header->slotCount & (header->slotCount - 1)) != 0
+		||	consumer->mapping.size < LM_RingSize(header->slotCount))
+	{
+		LM_UnmapRing(&consumer->mapping);
+		return false;
+	}
+
+	consumer->header = header;
+	consumer->slots = (const LM_RingSlot *)(header + 1);
+	consumer->next = LM_LoadAcquire(&header->writeSequence);
+
+	return true;
+}
+
+void LM_CloseRingConsumer(LM_RingConsumer * consumer)
+{
+	LM_UnmapRing(&consumer->mapping);
+}
+
+const LM_RingRecord * LM_PeekRing(LM_RingConsumer * consumer)
+{
+	const uint32_t slotCount = consumer->header->slotCount;
+
+	for (;;)
+	{
+		const LM_RingSlot * slot = &consumer->slots[consumer->next & (slotCount - 1)];
+		uint64_t sequence = LM_LoadAcquire(&slot->sequence);
+		uint64_t expected = 2 * consumer->next + 2;
+
+		if (sequence == expected)
+			return &slot->record;
+
+		if (sequence < expected)
+			return NULL;
+
+		// lapped; skip ahead to the oldest message still in the ring, less the
+		// one slot the producer may be overwriting right now
+		uint64_t writeSequence = LM_LoadAcquire(&consumer->header->writeSequence);
+		uint64_t oldest = writeSequence > slotCount ? writeSequence - slotCount + 1 : 0;
+
+		if (oldest <= consumer->next)
+			oldest = consumer->next + 1;
+
+		consumer->lost += oldest - consumer->next;
+		consumer->next = oldest;
+	}
+}
+
+bool LM_ReleaseRing(LM_RingConsumer * consumer)
+{
+	const LM_RingSlot * slot = &consumer->slots[consumer->next & (consumer->header->slotCount - 1)];
+
+	LM_LoadFence();
+
+	bool intact = slot->sequence == 2 * consumer->next + 2;
+
+	if (!intact)
+		consumer->lost++;
+
+	consumer->next++;
+
+	return intact;
+}
+
+bool LM_ReadRing(LM_RingConsumer * consumer, LM_RingRecord * record)
+{
+	const LM_RingRecord * shared;
+
+	while ((shared = LM_PeekRing(consumer)) != NULL)
+	{
+		memcpy(record, shared, sizeof(LM_RingRecord));
+
+		if (LM_ReleaseRing(consumer))
+			return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,106 @@
+#ifndef LM_SWIPERING_H_
+#define LM_SWIPERING_H_
+
+#include <stdint.h>
+
+// Shared memory ring of decoded swipes, one producer and any number of
+// consumers, for readers on the same host that would otherwise parse stdout.
+//
+// The ring is a named shared memory object (shm_open on POSIX, a named file
+// mapping on Windows) holding LM_RingHeader and then slotCount fixed size
+// slots. Message n goes to slot n % slotCount. Each slot carries a sequence
+// word used as a seqlock: the producer sets it to 2n + 1 before writing the
+// record and to 2n + 2 after, so a consumer waiting for message n knows the
+// slot holds it when it reads 2n + 2, that n is not published yet when it
+// reads less, and that it was lapped when it reads more.
+//
+// Consumers never write to the ring and never make a system call to read
+// it. A slow consumer does not hold the producer back; it loses the
+// messages that were overwritten and picks up at the oldest one left.
+
+#define LM_RING_MAGIC				"LMSWRNG"
+#define LM_RING_VERSION				1
+#define LM_RING_SLOTS				4096	// power of two
+#define LM_RING_DATASIZE			208		// decoded characters kept per swipe
+#define LM_RING_CACHELINE			64
+
+struct LM_RingRecord
+{
+	int64_t		timestamp;			// nanoseconds since the Unix epoch
+	int64_t		published;			// LM_MonotonicTime() when published, for latency
+	uint32_t	deviceId;
+	uint16_t	flags;				// LM_DECODEFLAG_*
+	uint16_t	length;
+	uint8_t		track;				// LM_Track
+	uint8_t		valid;
+	uint8_t		confidence;
+	uint8_t		truncated;			// data was longer than LM_RING_DATASIZE
+	uint32_t	reserved;
+	char		data[LM_RING_DATASIZE];
+};
+
+struct LM_RingSlot
+{
+	volatile uint64_t	sequence;
+	uint64_t			reserved;
+	LM_RingRecord		record;
+};
+
+struct LM_RingHeader
+{
+	char				magic[8];
+	uint32_t			version;
+	uint32_t			slotCount;
+	uint32_t			slotSize;
+	uint32_t			reserved[11];
+	volatile uint64_t	writeSequence;		// next message number, on a cache line of its own
+	uint64_t			reserved2[7];
+};
+
+struct LM_RingMapping
+{
+	void *			base;
+	size_t			size;
+#ifdef WIN32
+	void *			mappingHandle;
+#endif
+};
+
+struct LM_RingProducer
+{
+	LM_RingMapping	mapping;
+	LM_RingHeader *	header;
+	LM_RingSlot *	slots;
+	uint64_t		sequence;
+};
+
+// Creates the ring, or takes over one left by an earlier run and carries on
+// its sequence so attached consumers keep reading.
+bool LM_OpenRingProducer(LM_RingProducer * producer, const char * name);
+void LM_CloseRingProducer(LM_RingProducer * producer);
+
+void LM_PublishSwipe(LM_RingProducer * producer, int64_t timestamp, uint32_t deviceId, int track, bool valid, int flags, int confidence, const char * data, int length);
+
+struct LM_RingConsumer
+{
+	LM_RingMapping			mapping;
+	const LM_RingHeader *	header;
+	const LM_RingSlot *		slots;
+	uint64_t				next;			// message number to read next
+	uint64_t				lost;			// messages overwritten before they were read
+};
+
+// Attaches to an existing ring and starts at the next message published.
+bool LM_OpenRingConsumer(LM_RingConsumer * consumer, const char * name);
+void LM_CloseRingConsumer(LM_RingConsumer * consumer);
+
+// Zero copy read: returns the next record in place, or NULL if none is
+// published yet. The record may be overwritten while in use, so it is only
+// good if LM_ReleaseRing, which moves on to the next message, returns true.
+const LM_RingRecord * LM_PeekRing(LM_RingConsumer * consumer);
+bool LM_ReleaseRing(LM_RingConsumer * consumer);
+
+// Copies the next intact record out. Returns false if none is published yet.
+bool LM_ReadRing(LM_RingConsumer * consumer, LM_RingRecord * record);
+
+#endif /*LM_SWIPERING_H_*/
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/un.h>
+#endif
+
+#include "LM_SwipeServer.h"
+#include "LM_Socket.h"
+
+#ifdef WIN32
+
+LM_SwipeServer * LM_OpenSwipeServer(const char *)
+{
+	return NULL;
+}
+
+void LM_CloseSwipeServer(LM_SwipeServer *)
+{
+}
+
+void LM_PublishToSubscribers(LM_SwipeServer *, const char *, size_t)
+{
+}
+
+#else
+
+#define LM_SERVER_BACKLOG			16
+#define LM_SERVER_DISCARDSIZE		256
+
+// A subscriber's queue is a byte ring; head is the next byte to send.
+struct LM_Subscriber
+{
+	int					socket;			// -1 for a free entry
+	char *				queue;
+	size_t				head;
+	size_t				size;
+	unsigned long long	dropped;		// messages that did not fit
+};
+
+struct LM_SwipeServer
+{
+	int					listenSocket;
+	int					wakePipe[2];	// wakes the server thread to send new messages or stop
+	pthread_t			thread;
+	pthread_mutex_t		mutex;			// guards the subscribers
+	bool				stopping;
+	char				path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	LM_Subscriber		subscribers[LM_SERVER_MAXSUBSCRIBERS];
+};
+
+static void LM_DropSubscriber(LM_Subscriber * subscriber)
+{
+	if (subscriber->dropped)
+		fprintf(stderr, "Subscriber disconnected after %llu swipes were dropped for it.\n", subscriber->dropped);
+
+	close(subscriber->socket);
+	free(subscriber->queue);
+
+	subscriber->socket = -1;
+	subscriber->queue = NULL;
+	subscriber->head = 0;
+	subscriber->size = 0;
+	subscriber->dropped = 0;
+}
+
+static void LM_AcceptSubscriber(LM_SwipeServer * server)
+{
+	int socket = accept(server->listenSocket, NULL, NULL);
+
+	if (socket < 0)
+		return;
+
+	LM_NoSigPipe(socket);
+
+	char * queue = (char *)malloc(LM_SERVER_QUEUESIZE);
+
+	if (!queue || !LM_SetNonBlocking(socket))
+	{
+		free(queue);
+		close(socket);
+		return;
+	}
+
+	pthread_mutex_lock(&server->mutex);
+
+	LM_Subscriber * subscriber = NULL;
+
+	for (int i = 0; !subscriber && i < LM_SERVER_MAXSUBSCRIBERS; i++)
+	{
+		if (server->subscribers[i].socket < 0)
+			subscriber = &server->subscribers[i];
+	}
+
+	if (subscriber)
+	{
+		subscriber->socket = socket;
+		subscriber->queue = queue;
+	}
+
+	pthread_mutex_unlock(&server->mutex);
+
+	if (!subscriber)
+	{
+		fprintf(stderr, "Refusing subscriber; all %d places are taken.\n", LM_SERVER_MAXSUBSCRIBERS);
+		free(queue);
+		close(socket);
+	}
+}
+
+// Sends as much of the queue as the socket takes without blocking.
+static bool LM_SendQueued(LM_Subscriber * subscriber)
+{
+	while (subscriber->size)
+	{
+		size_t contiguous = LM_SERVER_QUEUESIZE - subscriber->head;
+
+		if (contiguous > subscriber->size)
+			contiguous = subscriber->size;
+
+		ssize_t sent = send(subscriber->socket, subscriber->queue + subscriber->head, contiguous, MSG_NOSIGNAL);
+
+		if (sent < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+		subscriber->head = (subscriber->head + sent) % LM_SERVER_QUEUESIZE;
+		subscriber->size -= sent;
+	}
+
+	return true;
+}
+
+static void * LM_ServerMain(void * argument)
+{
+	LM_SwipeServer * server = (LM_SwipeServer *)argument;
+
+	struct pollfd descriptors[LM_SERVER_MAXSUBSCRIBERS + 2];
+	int owners[LM_SERVER_MAXSUBSCRIBERS + 2];
+
+	for (;;)
+	{
+		int count = 0;
+
+		descriptors[count].fd = server->wakePipe[0];
+		descriptors[count++].events = POLLIN;
+
+		descriptors[count].fd = server->listenSocket;
+		descriptors[count++].events = POLLIN;
+
+		pthread_mutex_lock(&server->mutex);
+
+		if (server->stopping)
+		{
+			pthread_mutex_unlock(&server->mutex);
+			break;
+		}
+
+		for (int i = 0; i < LM_SERVER_MAXSUBSCRIBERS; i++)
+		{
+			LM_Subscriber * subscriber = &server->subscribers[i];
+
+			if (subscriber->socket < 0)
+				continue;
+
+			owners[count] = i;
+			descriptors[count].fd = subscriber->socket;
+			descriptors[count++].events = POLLIN | (subscriber->size ? POLLOUT : 0);
+		}
+
+		pthread_mutex_unlock(&server->mutex);
+
+		if (poll(descriptors, count, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		if (descriptors[0].revents & POLLIN)
+			LM_DrainWakePipe(server->wakePipe);
+
+		if (descriptors[1].revents & POLLIN)
+			LM_AcceptSubscriber(server);
+
+		pthread_mutex_lock(&server->mutex);
+
+		for (int i = 2; i < count; i++)
+		{
+			LM_Subscriber * subscriber = &server->subscribers[owners[i]];
+			bool connected = true;
+
+			if (descriptors[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+				connected = false;
+
+			if (connected && descriptors[i].revents & POLLIN)
+			{
+				char discard[LM_SERVER_DISCARDSIZE];
+				ssize_t received = recv(subscriber->socket, discard, sizeof(discard), 0);
+
+				if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+					connected = false;
+			}
+
+			// new messages may have been queued since the poll, so send
+			// whatever is queued rather than waiting for POLLOUT
+			if (connected)
+				connected = LM_SendQueued(subscriber);
+
+			if (!connected)
+				LM_DropSubscriber(subscriber);
+		}
+
+		pthread_mutex_unlock(&server->mutex);
+	}
+
+	return NULL;
+}
+
+LM_SwipeServer * LM_OpenSwipeServer(const char * path)
+{
+	LM_SwipeServer * server = (LM_SwipeServer *)calloc(1, sizeof(LM_SwipeServer));
+
+	if (!server)
+		return NULL;
+
+	if (strlen(path) >= sizeof(server->path))
+	{
+		free(server);
+		return NULL;
+	}
+
+	strcpy(server->path, path);
+
+	for (int i = 0; i < LM_SERVER_MAXSUBSCRIBERS; i++)
+		server->subscribers[i].socket = -1;
+
+	server->wakePipe[0] = server->wakePipe[1] = -1;
+	server->listenSocket = LM_ListenUnixSocket(path, LM_SERVER_BACKLOG);
+
+	if (server->listenSocket < 0)
+	{
+		free(server);
+		return NULL;
+	}
+
+	if (!LM_SetNonBlocking(server->listenSocket) || !LM_OpenWakePipe(server->wakePipe))
+	{
+		close(server->listenSocket);
+		unlink(path);
+		free(server);
+		return NULL;
+	}
+
+	pthread_mutex_init(&server->mutex, NULL);
+
+	if (pthread_create(&server->thread, NULL, LM_ServerMain, server) != 0)
+	{
+		pthread_mutex_destroy(&server->mutex);
+		close(server->listenSocket);
+		LM_CloseWakePipe(server->wakePipe);
+		unlink(path);
+		free(server);
+		return NULL;
+	}
+
+	return server;
+}
+
+void LM_CloseSwipeServer(LM_SwipeServer * server)
+{
+	pthread_mutex_lock(&server->mutex);
+	server->stopping = true;
+	pthread_mutex_unlock(&server->mutex);
+
+	LM_WakeThread(server->wakePipe);
+	pthread_join(server->thread, NULL);
+
+	// give each subscriber what is already queued, as far as it takes it now
+	for (int i = 0; i < LM_SERVER_MAXSUBSCRIBERS; i++)
+	{
+		LM_Subscriber * subscriber = &server->subscribers[i];
+
+		if (subscriber->socket < 0)
+			continue;
+
+		LM_SendQueued(subscriber);
+		LM_DropSubscriber(subscriber);
+	}
+
+	close(server->listenSocket);
+	LM_CloseWakePipe(server->wakePipe);
+	unlink(server->path);
+
+	pthread_mutex_destroy(&server->mutex);
+	free(server);
+}
+
+void LM_PublishToSubscribers(LM_SwipeServer * server, const char * message, size_t length)
+{
+	bool queued = false;
+
+	pthread_mutex_lock(&server->mutex);
+
+	for (int i = 0; i < LM_SERVER_MAXSUBSCRIBERS; i++)
+	{
+		LM_Subscriber * subscriber = &server->subscribers[i];
+
+		if (subscriber->socket < 0)
+			continue;
+
+		if (LM_SERVER_QUEUESIZE - subscriber->size < length)
+		{
+			subscriber->dropped++;
+			continue;
+		}
+
+		size_t tail = (subscriber->head + subscriber->size) % LM_SERVER_QUEUESIZE;
+		size_t contiguous = LM_SERVER_QUEUESIZE - tail;
+
+		if (contiguous >= length)
+			memcpy(subscriber->queue + tail, message, length);
+		else
+		{
+			memcpy(subscriber->queue + tail, message, contiguous);
+			memcpy(subscriber->queue, message + contiguous, length - contiguous);
+		}
+
+		subscriber->size += length;
+		queued = true;
+	}
+
+	pthread_mutex_unlock(&server->mutex);
+
+	if (queued)
+		LM_WakeThread(server->wakePipe);
+}
+
+#endif
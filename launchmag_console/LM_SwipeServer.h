@@ -0,0 +1,28 @@
+#ifndef LM_SWIPESERVER_H_
+#define LM_SWIPESERVER_H_
+
+#include <stddef.h>
+
+// Fans decoded swipes out to any number of subscribers connected to a Unix
+// domain socket. Each subscriber has a bounded queue; publishing only copies
+// the message into the queues, and a server thread drains them with
+// non-blocking writes, so a slow or stalled subscriber never holds up the
+// reader. A message that does not fit a subscriber's queue is dropped for
+// that subscriber alone and counted.
+//
+// Subscribers only read; anything they send is discarded.
+
+#define LM_SERVER_MAXSUBSCRIBERS	64
+#define LM_SERVER_QUEUESIZE			(256 * 1024)	// bytes queued per subscriber
+
+struct LM_SwipeServer;
+
+// Listens on path, replacing a socket file left by an earlier run once no
+// server answers on it. Returns NULL on failure, and always on Windows,
+// which has no Unix sockets here.
+LM_SwipeServer * LM_OpenSwipeServer(const char * path);
+void LM_CloseSwipeServer(LM_SwipeServer * server);
+
+void LM_PublishToSubscribers(LM_SwipeServer * server, const char * message, size_t length);
+
+#endif /*LM_SWIPESERVER_H_*/
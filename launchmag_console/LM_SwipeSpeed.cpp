@@ -0,0 +1,151 @@
+#include <math.h>
+
+#include "../launchmag_firmware/LM_PacketFlags.h"
+
+#include "LM_SwipeSpeed.h"
+
+#define LM_MILLIMETRES_PER_INCH		25.4
+#define LM_SPEED_LONGESTMICROS		16320	// what LM_TIMING_SATURATED stands for, at least
+
+int LM_DecodeTimingCode(int code)
+{
+	if (code >= LM_TIMING_SATURATED)
+		return LM_SPEED_UNTIMED;
+
+	int exponent = code >> 7;
+	int mantissa = code & 0x7F;
+
+	if (!exponent)
+		return mantissa;
+
+	// the firmware drops the bits shifted out, so take the middle of the range
+	return ((128 + mantissa) << (exponent - 1)) + ((1 << (exponent - 1)) >> 1);
+}
+
+static bool LM_GroupTimed(const LM_TimingGroup * group)
+{
+	return group->micros > 0 && group->intervals > 0;
+}
+
+double LM_GroupSpeed(const LM_SwipeSpeed * speed, int group)
+{
+	const LM_TimingGroup * timing = &speed->groups[group];
+
+	if (!LM_GroupTimed(timing))
+		return -1.0;
+
+	return timing->intervals * 1000000.0 / (timing->micros * speed->bitsPerMillimetre);
+}
+
+bool LM_AnalyzeSwipeSpeed(LM_SwipeSpeed * speed, const LM_TimingGroup * groups, int groupCount, int bitsPerInch, int leadMicros)
+{
+	speed->groups = groups;
+	speed->groupCount = groupCount;
+	speed->bitsPerMillimetre = bitsPerInch / LM_MILLIMETRES_PER_INCH;
+	speed->timedGroups = 0;
+	speed->meanSpeed = 0.0;
+	speed->minSpeed = 0.0;
+	speed->maxSpeed = 0.0;
+	speed->acceleration = 0.0;
+	speed->jitter = 0.0;
+	speed->leadTime = (leadMicros >= 0) ? leadMicros / 1000000.0 : -1.0;
+
+	long long intervals = 0;
+	long long micros = 0;
+	double elapsed = 0.0;
+
+	// least squares of speed against the time of each group's middle
+	double sumTime = 0.0, sumSpeed = 0.0, sumTimeTime = 0.0, sumTimeSpeed = 0.0;
+
+	for (int i = 0; i < groupCount; i++)
+	{
+		const LM_TimingGroup * group = &groups[i];
+		double seconds = ((group->micros == LM_SPEED_UNTIMED) ? LM_SPEED_LONGESTMICROS : group->micros) / 1000000.0;
+
+		if (LM_GroupTimed(group))
+		{
+			double groupSpeed = LM_GroupSpeed(speed, i);
+			double time = elapsed + seconds / 2;
+
+			if (!speed->timedGroups || groupSpeed < speed->minSpeed)
+				speed->minSpeed = groupSpeed;
+
+			if (!speed->timedGroups || groupSpeed > speed->maxSpeed)
+				speed->maxSpeed = groupSpeed;
+
+			sumTime += time;
+			sumSpeed += groupSpeed;
+			sumTimeTime += time * time;
+			sumTimeSpeed += time * groupSpeed;
+
+			intervals += group->intervals;
+			micros += group->micros;
+			speed->timedGroups++;
+		}
+
+		elapsed += seconds;
+	}
+
+	speed->duration = elapsed;
+
+	if (speed->timedGroups < 3)
+		return false;
+
+	speed->meanSpeed = intervals * 1000000.0 / (micros * speed->bitsPerMillimetre);
+
+	double count = speed->timedGroups;
+	double denominator = count * sumTimeTime - sumTime * sumTime;
+
+	if (denominator > 0.0)
+		speed->acceleration = (count * sumTimeSpeed - sumTime * sumSpeed) / denominator;
+
+	// Against the mean of both neighbours a steady change of speed cancels
+	// out, leaving what varies from one group to the next.
+	double sumSquares = 0.0;
+	int compared = 0;
+
+	for (int i = 1; i + 1 < groupCount; i++)
+	{
+		const LM_TimingGroup * previous = &groups[i - 1];
+		const LM_TimingGroup * group = &groups[i];
+		const LM_TimingGroup * next = &groups[i + 1];
+
+		if (!LM_GroupTimed(previous) || !LM_GroupTimed(group) || !LM_GroupTimed(next))
+			continue;
+
+		double neighbours = ((double)previous->micros / previous->intervals + (double)next->micros / next->intervals) / 2;
+		double deviation = (double)group->micros / group->intervals / neighbours - 1.0;
+
+		sumSquares += deviation * deviation;
+		compared++;
+	}
+
+	if (compared)
+		speed->jitter = sqrt(sumSquares / compared) * 100.0;
+
+	return true;
+}
+
+void LM_RecordWakeLatency(LM_WakeLatency * wake, double seconds)
+{
+	if (!wake->count || seconds < wake->shortest)
+		wake->shortest = seconds;
+
+	if (!wake->count || seconds > wake->longest)
+		wake->longest = seconds;
+
+	wake->sum += seconds;
+	wake->count++;
+}
+
+void LM_PrintWakeLatency(FILE * file, const LM_WakeLatency * wake)
+{
+	if (!wake->count)
+	{
+		fprintf(file, "\nNo card loaded to first clock edge times were received.\n");
+		return;
+	}
+
+	fprintf(file, "\nCard loaded to first clock edge over %lld tracks: shortest %.2f ms (the time the wake must beat), mean %.2f ms, longest %.2f ms\n",
+		wake->count, wake->shortest * 1000.0, wake->sum / wake->count * 1000.0, wake->longest * 1000.0);
+}
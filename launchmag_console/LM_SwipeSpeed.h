@@ -0,0 +1,64 @@
+#ifndef LM_SWIPESPEED_H_
+#define LM_SWIPESPEED_H_
+
+#include <stdio.h>
+
+// Swipe speed from the edge times sent by firmware built with
+// LM_TIMINGCAPTURE (see LM_PacketFlags.h). Every data packet comes with the
+// time its clock edges spanned, so the speed is known for every 5 bits of
+// a swipe: enough to see a card slow down as it leaves the head, and, from
+// how far each group's bit period strays from its neighbours', the jitter
+// of a worn head or a sticking card path.
+//
+// A bit is a fixed length of stripe, 1/210 inch on Tracks 1 and 3 and 1/75
+// on Track 2, so a bit period is a speed.
+
+#define LM_SPEED_MAXGROUPS			4096	// timed packets kept per track
+#define LM_SPEED_UNTIMED			-1		// a group whose time was past the longest code
+
+struct LM_TimingGroup
+{
+	int		micros;			// time its intervals spanned, or LM_SPEED_UNTIMED
+	int		intervals;		// clock intervals timed
+};
+
+// Microseconds for a 10 bit timing code, or LM_SPEED_UNTIMED.
+int LM_DecodeTimingCode(int code);
+
+struct LM_SwipeSpeed
+{
+	const LM_TimingGroup *	groups;
+	int				groupCount;
+	double			bitsPerMillimetre;
+	int				timedGroups;		// groups with a time and at least one interval
+	double			duration;			// seconds from the first edge to the last
+	double			meanSpeed;			// millimetres per second, stripe length over duration
+	double			minSpeed;			// of any one group
+	double			maxSpeed;
+	double			acceleration;		// millimetres per second squared, least squares over the swipe
+	double			jitter;				// percent RMS of each group's bit period against its neighbours'
+	double			leadTime;			// seconds from card loaded to the first clock edge, or -1
+};
+
+// Works out the speed of one track. Returns false when fewer than three
+// groups were timed, too few for acceleration or jitter.
+bool LM_AnalyzeSwipeSpeed(LM_SwipeSpeed * speed, const LM_TimingGroup * groups, int groupCount, int bitsPerInch, int leadMicros);
+
+// Millimetres per second over one group, or a negative value if untimed.
+double LM_GroupSpeed(const LM_SwipeSpeed * speed, int group);
+
+// The card loaded edge wakes the firmware from LPM3, and it has to be
+// running at full speed by the first clock edge, so over many swipes the
+// shortest time between the two is the worst case the wake must beat.
+struct LM_WakeLatency
+{
+	long long	count;
+	double		shortest;			// seconds
+	double		longest;
+	double		sum;
+};
+
+void LM_RecordWakeLatency(LM_WakeLatency * wake, double seconds);
+void LM_PrintWakeLatency(FILE * file, const LM_WakeLatency * wake);
+
+#endif /*LM_SWIPESPEED_H_*/
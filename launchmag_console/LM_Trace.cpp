@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <intrin.h>
+#endif
+
+#include "LM_Trace.h"
+
+#ifdef WIN32
+#define LM_THREADLOCAL		__declspec(thread)
+#else
+#define LM_THREADLOCAL		__thread
+#endif
+
+struct LM_TraceSpan
+{
+	const char *	name;
+	long long		start;
+	long long		end;
+};
+
+struct LM_TraceBuffer
+{
+	long long		count;
+	long long		dropped;
+	LM_TraceSpan	spans[1];		// LM_traceBufferSpans of them
+};
+
+bool LM_tracing;
+
+static long long LM_traceStarted;
+static volatile long LM_traceThreadCount;		// threads that have taken a buffer, or tried to
+static long LM_traceBufferCount;
+static long long LM_traceBufferSpans;
+static LM_TraceBuffer * LM_traceBuffers[LM_TRACE_MAXTHREADS];
+
+static LM_THREADLOCAL LM_TraceBuffer * LM_threadTrace;
+static LM_THREADLOCAL bool LM_threadTraceTaken;
+
+static volatile long LM_traceUnbufferedSpans;	// of threads past the buffers
+
+bool LM_StartTrace(int threadCount, long long eventsPerThread)
+{
+	if (threadCount > LM_TRACE_MAXTHREADS)
+		threadCount = LM_TRACE_MAXTHREADS;
+
+	if (eventsPerThread < 1)
+		eventsPerThread = 1;
+
+	LM_traceBufferSpans = eventsPerThread;
+
+	size_t size = sizeof(LM_TraceBuffer) + (size_t)(eventsPerThread - 1) * sizeof(LM_TraceSpan);
+
+	for (LM_traceBufferCount = 0; LM_traceBufferCount < threadCount; LM_traceBufferCount++)
+	{
+		LM_TraceBuffer * buffer = (LM_TraceBuffer *)malloc(size);
+
+		if (!buffer)
+			break;
+
+		// writing every page now keeps page faults out of the spans measured
+		memset(buffer, 0, size);
+		LM_traceBuffers[LM_traceBufferCount] = buffer;
+	}
+
+	LM_traceStarted = LM_MonotonicTime();
+	LM_tracing = LM_traceBufferCount > 0;
+
+	return LM_tracing;
+}
+
+static LM_TraceBuffer * LM_TakeTraceBuffer()
+{
+	LM_threadTraceTaken = true;
+
+#ifdef WIN32
+	long index = _InterlockedIncrement(&LM_traceThreadCount) - 1;
+#else
+	long index = __atomic_fetch_add(&LM_traceThreadCount, 1, __ATOMIC_RELAXED);
+#endif
+
+	return (index < LM_traceBufferCount) ? LM_traceBuffers[index] : NULL;
+}
+
+void LM_RecordTraceSpan(const char * name, long long start, long long end)
+{
+	if (!LM_threadTraceTaken)
+		LM_threadTrace = LM_TakeTraceBuffer();
+
+	LM_TraceBuffer * buffer = LM_threadTrace;
+
+	if (!buffer)
+	{
+#ifdef WIN32
+		_InterlockedIncrement(&LM_traceUnbufferedSpans);
+#else
+		__atomic_fetch_add(&LM_traceUnbufferedSpans, 1, __ATOMIC_RELAXED);
+#endif
+		return;
+	}
+
+	if (buffer->count == LM_traceBufferSpans)
+	{
+		buffer->dropped++;
+		return;
+	}
+
+	LM_TraceSpan * span = &buffer->spans[buffer->count++];
+
+	span->name = name;
+	span->start = start;
+	span->end = end;
+}
+
+bool LM_WriteTrace(const char * path)
+{
+	LM_tracing = false;
+
+	FILE * file = fopen(path, "w");
+
+	if (!file)
+		return false;
+
+	long threadCount = LM_traceBufferCount;
+	long long dropped = LM_traceUnbufferedSpans;
+	bool first = true;
+
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+	for (long thread = 0; thread < threadCount; thread++)
+	{
+		LM_TraceBuffer * buffer = LM_traceBuffers[thread];
+
+		if (!buffer)
+			continue;
+
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%ld,\"args\":{\"name\":\"thread %ld\"}}",
+			first ? "" : ",\n", thread + 1, thread + 1);
+		first = false;
+
+		for (long long i = 0; i < buffer->count; i++)
+		{
+			const LM_TraceSpan * span = &buffer->spans[i];
+			long long start = span->start - LM_traceStarted;
+			long long duration = span->end - span->start;
+
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%ld,\"ts\":%lld.%03lld,\"dur\":%lld.%03lld}",
+				span->name, thread + 1, start / 1000, start % 1000, duration / 1000, duration % 1000);
+		}
+
+		dropped += buffer->dropped;
+
+		free(buffer);
+		LM_traceBuffers[thread] = NULL;
+	}
+
+	fprintf(file, "\n]}\n");
+
+	bool written = !ferror(file);
+
+	if (fclose(file) != 0)
+		written = false;
+
+	if (dropped)
+		fprintf(stderr, "Trace buffers were full; %lld spans were dropped.\n", dropped);
+
+	return written;
+}
@@ -0,0 +1,71 @@
+#ifndef LM_TRACE_H_
+#define LM_TRACE_H_
+
+#include "LM_Clock.h"
+
+// Spans of the swipe pipeline written out as Chrome trace JSON, for
+// chrome://tracing or Perfetto.
+//
+// A span is timed with LM_TraceBegin and recorded by LM_TraceEnd as one
+// complete ("X") event, the begin/end pair in a single record. Each thread
+// records into a buffer of its own, taken on its first span from those
+// LM_StartTrace allocated and touched up front at the size it was given,
+// and never grown; spans past
+// its end, and the spans of threads past the buffers, are counted and
+// dropped. While tracing is off LM_TraceBegin is a test of one global and
+// LM_TraceEnd a test of its result, and building with LM_NOTRACE removes
+// even that. Code that times spans itself tests LM_TraceOn and records with
+// LM_TraceRecord so it goes too.
+
+#define LM_TRACE_MAXTHREADS			64
+#define LM_TRACE_EVENTSPERTHREAD	(1 << 16)	// default, 1.5 MB a thread
+
+extern bool LM_tracing;
+
+void LM_RecordTraceSpan(const char * name, long long start, long long end);
+
+inline bool LM_TraceOn()
+{
+#ifdef LM_NOTRACE
+	return false;
+#else
+	return LM_tracing;
+#endif
+}
+
+inline void LM_TraceRecord(const char * name, long long start, long long end)
+{
+#ifndef LM_NOTRACE
+	LM_RecordTraceSpan(name, start, end);
+#endif
+}
+
+// Returns the span's start, or 0 when not tracing. name must be a string
+// that lives until the trace is written.
+inline long long LM_TraceBegin()
+{
+#ifdef LM_NOTRACE
+	return 0;
+#else
+	return LM_tracing ? LM_MonotonicTime() : 0;
+#endif
+}
+
+inline void LM_TraceEnd(const char * name, long long start)
+{
+#ifndef LM_NOTRACE
+	if (start)
+		LM_RecordTraceSpan(name, start, LM_MonotonicTime());
+#endif
+}
+
+// Allocates a buffer of eventsPerThread spans for each of threadCount
+// threads, the main thread included, and faults its pages in so the first
+// spans do not pay for it. Returns false if not even one could be had.
+bool LM_StartTrace(int threadCount, long long eventsPerThread);
+
+// Writes every thread's spans to path and frees the buffers. Threads that
+// recorded spans must have finished with them.
+bool LM_WriteTrace(const char * path);
+
+#endif /*LM_TRACE_H_*/
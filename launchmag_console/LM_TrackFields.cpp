@@ -0,0 +1,204 @@
+#include <memory.h>
+
+#include "LM_TrackFields.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LM_LUHN_SSE2
+#endif
+
+#define LM_FIELD_MAXPAN			19
+#define LM_FIELD_MAXNAME		26
+#define LM_FIELD_EXPIRATION		4
+#define LM_FIELD_SERVICECODE	3
+
+#define LM_LUHN_LANES			16
+
+static void LM_SetSpan(LM_Span * span, const char * data, int length)
+{
+	span->data = data;
+	span->length = length;
+}
+
+// Scans up to the separator, returning the position of the separator or -1.
+static int LM_FindSeparator(const char * data, int position, int end, char separator, int maxLength)
+{
+	for (int i = position; i < end && i - position <= maxLength; i++)
+	{
+		if (data[i] == separator)
+			return i;
+	}
+
+	return -1;
+}
+
+// Expiration and service code are fixed width, but either may be replaced by
+// a single separator when the issuer left it off the card, and short cards
+// may stop right after the name or PAN.
+static bool LM_ParseAdditionalData(LM_TrackFields * fields, const char * data, int position, int end, char separator)
+{
+	if (position >= end)
+		return true;
+
+	if (data[position] == separator)
+		position++;
+	else if (position + LM_FIELD_EXPIRATION <= end)
+	{
+		LM_SetSpan(&fields->expiration, data + position, LM_FIELD_EXPIRATION);
+		position += LM_FIELD_EXPIRATION;
+	}
+	else
+		return false;
+
+	if (position >= end)
+		return true;
+
+	if (data[position] == separator)
+		position++;
+	else if (position + LM_FIELD_SERVICECODE <= end)
+	{
+		LM_SetSpan(&fields->serviceCode, data + position, LM_FIELD_SERVICECODE);
+		position += LM_FIELD_SERVICECODE;
+	}
+	else
+		return false;
+
+	LM_SetSpan(&fields->discretionary, data + position, end - position);
+
+	return true;
+}
+
+bool LM_ParseTrack1Fields(LM_TrackFields * fields, const char * data, int length)
+{
+	memset(fields, 0, sizeof(LM_TrackFields));
+
+	if (length < 3 || data[0] != '%' || data[length - 1] != '?')
+		return false;
+
+	int end = length - 1;
+
+	fields->formatCode = data[1];
+
+	int panEnd = LM_FindSeparator(data, 2, end, '^', LM_FIELD_MAXPAN);
+	if (panEnd == -1)
+		return false;
+
+	LM_SetSpan(&fields->pan, data + 2, panEnd - 2);
+
+	int nameEnd = LM_FindSeparator(data, panEnd + 1, end, '^', LM_FIELD_MAXNAME);
+	if (nameEnd == -1)
+		return false;
+
+	LM_SetSpan(&fields->name, data + panEnd + 1, nameEnd - (panEnd + 1));
+
+	return LM_ParseAdditionalData(fields, data, nameEnd + 1, end, '^');
+}
+
+bool LM_ParseTrack2Fields(LM_TrackFields * fields, const char * data, int length)
+{
+	memset(fields, 0, sizeof(LM_TrackFields));
+
+	if (length < 2 || data[0] != ';' || data[length - 1] != '?')
+		return false;
+
+	int end = length - 1;
+
+	int panEnd = LM_FindSeparator(data, 1, end, '=', LM_FIELD_MAXPAN);
+	if (panEnd == -1)
+		return false;
+
+	LM_SetSpan(&fields->pan, data + 1, panEnd - 1);
+
+	return LM_ParseAdditionalData(fields, data, panEnd + 1, end, '=');
+}
+
+bool LM_CheckLuhn(const char * pan, int length)
+{
+	if (length < 1 || length > LM_FIELD_MAXPAN)
+		return false;
+
+	int sum = 0;
+	bool doubleDigit = false;
+
+	for (int i = length; i-->0; )
+	{
+		int digit = pan[i] - '0';
+
+		if (digit < 0 || digit > 9)
+			return false;
+
+		if (doubleDigit)
+		{
+			digit *= 2;
+			if (digit > 9)
+				digit -= 9;
+		}
+
+		sum += digit;
+		doubleDigit = !doubleDigit;
+	}
+
+	return sum % 10 == 0;
+}
+
+void LM_CheckLuhnBatch(const LM_Span * pans, int count, bool * results)
+{
+	int i = 0;
+
+#ifdef LM_LUHN_SSE2
+	// PANs are transposed so each lane holds one PAN and each column one digit
+	// position counted from the check digit. Shorter PANs are padded with zeros,
+	// which do not change the sum, and the largest lane sum (171) fits a byte.
+	const __m128i four = _mm_set1_epi8(4);
+	const __m128i nine = _mm_set1_epi8(9);
+
+	for (; i + LM_LUHN_LANES <= count; i += LM_LUHN_LANES)
+	{
+		unsigned char columns[LM_FIELD_MAXPAN][LM_LUHN_LANES];
+		bool valid[LM_LUHN_LANES];
+
+		memset(columns, 0, sizeof(columns));
+
+		for (int lane = 0; lane < LM_LUHN_LANES; lane++)
+		{
+			const LM_Span * pan = &pans[i + lane];
+
+			valid[lane] = pan->length >= 1 && pan->length <= LM_FIELD_MAXPAN;
+
+			for (int digit = 0; valid[lane] && digit < pan->length; digit++)
+			{
+				unsigned char value = (unsigned char)(pan->data[pan->length - 1 - digit] - '0');
+
+				if (value > 9)
+					valid[lane] = false;
+
+				columns[digit][lane] = value;
+			}
+		}
+
+		__m128i sum = _mm_setzero_si128();
+
+		for (int digit = 0; digit < LM_FIELD_MAXPAN; digit++)
+		{
+			__m128i value = _mm_loadu_si128((const __m128i *)columns[digit]);
+
+			if (digit & 1)
+			{
+				__m128i overflow = _mm_and_si128(_mm_cmpgt_epi8(value, four), nine);
+				value = _mm_sub_epi8(_mm_add_epi8(value, value), overflow);
+			}
+
+			sum = _mm_add_epi8(sum, value);
+		}
+
+		unsigned char sums[LM_LUHN_LANES];
+		_mm_storeu_si128((__m128i *)sums, sum);
+
+		for (int lane = 0; lane < LM_LUHN_LANES; lane++)
+			results[i + lane] = valid[lane] && sums[lane] % 10 == 0;
+	}
+#endif
+
+	for (; i < count; i++)
+		results[i] = LM_CheckLuhn(pans[i].data, pans[i].length);
+}
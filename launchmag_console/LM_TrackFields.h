@@ -0,0 +1,33 @@
+#ifndef LM_TRACKFIELDS_H_
+#define LM_TRACKFIELDS_H_
+
+// A view into a decoded track buffer. The buffer must outlive the span.
+struct LM_Span
+{
+	const char *	data;
+	int				length;
+};
+
+// ISO 7813 fields of a financial card. Fields absent from the track, such as
+// the name on Track 2, are left with a zero length.
+struct LM_TrackFields
+{
+	char	formatCode;			// Track 1 only, 'B' for financial cards
+	LM_Span	pan;
+	LM_Span	name;
+	LM_Span	expiration;			// YYMM
+	LM_Span	serviceCode;
+	LM_Span	discretionary;
+};
+
+// Both parsers take the decoded characters including the start and end
+// sentinels and walk them once without copying.
+bool LM_ParseTrack1Fields(LM_TrackFields * fields, const char * data, int length);
+bool LM_ParseTrack2Fields(LM_TrackFields * fields, const char * data, int length);
+
+// Luhn (mod 10) check of a PAN. The batch form validates many PANs at once,
+// sixteen to a vector where SSE2 is available, for replay and batch jobs.
+bool LM_CheckLuhn(const char * pan, int length);
+void LM_CheckLuhnBatch(const LM_Span * pans, int count, bool * results);
+
+#endif /*LM_TRACKFIELDS_H_*/
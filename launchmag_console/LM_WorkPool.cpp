@@ -0,0 +1,304 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "LM_WorkPool.h"
+
+#define LM_WORKDEQUE_INITIALSIZE	64
+
+#ifdef WIN32
+typedef CRITICAL_SECTION	LM_Mutex;
+typedef CONDITION_VARIABLE	LM_Condition;
+typedef HANDLE				LM_Thread;
+
+static void LM_InitializeMutex(LM_Mutex * mutex)		{ InitializeCriticalSection(mutex); }
+static void LM_DeleteMutex(LM_Mutex * mutex)			{ DeleteCriticalSection(mutex); }
+static void LM_Lock(LM_Mutex * mutex)					{ EnterCriticalSection(mutex); }
+static void LM_Unlock(LM_Mutex * mutex)					{ LeaveCriticalSection(mutex); }
+
+static void LM_InitializeCondition(LM_Condition * condition)	{ InitializeConditionVariable(condition); }
+static void LM_DeleteCondition(LM_Condition * condition)		{ }
+static void LM_Wait(LM_Condition * condition, LM_Mutex * mutex)	{ SleepConditionVariableCS(condition, mutex, INFINITE); }
+static void LM_Signal(LM_Condition * condition)					{ WakeConditionVariable(condition); }
+static void LM_Broadcast(LM_Condition * condition)				{ WakeAllConditionVariable(condition); }
+#else
+typedef pthread_mutex_t		LM_Mutex;
+typedef pthread_cond_t		LM_Condition;
+typedef pthread_t			LM_Thread;
+
+static void LM_InitializeMutex(LM_Mutex * mutex)		{ pthread_mutex_init(mutex, NULL); }
+static void LM_DeleteMutex(LM_Mutex * mutex)			{ pthread_mutex_destroy(mutex); }
+static void LM_Lock(LM_Mutex * mutex)					{ pthread_mutex_lock(mutex); }
+static void LM_Unlock(LM_Mutex * mutex)					{ pthread_mutex_unlock(mutex); }
+
+static void LM_InitializeCondition(LM_Condition * condition)	{ pthread_cond_init(condition, NULL); }
+static void LM_DeleteCondition(LM_Condition * condition)		{ pthread_cond_destroy(condition); }
+static void LM_Wait(LM_Condition * condition, LM_Mutex * mutex)	{ pthread_cond_wait(condition, mutex); }
+static void LM_Signal(LM_Condition * condition)					{ pthread_cond_signal(condition); }
+static void LM_Broadcast(LM_Condition * condition)				{ pthread_cond_broadcast(condition); }
+#endif
+
+// Ring buffer of items. The owner takes from the head, thieves from the tail.
+struct LM_WorkDeque
+{
+	LM_Mutex		mutex;
+	LM_WorkItem **	items;
+	int				capacity;
+	int				head;
+	int				count;
+};
+
+struct LM_Worker
+{
+	LM_WorkPool *	pool;
+	int				index;
+	LM_Thread		thread;
+	LM_WorkDeque	deque;
+};
+
+struct LM_WorkPool
+{
+	LM_Mutex		mutex;
+	LM_Condition	available;		// signalled when work is submitted or the pool stops
+	LM_Condition	completed;		// broadcast when any item finishes
+	int				pending;		// submitted items no worker has taken yet
+	bool			stopping;
+	int				nextWorker;
+	int				workerCount;
+	LM_Worker *		workers;
+};
+
+static void LM_PushWork(LM_WorkDeque * deque, LM_WorkItem * item)
+{
+	LM_Lock(&deque->mutex);
+
+	if (deque->count == deque->capacity)
+	{
+		int capacity = deque->capacity ? deque->capacity * 2 : LM_WORKDEQUE_INITIALSIZE;
+		LM_WorkItem ** items = (LM_WorkItem **)malloc(capacity * sizeof(LM_WorkItem *));
+
+		for (int i = 0; i < deque->count; i++)
+			items[i] = deque->items[(deque->head + i) % deque->capacity];
+
+		free(deque->items);
+		deque->items = items;
+		deque->capacity = capacity;
+		deque->head = 0;
+	}
+
+	deque->items[(deque->head + deque->count) % deque->capacity] = item;
+	deque->count++;
+
+	LM_Unlock(&deque->mutex);
+}
+
+static LM_WorkItem * LM_TakeWork(LM_WorkDeque * deque, bool steal)
+{
+	LM_WorkItem * item = NULL;
+
+	LM_Lock(&deque->mutex);
+
+	if (deque->count > 0)
+	{
+		if (steal)
+			item = deque->items[(deque->head + deque->count - 1) % deque->capacity];
+		else
+		{
+			item = deque->items[deque->head];
+			deque->head = (deque->head + 1) % deque->capacity;
+		}
+
+		deque->count--;
+	}
+
+	LM_Unlock(&deque->mutex);
+
+	return item;
+}
+
+static LM_WorkItem * LM_FindWork(LM_Worker * worker)
+{
+	LM_WorkPool * pool = worker->pool;
+
+	LM_WorkItem * item = LM_TakeWork(&worker->deque, false);
+
+	for (int i = 1; !item && i < pool->workerCount; i++)
+		item = LM_TakeWork(&pool->workers[(worker->index + i) % pool->workerCount].deque, true);
+
+	return item;
+}
+
+#ifdef WIN32
+static DWORD WINAPI LM_WorkerMain(LPVOID argument)
+#else
+static void * LM_WorkerMain(void * argument)
+#endif
+{
+	LM_Worker * worker = (LM_Worker *)argument;
+	LM_WorkPool * pool = worker->pool;
+
+	for (;;)
+	{
+		LM_Lock(&pool->mutex);
+
+		while (!pool->pending && !pool->stopping)
+			LM_Wait(&pool->available, &pool->mutex);
+
+		if (!pool->pending)
+		{
+			LM_Unlock(&pool->mutex);
+			break;
+		}
+
+		LM_Unlock(&pool->mutex);
+
+		// pending counts items before they reach a deque, so a worker woken
+		// for an item still being pushed may find nothing and go round again
+		LM_WorkItem * item = LM_FindWork(worker);
+
+		if (!item)
+			continue;
+
+		LM_Lock(&pool->mutex);
+		pool->pending--;
+		LM_Unlock(&pool->mutex);
+
+		item->function(item->argument);
+
+		LM_Lock(&pool->mutex);
+		item->done = 1;
+		LM_Broadcast(&pool->completed);
+		LM_Unlock(&pool->mutex);
+	}
+
+	return 0;
+}
+
+LM_WorkPool * LM_CreateWorkPool(int threadCount)
+{
+	if (threadCount < 1)
+		threadCount = 1;
+
+	LM_WorkPool * pool = (LM_WorkPool *)calloc(1, sizeof(LM_WorkPool));
+	LM_Worker * workers = (LM_Worker *)calloc(threadCount, sizeof(LM_Worker));
+
+	if (!pool || !workers)
+	{
+		free(pool);
+		free(workers);
+		return NULL;
+	}
+
+	LM_InitializeMutex(&pool->mutex);
+	LM_InitializeCondition(&pool->available);
+	LM_InitializeCondition(&pool->completed);
+
+	pool->workers = workers;
+
+	for (int i = 0; i < threadCount; i++)
+	{
+		LM_Worker * worker = &workers[i];
+
+		worker->pool = pool;
+		worker->index = i;
+		LM_InitializeMutex(&worker->deque.mutex);
+
+#ifdef WIN32
+		worker->thread = CreateThread(NULL, 0, LM_WorkerMain, worker, 0, NULL);
+		bool started = worker->thread != NULL;
+#else
+		bool started = pthread_create(&worker->thread, NULL, LM_WorkerMain, worker) == 0;
+#endif
+
+		if (!started)
+		{
+			LM_DeleteMutex(&worker->deque.mutex);
+			break;
+		}
+
+		pool->workerCount++;
+	}
+
+	if (!pool->workerCount)
+	{
+		LM_DestroyWorkPool(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+void LM_DestroyWorkPool(LM_WorkPool * pool)
+{
+	LM_Lock(&pool->mutex);
+	pool->stopping = true;
+	LM_Broadcast(&pool->available);
+	LM_Unlock(&pool->mutex);
+
+	for (int i = 0; i < pool->workerCount; i++)
+	{
+		LM_Worker * worker = &pool->workers[i];
+
+#ifdef WIN32
+		WaitForSingleObject(worker->thread, INFINITE);
+		CloseHandle(worker->thread);
+#else
+		pthread_join(worker->thread, NULL);
+#endif
+
+		LM_DeleteMutex(&worker->deque.mutex);
+		free(worker->deque.items);
+	}
+
+	LM_DeleteCondition(&pool->available);
+	LM_DeleteCondition(&pool->completed);
+	LM_DeleteMutex(&pool->mutex);
+
+	free(pool->workers);
+	free(pool);
+}
+
+void LM_SubmitWork(LM_WorkPool * pool, LM_WorkItem * item)
+{
+	item->done = 0;
+
+	LM_Lock(&pool->mutex);
+	int workerIndex = pool->nextWorker;
+	pool->nextWorker = (pool->nextWorker + 1) % pool->workerCount;
+	pool->pending++;
+	LM_Unlock(&pool->mutex);
+
+	LM_PushWork(&pool->workers[workerIndex].deque, item);
+
+	LM_Lock(&pool->mutex);
+	LM_Signal(&pool->available);
+	LM_Unlock(&pool->mutex);
+}
+
+void LM_WaitForWork(LM_WorkPool * pool, LM_WorkItem * item)
+{
+	LM_Lock(&pool->mutex);
+
+	while (!item->done)
+		LM_Wait(&pool->completed, &pool->mutex);
+
+	LM_Unlock(&pool->mutex);
+}
+
+int LM_ProcessorCount()
+{
+#ifdef WIN32
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	return (int)systemInfo.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+#endif
+}
@@ -0,0 +1,32 @@
+#ifndef LM_WORKPOOL_H_
+#define LM_WORKPOOL_H_
+
+typedef void (*LM_WorkFunction)(void * argument);
+
+// One unit of work. The caller owns the item and must keep it alive until
+// LM_WaitForWork has returned for it.
+struct LM_WorkItem
+{
+	LM_WorkFunction		function;
+	void *				argument;
+	volatile int		done;
+};
+
+// Work-stealing pool. Submitted items are dealt round robin to per-worker
+// deques; a worker takes its own items oldest first and, when it runs dry,
+// steals the newest item from another worker. Taking the oldest first keeps
+// items finishing roughly in submission order, so a caller merging results
+// in order rarely waits on a straggler.
+struct LM_WorkPool;
+
+LM_WorkPool * LM_CreateWorkPool(int threadCount);
+
+// Waits for all submitted work, then stops and frees the pool.
+void LM_DestroyWorkPool(LM_WorkPool * pool);
+
+void LM_SubmitWork(LM_WorkPool * pool, LM_WorkItem * item);
+void LM_WaitForWork(LM_WorkPool * pool, LM_WorkItem * item);
+
+int LM_ProcessorCount();
+
+#endif /*LM_WORKPOOL_H_*/
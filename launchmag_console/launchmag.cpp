@@ -1,16 +1,45 @@
 #pragma warning( disable : 4996 )
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <memory.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "argtable/argtable2.h"
 
 #include "../launchmag_firmware/LM_PacketFlags.h"
 
+#include "LM_DecodeFlags.h"
+#include "LM_ReadQuality.h"
+#include "LM_TrackFields.h"
+#include "LM_BinIndex.h"
+#include "LM_Clock.h"
+#include "LM_DedupeCache.h"
+#include "LM_SwipeLog.h"
+#include "LM_SwipeArchive.h"
+#include "LM_SwipeRing.h"
+#include "LM_SwipeServer.h"
+#include "LM_WorkPool.h"
+#include "LM_OutputFormat.h"
+#include "LM_SwipeLatency.h"
+#include "LM_Metrics.h"
+#include "LM_Trace.h"
+#include "LM_F2FDecoder.h"
+#include "LM_SwipeSpeed.h"
+#include "LM_CommandChannel.h"
+
 #ifdef WIN32
 #include <fcntl.h>
 #include <io.h>
 #include <Windows.h>
+#else
+#include <errno.h>
+#include <unistd.h>
 #endif
 
 #ifdef WIN32
@@ -65,141 +94,671 @@ enum LM_PrintMode
 #define LM_PRINTFLAG_TRACK2		0x0001
 #define LM_PRINTFLAG_TRACK1		0x0002
 #define LM_PRINTFLAG_LABELS		0x0004
+#define LM_PRINTFLAG_TRACK3		0x0008
+#define LM_PRINTFLAG_FIELDS		0x0010
+#define LM_PRINTFLAG_LUHN		0x0020
+#define LM_PRINTFLAG_DUPLICATES	0x0040	// print repeat swipes tagged instead of dropping them
+#define LM_PRINTFLAG_TIMING		0x0080	// work out swipe speed from timing packets
+#define LM_PRINTFLAG_QUALITY	0x0100
 
 #define LM_TRACKBUFFER_SIZE		2048
 
-bool LM_PrintInterpret(const char * track, int bitCount, int printFlags)
+#define LM_SERIAL_BYTE_TIME		1041667	// nanoseconds per byte at 9600 baud, 8N1
+
+
+#define LM_BATCH_CHUNKSIZE		(256 * 1024)	// minimum capture bytes per batch chunk
+#define LM_BATCH_CHUNKSPERTHREAD	4			// chunks in flight per thread while merging
+
+struct LM_Options
+{
+	LM_PrintMode		printMode;
+	int					printFlags;
+	int					maxSentinelDistance;
+	int					deviceId;
+	LM_BinTable *		binTable;
+	LM_DedupeCache *	dedupeCache;
+	LM_LogWriter *		logWriter;
+	LM_ArchiveWriter *	archiveWriter;
+	LM_RingProducer *	ring;
+	LM_SwipeServer *	server;
+	LM_OutputWriter *	output;			// machine readable output instead of text, or NULL
+	LM_SwipeLatency *	latency;		// stage histograms, or NULL to read no clocks for them
+	LM_Metrics *		metrics;
+	LM_WakeLatency *	wakeLatency;	// with LM_PRINTFLAG_TIMING
+	LM_CommandPort *	commandPort;	// the reader's serial port, for following a baud change, or NULL
+};
+
+#define LM_DECODEDTRACK_SIZE		4096
+#define LM_SWIPELINE_SIZE			(LM_DECODEDTRACK_SIZE + 256)	// a formatted swipe line
+
+#define LM_SENTINEL_LEADINGZEROS	16		// leading zeros expected ahead of the start sentinel
+#define LM_SENTINEL_CANDIDATES		8		// alignments tried per direction when salvaging
+#define LM_SENTINEL_MAXDISTANCE		0		// default bit errors tolerated when salvaging, so off unless -s is given
+
+#define LM_QUALITY_MINCHARACTERS	3		// start sentinel, one character, end sentinel
+#define LM_QUALITY_CORRECTEDCOST	25		// score lost to a character repaired from the LRC
+#define LM_QUALITY_NOLRCCOST		15
+#define LM_QUALITY_SALVAGEDCOST		10		// and a point for each percent of sentinel confidence
+#define LM_QUALITY_LENGTHCOST		30
+
+struct LM_TrackFormat
+{
+	int				bitsPerCharacter;	// data bits plus the odd parity bit
+	unsigned char	startSentinel;		// including parity bit
+	unsigned char	endSentinel;		// including parity bit
+	char			characterOffset;	// added to the data bits to get ASCII
+	int				maxCharacters;		// ISO 7811 capacity, sentinels and LRC included
+};
+
+const LM_TrackFormat LM_TRACKFORMAT_TRACK2 = { 5, 0x0B, 0x1F, 0x30, 40 };
+const LM_TrackFormat LM_TRACKFORMAT_TRACK1 = { 7, 0x45, 0x1F, 0x20, 79 };
+const LM_TrackFormat LM_TRACKFORMAT_TRACK3 = { 5, 0x0B, 0x1F, 0x30, 107 };	// ISO 4909 shares the Track 2 character set
+
+enum LM_Track
+{
+	LM_TRACK_1 = 0,
+	LM_TRACK_2,
+	LM_TRACK_3,
+	LM_TRACK_COUNT,
+};
+
+struct LM_TrackInfo
+{
+	const char *			label;
+	const char *			name;
+	int						printFlag;
+	const LM_TrackFormat *	format;
+	int						bitsPerInch;
+	bool					(*parseFields)(LM_TrackFields * fields, const char * data, int length);
+};
+
+const LM_TrackInfo LM_TRACKINFO[LM_TRACK_COUNT] = {
+	{ "Track 1: ", "track1", LM_PRINTFLAG_TRACK1, &LM_TRACKFORMAT_TRACK1, 210, LM_ParseTrack1Fields },
+	{ "Track 2: ", "track2", LM_PRINTFLAG_TRACK2, &LM_TRACKFORMAT_TRACK2, 75, LM_ParseTrack2Fields },
+	{ "Track 3: ", "track3", LM_PRINTFLAG_TRACK3, &LM_TRACKFORMAT_TRACK3, 210, NULL },
+};
+
+struct LM_TrackBuffer
+{
+	char	data[LM_TRACKBUFFER_SIZE];
+	int		bitCount;
+	int		packetSize;
+	long long	startTime;			// LM_MonotonicTime() of the START byte, with --latency
+	long long	lastDataTime;		// and of the last data byte
+	int		lastPacketBits;		// bits in the last data packet, which the next timing packet times
+	int		timingHigh;			// first half of a timing code, or -1
+	bool	leadPending;		// the next timing code is card loaded to the first edge
+	int		leadMicros;
+	int		timingGroupCount;
+	LM_TimingGroup	timingGroups[LM_SPEED_MAXGROUPS];
+};
+
+struct LM_DecodedTrack
+{
+	char	data[LM_DECODEDTRACK_SIZE];
+	int		length;
+	int		flags;
+	int		confidence;		// percentage of the sentinel window that matched
+	LM_ReadQuality	quality;
+};
+
+struct LM_SentinelCandidate
 {
-	char printableData[4096];
-	memset(printableData, 0, sizeof(printableData));
-	char *pPrintableData = printableData;
+	int		dataStartBit;	// first bit after the start sentinel
+	int		distance;		// bit errors against the expected window
+	int		confidence;
+};
 
-	if (printFlags & LM_PRINTFLAG_TRACK2)
+bool LM_CheckParity(unsigned char character, const LM_TrackFormat * format)
+{
+	bool calculatedEvenParity = true;
+	for (int i = format->bitsPerCharacter - 1; i-->0; )
 	{
-		unsigned char currentByte = 0;
-		int currentBitCount = 0;
+		if (character & (1 << i))
+			calculatedEvenParity = !calculatedEvenParity;
+	}
 
-		for (; currentBitCount < bitCount; currentBitCount++)
-		{
-			if (currentByte == 0x0B)
-				break;
+	return calculatedEvenParity == !!(character & (1 << (format->bitsPerCharacter - 1)));
+}
 
-			currentByte = currentByte >> 1;
+int LM_CountZeroBits(const char * track, int from, int to)
+{
+	int zeros = 0;
 
-			if (track[currentBitCount / 8] & (0x01 << (7 - (currentBitCount % 8))))
-				currentByte |= 0x10;
-		}
+	for (int i = from; i < to; i++)
+	{
+		if (!(track[i / 8] & (0x01 << (7 - (i % 8)))))
+			zeros++;
+	}
 
-		if (currentByte != 0x0B)
-			return false;
+	return zeros;
+}
 
-		if (pPrintableData - printableData > sizeof(printableData))
-			return false;
+// Decodes the characters following a start sentinel that ends just before
+// bit currentBitCount. The sentinel itself is taken as given, so a caller that
+// located it approximately still gets an exact LRC over the whole track.
+bool LM_DecodeTrackAt(LM_DecodedTrack * decoded, const char * track, int bitCount, const LM_TrackFormat * format, int currentBitCount)
+{
+	unsigned char characters[LM_DECODEDTRACK_SIZE];
+	int characterCount = 0;
+	const int sentinelStartBit = currentBitCount - format->bitsPerCharacter;
 
-		*(pPrintableData++) = currentByte + 0x30;
+	const unsigned char parityBit = 0x01 << (format->bitsPerCharacter - 1);
+	const unsigned char dataMask = parityBit - 1;
 
-		int bitsRead = 0;
-		bool calculatedEvenParity;
+	decoded->length = 0;
+	decoded->flags = 0;
+	decoded->confidence = 100;
 
-		for (; currentBitCount < bitCount; currentBitCount++)
-		{
-			currentByte = currentByte >> 1;
+	unsigned char currentByte = format->startSentinel;
 
-			if (track[currentBitCount / 8] & (0x01 << (7 - (currentBitCount % 8))))
-				currentByte |= 0x10;
+	characters[characterCount++] = currentByte;
 
-			if (++bitsRead == 5)
-			{
-				calculatedEvenParity = true;
-				for (int i = 4; i-->0; )
-				{
-					if (currentByte & (1 << i))
-						calculatedEvenParity = !calculatedEvenParity;
-				}
+	// Characters are read up to and including the end sentinel, followed by
+	// the LRC character if the swipe captured enough bits for it. At most one
+	// character may fail parity; the LRC decides whether it can be repaired.
+	int parityErrorIndex = -1;
+	int lrcIndex = -1;
+	int bitsRead = 0;
+	int endSentinelEndBit = bitCount;
+	int lrcEndBit = bitCount;
 
-				if (calculatedEvenParity != !!(currentByte & 0x10))
-					return false;
+	for (; currentBitCount < bitCount; currentBitCount++)
+	{
+		currentByte = currentByte >> 1;
 
-				if (pPrintableData - printableData > sizeof(printableData))
+		if (track[currentBitCount / 8] & (0x01 << (7 - (currentBitCount % 8))))
+			currentByte |= parityBit;
+
+		if (++bitsRead == format->bitsPerCharacter)
+		{
+			if (characterCount >= LM_DECODEDTRACK_SIZE - 1)
+				return false;
+
+			if (!LM_CheckParity(currentByte, format))
+			{
+				if (parityErrorIndex != -1)
 					return false;
 
-				*(pPrintableData++) = (currentByte & 0x0F) + 0x30;
+				parityErrorIndex = characterCount;
+			}
+
+			characters[characterCount++] = currentByte;
 
-				if (currentByte == 0x1F)
-					break;
+			if (lrcIndex != -1)
+			{
+				lrcEndBit = currentBitCount + 1;
+				break;
+			}
 
-				bitsRead = 0;
+			if (currentByte == format->endSentinel)
+			{
+				lrcIndex = characterCount;
+				endSentinelEndBit = currentBitCount + 1;
 			}
+
+			bitsRead = 0;
 		}
-		
-		if (currentByte != 0x1F)
-			return false;
 	}
-	else if (printFlags & LM_PRINTFLAG_TRACK1)
+
+	if (lrcIndex == -1)
+		return false;
+
+	int dataCount = lrcIndex;
+
+	// Readers that stop clocking right after the end sentinel leave nothing
+	// but zeros where the LRC would be; treat that as a missing LRC.
+	if (	lrcIndex < characterCount
+		&&	characters[lrcIndex] == 0
+		&&	parityErrorIndex == lrcIndex)
+	{
+		characterCount = lrcIndex;
+		parityErrorIndex = -1;
+	}
+
+	if (lrcIndex < characterCount)
 	{
-		unsigned char currentByte = 0;
-		int currentBitCount = 0;
+		unsigned char columnParity = 0;
+		for (int i = 0; i < characterCount; i++)
+			columnParity ^= characters[i] & dataMask;
 
-		for (; currentBitCount < bitCount; currentBitCount++)
+		if (parityErrorIndex == -1)
 		{
-			if (currentByte == 0x45)
-				break;
+			// A mismatch without a parity failure means an even number of
+			// bits flipped in one character, which parity alone cannot see.
+			if (columnParity != 0)
+				return false;
+		}
+		else
+		{
+			if (columnParity & (columnParity - 1))
+				return false;
+
+			characters[parityErrorIndex] ^= columnParity ? columnParity : parityBit;
 
-			currentByte = currentByte >> 1;
+			if (	parityErrorIndex < lrcIndex - 1
+				&&	characters[parityErrorIndex] == format->endSentinel)
+				return false;
 
-			if (track[currentBitCount / 8] & (0x01 << (7 - (currentBitCount % 8))))
-				currentByte |= 0x40;
+			decoded->flags |= LM_DECODEFLAG_CORRECTED;
 		}
 
-		if (currentByte != 0x45)
-			return false;
+		decoded->flags |= LM_DECODEFLAG_LRCVALID;
+	}
+	else if (parityErrorIndex != -1)
+	{
+		return false;
+	}
 
-		if (pPrintableData - printableData > sizeof(printableData))
-			return false;
+	decoded->quality.leadingZeros = LM_CountZeroBits(track, 0, sentinelStartBit);
+	decoded->quality.trailingZeros = LM_CountZeroBits(track, (lrcIndex < characterCount) ? lrcEndBit : endSentinelEndBit, bitCount);
+	decoded->quality.parityErrors = (parityErrorIndex != -1) ? 1 : 0;
+
+	for (int i = 0; i < dataCount; i++)
+		decoded->data[decoded->length++] = (characters[i] & dataMask) + format->characterOffset;
+
+	decoded->data[decoded->length] = 0;
+
+	return true;
+}
+
+bool LM_DecodeTrack(LM_DecodedTrack * decoded, const char * track, int bitCount, const LM_TrackFormat * format)
+{
+	const unsigned char parityBit = 0x01 << (format->bitsPerCharacter - 1);
+
+	unsigned char currentByte = 0;
+	int currentBitCount = 0;
+
+	for (; currentBitCount < bitCount; currentBitCount++)
+	{
+		if (currentByte == format->startSentinel)
+			break;
+
+		currentByte = currentByte >> 1;
+
+		if (track[currentBitCount / 8] & (0x01 << (7 - (currentBitCount % 8))))
+			currentByte |= parityBit;
+	}
+
+	if (currentByte != format->startSentinel)
+		return false;
+
+	return LM_DecodeTrackAt(decoded, track, bitCount, format, currentBitCount);
+}
+
+int LM_PopCount64(unsigned long long value)
+{
+#ifdef __GNUC__
+	return __builtin_popcountll(value);
+#else
+	value = value - ((value >> 1) & 0x5555555555555555ULL);
+	value = (value & 0x3333333333333333ULL) + ((value >> 2) & 0x3333333333333333ULL);
+	value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int)((value * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// Slides a 64 bit window over the track comparing it against the expected
+// run of leading zeros followed by the start sentinel. Every alignment within
+// maxDistance bit errors is kept, best first, so a flipped bit in the zeros
+// or the sentinel no longer costs the whole read.
+int LM_LocateSentinels(LM_SentinelCandidate * candidates, int maxCandidates, const char * track, int bitCount, const LM_TrackFormat * format, int maxDistance)
+{
+	const int patternBits = LM_SENTINEL_LEADINGZEROS + format->bitsPerCharacter;
+	const unsigned long long patternMask = (patternBits >= 64) ? ~0ULL : ((1ULL << patternBits) - 1);
+
+	// the most recently read bit sits in bit 0 of the window, so the
+	// sentinel appears with its first read (least significant) bit highest
+	unsigned long long pattern = 0;
+	for (int i = 0; i < format->bitsPerCharacter; i++)
+	{
+		if (format->startSentinel & (0x01 << i))
+			pattern |= 1ULL << (format->bitsPerCharacter - 1 - i);
+	}
+
+	int candidateCount = 0;
+	unsigned long long window = 0;
+
+	for (int currentBitCount = 0; currentBitCount < bitCount; currentBitCount++)
+	{
+		window <<= 1;
+
+		if (track[currentBitCount / 8] & (0x01 << (7 - (currentBitCount % 8))))
+			window |= 1;
+
+		int distance = LM_PopCount64((window ^ pattern) & patternMask);
+
+		if (distance > maxDistance)
+			continue;
+
+		if (candidateCount == maxCandidates && distance >= candidates[candidateCount - 1].distance)
+			continue;
+
+		int i = (candidateCount < maxCandidates) ? candidateCount++ : candidateCount - 1;
+		for (; i > 0 && candidates[i - 1].distance > distance; i--)
+			candidates[i] = candidates[i - 1];
+
+		candidates[i].dataStartBit = currentBitCount + 1;
+		candidates[i].distance = distance;
+		candidates[i].confidence = ((patternBits - distance) * 100) / patternBits;
+	}
+
+	return candidateCount;
+}
+
+void LM_ReverseTrackData(char * trackReversed, const char * track, int bitCount)
+{
+	memset(trackReversed, 0, LM_TRACKBUFFER_SIZE);
+
+	for (int i = 0; i < bitCount; i++)
+	{
+		if (track[i / 8] & (0x01 << (7 - (i % 8))))
+			trackReversed[((bitCount - 1) - i) / 8] |= (0x01 << (7 - (((bitCount - 1) - i) % 8)));
+	}
+}
+
+// Tries an exact forward then reversed decode. If both fail and salvaging is
+// enabled, the best sentinel candidates from either direction are decoded in
+// order of distance; a salvaged read is only accepted when its LRC checks.
+bool LM_DecodeEitherDirection(LM_DecodedTrack * decoded, const char * track, int bitCount, const LM_TrackFormat * format, int maxSentinelDistance, int * attempts)
+{
+	long long traceStart = LM_TraceBegin();
+	bool decodedForward = LM_DecodeTrack(decoded, track, bitCount, format);
+	LM_TraceEnd("forward decode", traceStart);
+
+	*attempts = 1;
+
+	if (decodedForward)
+		return true;
+
+	traceStart = LM_TraceBegin();
+
+	char reversedTrack[LM_TRACKBUFFER_SIZE];
+	LM_ReverseTrackData(reversedTrack, track, bitCount);
+
+	bool decodedReverse = LM_DecodeTrack(decoded, reversedTrack, bitCount, format);
+	LM_TraceEnd("reverse decode", traceStart);
+
+	*attempts = 2;
+
+	if (decodedReverse)
+	{
+		decoded->flags |= LM_DECODEFLAG_REVERSED;
+		return true;
+	}
+
+	if (maxSentinelDistance <= 0)
+		return false;
+
+	traceStart = LM_TraceBegin();
+
+	LM_SentinelCandidate candidates[2][LM_SENTINEL_CANDIDATES];
+	int candidateCounts[2];
 
-		*(pPrintableData++) = (currentByte & 0x3F) + 0x20;
+	candidateCounts[0] = LM_LocateSentinels(candidates[0], LM_SENTINEL_CANDIDATES, track, bitCount, format, maxSentinelDistance);
+	candidateCounts[1] = LM_LocateSentinels(candidates[1], LM_SENTINEL_CANDIDATES, reversedTrack, bitCount, format, maxSentinelDistance);
 
-		int bitsRead = 0;
-		bool calculatedEvenParity;
+	int next[2] = { 0, 0 };
 
-		for (; currentBitCount < bitCount; currentBitCount++)
+	while (next[0] < candidateCounts[0] || next[1] < candidateCounts[1])
+	{
+		int direction = 0;
+		if (	next[0] == candidateCounts[0]
+			||	(next[1] < candidateCounts[1] && candidates[1][next[1]].distance < candidates[0][next[0]].distance))
 		{
-			currentByte = currentByte >> 1;
+			direction = 1;
+		}
 
-			if (track[currentBitCount / 8] & (0x01 << (7 - (currentBitCount % 8))))
-				currentByte |= 0x40;
+		const LM_SentinelCandidate * candidate = &candidates[direction][next[direction]++];
 
-			if (++bitsRead == 7)
-			{
-				calculatedEvenParity = true;
-				for (int i = 6; i-->0; )
-				{
-					if (currentByte & (1 << i))
-						calculatedEvenParity = !calculatedEvenParity;
-				}
+		(*attempts)++;
 
-				if (calculatedEvenParity != !!(currentByte & 0x40))
-					return false;
+		if (	LM_DecodeTrackAt(decoded, direction ? reversedTrack : track, bitCount, format, candidate->dataStartBit)
+			&&	decoded->flags & LM_DECODEFLAG_LRCVALID)
+		{
+			decoded->flags |= LM_DECODEFLAG_SALVAGED | (direction ? LM_DECODEFLAG_REVERSED : 0);
+			decoded->confidence = candidate->confidence;
+			LM_TraceEnd("salvage", traceStart);
+			return true;
+		}
+	}
 
-				if (pPrintableData - printableData > sizeof(printableData))
-					return false;
+	LM_TraceEnd("salvage", traceStart);
 
-				*(pPrintableData++) = (currentByte & 0x3F) + 0x20;
+	return false;
+}
 
-				if (currentByte == 0x1F)
-					break;
+// Scores a read from what decoding it found, see LM_ReadQuality.h. The
+// direction of a swipe is not held against it.
+void LM_ScoreRead(LM_DecodedTrack * decoded, bool valid, const LM_TrackFormat * format, int attempts)
+{
+	LM_ReadQuality * quality = &decoded->quality;
 
-				bitsRead = 0;
-			}
+	quality->attempts = attempts;
+
+	if (!valid)
+	{
+		quality->score = 0;
+		quality->leadingZeros = -1;
+		quality->trailingZeros = -1;
+		quality->parityErrors = -1;
+		quality->plausibleLength = false;
+		return;
+	}
+
+	const int flags = decoded->flags;
+	int characters = decoded->length + ((flags & LM_DECODEFLAG_LRCVALID) ? 1 : 0);
+
+	quality->plausibleLength = characters >= LM_QUALITY_MINCHARACTERS && characters <= format->maxCharacters;
+
+	// a point for each clocking zero short of what the sentinel search expects
+	int score = 100;
+
+	if (quality->leadingZeros < LM_SENTINEL_LEADINGZEROS)
+		score -= LM_SENTINEL_LEADINGZEROS - quality->leadingZeros;
+
+	if (quality->trailingZeros < LM_SENTINEL_LEADINGZEROS)
+		score -= LM_SENTINEL_LEADINGZEROS - quality->trailingZeros;
+
+	if (flags & LM_DECODEFLAG_CORRECTED)
+		score -= LM_QUALITY_CORRECTEDCOST;
+
+	if (!(flags & LM_DECODEFLAG_LRCVALID))
+		score -= LM_QUALITY_NOLRCCOST;
+
+	if (flags & LM_DECODEFLAG_SALVAGED)
+		score -= LM_QUALITY_SALVAGEDCOST + (100 - decoded->confidence);
+
+	if (!quality->plausibleLength)
+		score -= LM_QUALITY_LENGTHCOST;
+
+	// a read that decoded always scores above one that did not
+	quality->score = (score < 1) ? 1 : score;
+}
+
+bool LM_InterpretTrack(LM_DecodedTrack * decoded, const char * track, int bitCount, const LM_TrackFormat * format, int maxSentinelDistance)
+{
+	int attempts;
+	bool valid = LM_DecodeEitherDirection(decoded, track, bitCount, format, maxSentinelDistance, &attempts);
+
+	LM_ScoreRead(decoded, valid, format, attempts);
+
+	return valid;
+}
+
+void LM_PrintField(const char * label, const LM_Span * span)
+{
+	if (span->length > 0)
+		printf("\n    %-15s%.*s", label, span->length, span->data);
+}
+
+void LM_PrintText(const char * label, const char * text)
+{
+	if (text[0])
+		printf("\n    %-15s%s", label, text);
+}
+
+// One track of one swipe on its way from the decoder to the output. The
+// field spans point into decoded, so a swipe must not be copied once parsed.
+struct LM_Swipe
+{
+	const LM_TrackInfo *	trackInfo;
+	int						deviceId;
+	bool					valid;			// false on a read error
+	LM_DecodedTrack			decoded;
+	LM_TrackFields			fields;
+	bool					fieldsParsed;
+	const LM_BinRecord *	bin;
+	LM_SwipeTiming			timing;
+	const LM_SwipeSpeed *	speed;			// from timing packets, or NULL
+	long long				time;			// nanoseconds, when the swipe was read, recorded or live; or -1
+	long long				timestamp;		// nanoseconds since the Unix epoch, when it was read or recorded
+};
+
+// Parses fields and looks up the issuer of a decoded swipe. A check digit
+// already tested by a batch worker is not tested again.
+void LM_AnnotateSwipe(LM_Swipe * swipe, const LM_Options * options)
+{
+	const int printFlags = options->printFlags;
+	const LM_TrackInfo * trackInfo = swipe->trackInfo;
+
+	swipe->fieldsParsed = false;
+	swipe->bin = NULL;
+
+	if (!swipe->valid)
+		return;
+
+	if (	(printFlags & (LM_PRINTFLAG_FIELDS | LM_PRINTFLAG_LUHN) || options->binTable || options->archiveWriter)
+		&&	trackInfo->parseFields)
+	{
+		swipe->fieldsParsed = trackInfo->parseFields(&swipe->fields, swipe->decoded.data, swipe->decoded.length);
+	}
+
+	if (	swipe->fieldsParsed
+		&&	printFlags & LM_PRINTFLAG_LUHN
+		&&	!(swipe->decoded.flags & LM_DECODEFLAG_LUHNCHECKED))
+	{
+		swipe->decoded.flags |= LM_DECODEFLAG_LUHNCHECKED;
+
+		if (LM_CheckLuhn(swipe->fields.pan.data, swipe->fields.pan.length))
+			swipe->decoded.flags |= LM_DECODEFLAG_LUHNVALID;
+	}
+
+	if (swipe->fieldsParsed && options->binTable)
+		swipe->bin = LM_LookupBin(LM_AcquireBinIndex(options->binTable), swipe->fields.pan.data, swipe->fields.pan.length);
+}
+
+void LM_InterpretSwipe(LM_Swipe * swipe, const char * track, int bitCount, const LM_TrackInfo * trackInfo, int deviceId, const LM_Options * options)
+{
+	swipe->trackInfo = trackInfo;
+	swipe->deviceId = deviceId;
+	swipe->valid = LM_InterpretTrack(&swipe->decoded, track, bitCount, trackInfo->format, options->maxSentinelDistance);
+
+	long long traceStart = LM_TraceBegin();
+	LM_AnnotateSwipe(swipe, options);
+	LM_TraceEnd("annotate", traceStart);
+}
+
+// Speed in the field layout, then mm/s for every timed packet of the swipe.
+void LM_PrintSwipeSpeed(const LM_SwipeSpeed * speed)
+{
+	printf("\n    %-15s%.0f mm/s, %.0f to %.0f, %+.2f m/s^2, jitter %.1f%% over %.1f ms",
+		"Speed:", speed->meanSpeed, speed->minSpeed, speed->maxSpeed, speed->acceleration / 1000.0, speed->jitter, speed->duration * 1000.0);
+
+	if (speed->leadTime >= 0)
+		printf(", first edge %.2f ms after card loaded", speed->leadTime * 1000.0);
+
+	printf("\n    %-15s", "Profile:");
+
+	for (int i = 0; i < speed->groupCount; i++)
+	{
+		double groupSpeed = LM_GroupSpeed(speed, i);
+
+		if (groupSpeed >= 0)
+			printf(i ? " %.0f" : "%.0f", groupSpeed);
+		else
+			printf(i ? " -" : "-");
+	}
+}
+
+void LM_PrintReadQuality(const LM_DecodedTrack * decoded)
+{
+	const LM_ReadQuality * quality = &decoded->quality;
+
+	printf("\n    %-15s%d: %d leading and %d trailing zeros, %s, LRC %s, %s, %d attempt%s",
+		"Quality:", quality->score, quality->leadingZeros, quality->trailingZeros,
+		quality->parityErrors ? "parity corrected" : "parity ok",
+		(decoded->flags & LM_DECODEFLAG_LRCVALID) ? "ok" : "missing",
+		quality->plausibleLength ? "length ok" : "implausible length",
+		quality->attempts, (quality->attempts == 1) ? "" : "s");
+}
+
+void LM_PrintSwipe(const LM_Swipe * swipe, const LM_Options * options)
+{
+	const int printFlags = options->printFlags;
+	const LM_DecodedTrack * decoded = &swipe->decoded;
+
+	if (printFlags & LM_PRINTFLAG_LABELS)
+		printf("%s", swipe->trackInfo->label);
+
+	if (!swipe->valid)
+	{
+		fprintf(stderr, "data read error");
+
+		if (swipe->speed)
+			LM_PrintSwipeSpeed(swipe->speed);
+
+		printf("\n");
+		return;
+	}
+
+	printf("%s", decoded->data);
+
+	if (printFlags & LM_PRINTFLAG_LABELS)
+	{
+		if (decoded->flags & LM_DECODEFLAG_CORRECTED)
+			printf(" (corrected)");
+
+		if (decoded->flags & LM_DECODEFLAG_SALVAGED)
+			printf(" (salvaged, %d%% confidence)", decoded->confidence);
+
+		if (decoded->flags & LM_DECODEFLAG_LUHNCHECKED)
+			printf((decoded->flags & LM_DECODEFLAG_LUHNVALID) ? " (check digit ok)" : " (check digit failed)");
+
+		if (decoded->flags & LM_DECODEFLAG_DUPLICATE)
+			printf(" (duplicate)");
+
+		if (options->latency && swipe->timing.start >= 0)
+		{
+			printf(" (read %.1f ms, decode %.1f us)",
+				(swipe->timing.stop - swipe->timing.start) / (double)LM_NANOSECONDS_PER_MILLISECOND,
+				(swipe->timing.decoded - swipe->timing.stop) / 1000.0);
 		}
-		
-		if (currentByte != 0x1F)
-			return false;
 	}
 
-	printf("%s", printableData);
+	if (swipe->fieldsParsed && printFlags & LM_PRINTFLAG_FIELDS)
+	{
+		LM_PrintField("PAN:", &swipe->fields.pan);
+		LM_PrintField("Name:", &swipe->fields.name);
+		LM_PrintField("Expiration:", &swipe->fields.expiration);
+		LM_PrintField("Service code:", &swipe->fields.serviceCode);
+		LM_PrintField("Discretionary:", &swipe->fields.discretionary);
+	}
+
+	if (swipe->bin)
+	{
+		LM_PrintText("Issuer:", swipe->bin->issuer);
+		LM_PrintText("Network:", swipe->bin->network);
+		LM_PrintText("Card type:", swipe->bin->cardType);
+	}
 
-	return true;
+	if (printFlags & LM_PRINTFLAG_QUALITY)
+		LM_PrintReadQuality(&swipe->decoded);
+
+	if (swipe->speed)
+		LM_PrintSwipeSpeed(swipe->speed);
+
+	printf("\n");
 }
 
 void LM_PrintBinary(const char * track, int bitCount)
@@ -213,99 +772,1848 @@ void LM_PrintBinary(const char * track, int bitCount)
 	}
 }
 
-void LM_ReverseTrackData(char * trackReversed, const char * track, int bitCount)
+// Formats one timestamped swipe as a line, as printed from a log or archive
+// and sent to subscribers. Returns the length of the line.
+int LM_FormatStoredSwipe(char * line, long long timestamp, unsigned int deviceId, int track, bool valid, int flags, int confidence, const char * data, int length)
 {
-	memset(trackReversed, 0, LM_TRACKBUFFER_SIZE);
+	time_t seconds = (time_t)(timestamp / LM_NANOSECONDS_PER_SECOND);
+	char timeText[32];
+	strftime(timeText, sizeof(timeText), "%Y-%m-%d %H:%M:%S", gmtime(&seconds));
 
-	for (int i = 0; i < bitCount; i++)
+	char * end = line;
+
+	end += sprintf(end, "%s.%03d device %u %s", timeText, (int)((timestamp % LM_NANOSECONDS_PER_SECOND) / LM_NANOSECONDS_PER_MILLISECOND), deviceId,
+		(track < LM_TRACK_COUNT) ? LM_TRACKINFO[track].label : "Track ?: ");
+
+	if (valid)
 	{
-		if (track[i / 8] & (0x01 << (7 - (i % 8))))
-			trackReversed[((bitCount - 1) - i) / 8] |= (0x01 << (7 - (((bitCount - 1) - i) % 8)));
+		if (length > LM_DECODEDTRACK_SIZE)
+			length = LM_DECODEDTRACK_SIZE;
+
+		memcpy(end, data, length);
+		end += length;
 	}
-}
+	else
+		end += sprintf(end, "data read error");
 
-void LM_MainLoop(FILE * inputStream, LM_PrintMode printMode, int printFlags)
-{
-	char track2[LM_TRACKBUFFER_SIZE];
-	char track1[LM_TRACKBUFFER_SIZE];
+	if (flags & LM_DECODEFLAG_CORRECTED)
+		end += sprintf(end, " (corrected)");
 
-	int track2BitCount = 0;
-	int track1BitCount = 0;
+	if (flags & LM_DECODEFLAG_SALVAGED)
+		end += sprintf(end, " (salvaged, %d%% confidence)", confidence);
 
-	memset(track2, 0, LM_TRACKBUFFER_SIZE);
-	memset(track1, 0, LM_TRACKBUFFER_SIZE);
+	if (flags & LM_DECODEFLAG_DUPLICATE)
+		end += sprintf(end, " (duplicate)");
 
-	int track2PacketSize = -1;
-	int track1PacketSize = -1;
+	end += sprintf(end, "\n");
 
-	while (1)
-	{
-		int inputByte = fgetc(inputStream);
+	return (int)(end - line);
+}
+
+void LM_PrintStoredSwipe(FILE * file, long long timestamp, unsigned int deviceId, int track, bool valid, int flags, int confidence, const char * data, int length)
+{
+	static char line[LM_SWIPELINE_SIZE];
+
+	fwrite(line, 1, LM_FormatStoredSwipe(line, timestamp, deviceId, track, valid, flags, confidence, data, length), file);
+}
+
+void LM_CountSwipe(LM_MetricsSlot * slot, const LM_Swipe * swipe, int track)
+{
+	if (!slot)
+		return;
+
+	const int flags = swipe->decoded.flags;
+
+	LM_CountMetric(&slot->swipes[track], 1);
+	LM_CountMetric(&slot->qualityPoints[track], swipe->decoded.quality.score);
+
+	if (!swipe->valid)
+	{
+		LM_CountMetric(&slot->readErrors[track], 1);
+		return;
+	}
+
+	if (flags & LM_DECODEFLAG_REVERSED)
+		LM_CountMetric(&slot->reversed[track], 1);
+
+	if (flags & LM_DECODEFLAG_CORRECTED)
+		LM_CountMetric(&slot->corrected[track], 1);
+
+	if (flags & LM_DECODEFLAG_SALVAGED)
+		LM_CountMetric(&slot->salvaged[track], 1);
+
+	if ((flags & (LM_DECODEFLAG_LUHNCHECKED | LM_DECODEFLAG_LUHNVALID)) == LM_DECODEFLAG_LUHNCHECKED)
+		LM_CountMetric(&slot->luhnFailures, 1);
+}
+
+// Drops or tags repeats, logs, archives and prints one interpreted swipe.
+// The shared memory ring and socket subscribers get exactly the swipes that
+// are printed.
+void LM_OutputSwipe(LM_Swipe * swipe, int track, const LM_Options * options)
+{
+	LM_MetricsSlot * metrics = options->metrics ? LM_MetricsThreadSlot(options->metrics) : NULL;
+
+	LM_CountSwipe(metrics, swipe, track);
+
+	if (	swipe->valid
+		&&	options->dedupeCache
+		&&	swipe->time >= 0
+		&&	LM_CheckDuplicate(options->dedupeCache, swipe->deviceId, track, swipe->decoded.data, swipe->decoded.length, swipe->time))
+	{
+		swipe->decoded.flags |= LM_DECODEFLAG_DUPLICATE;
+
+		if (metrics)
+			LM_CountMetric(&metrics->duplicates, 1);
+	}
+
+	long long traceStart;
+
+	if (options->logWriter)
+	{
+		traceStart = LM_TraceBegin();
+		LM_LogSwipe(options->logWriter, swipe->timestamp, track, swipe->valid, swipe->decoded.flags, swipe->decoded.confidence, swipe->decoded.data, swipe->decoded.length);
+		LM_TraceEnd("log", traceStart);
+	}
+
+	if (options->archiveWriter)
+	{
+		traceStart = LM_TraceBegin();
+		LM_ArchiveSwipe(options->archiveWriter, swipe->timestamp, swipe->deviceId, track, swipe->valid, swipe->decoded.flags, swipe->decoded.confidence,
+			swipe->decoded.data, swipe->decoded.length, swipe->fieldsParsed ? swipe->fields.pan.data : NULL, swipe->fields.pan.length);
+		LM_TraceEnd("archive", traceStart);
+	}
+
+	if (!(swipe->decoded.flags & LM_DECODEFLAG_DUPLICATE) || options->printFlags & LM_PRINTFLAG_DUPLICATES)
+	{
+		long long timestamp = swipe->timestamp;
+
+		if (options->ring)
+		{
+			traceStart = LM_TraceBegin();
+			LM_PublishSwipe(options->ring, timestamp, swipe->deviceId, track, swipe->valid, swipe->decoded.flags, swipe->decoded.confidence, swipe->decoded.data, swipe->decoded.length);
+			LM_TraceEnd("publish to ring", traceStart);
+		}
+
+		if (options->server)
+		{
+			traceStart = LM_TraceBegin();
+
+			static char line[LM_SWIPELINE_SIZE];
+			int length = LM_FormatStoredSwipe(line, timestamp, swipe->deviceId, track, swipe->valid, swipe->decoded.flags, swipe->decoded.confidence, swipe->decoded.data, swipe->decoded.length);
+
+			LM_PublishToSubscribers(options->server, line, length);
+			LM_TraceEnd("publish to subscribers", traceStart);
+		}
+
+		traceStart = LM_TraceBegin();
+
+		if (options->output)
+		{
+			LM_OutputRecord record;
+
+			record.timestamp = timestamp;
+			record.decodeTime = (swipe->timing.stop >= 0 && swipe->timing.decoded >= 0) ? swipe->timing.decoded - swipe->timing.stop : -1;
+			record.deviceId = swipe->deviceId;
+			record.track = track;
+			record.valid = swipe->valid;
+			record.flags = swipe->decoded.flags;
+			record.confidence = swipe->decoded.confidence;
+			record.data = swipe->decoded.data;
+			record.length = swipe->decoded.length;
+			record.timing = options->latency ? &swipe->timing : NULL;
+			record.speed = swipe->speed;
+			record.quality = &swipe->decoded.quality;
+
+			LM_WriteOutputRecord(options->output, &record);
+		}
+		else
+		{
+			LM_PrintSwipe(swipe, options);
+
+			// text goes through stdio, so it is only out once flushed
+			if (options->latency)
+				fflush(stdout);
+		}
+
+		LM_TraceEnd("print", traceStart);
+
+		if (options->latency)
+		{
+			swipe->timing.flushed = LM_MonotonicTime();
+			LM_RecordSwipeTiming(options->latency, &swipe->timing);
+		}
+	}
+}
+
+// Maps every packet byte to the track it belongs to, so telling the tracks
+// apart costs one lookup per byte however many tracks the protocol carries.
+unsigned char LM_packetTracks[256];
+
+void LM_InitializePacketTracks()
+{
+	for (int inputByte = 0; inputByte < 256; inputByte++)
+	{
+		if (inputByte & LM_PACKET_FLAG_TRACK2)
+			LM_packetTracks[inputByte] = LM_TRACK_2;
+		else if (inputByte & ((inputByte & LM_PACKET_FLAG_STARTSTOPCONTROL) ? LM_PACKET_FLAG_CONTROLTRACK3 : LM_PACKET_FLAG_TRACK3))
+			LM_packetTracks[inputByte] = LM_TRACK_3;
+		else
+			LM_packetTracks[inputByte] = LM_TRACK_1;
+	}
+}
+
+// Timing gathered while replaying a capture.
+struct LM_ReplayStats
+{
+	long long	byteCount;
+	long long	swipeCount;
+	long long *	latencies;		// STOP byte to swipe output, nanoseconds
+	long long	latencyCapacity;
+};
+
+struct LM_BatchChunk;
+
+struct LM_ReaderState
+{
+	LM_TrackBuffer		tracks[LM_TRACK_COUNT];
+	int					deviceId;
+	LM_ReplayStats *	replayStats;
+	LM_BatchChunk *		batchChunk;		// set on batch workers, which store tracks instead of printing
+	int					timingTrack;	// track of the last data packet, which timing packets follow
+	long long			streamTime;		// recorded time of the byte being replayed, since the Unix epoch, or -1 for live input
+	LM_ReplyParser		reply;			// replies to reader commands, see LM_Commands.h
+};
+
+void LM_StoreBatchTrack(LM_BatchChunk * chunk, int track, const char * data, int bitCount, long long time, const LM_Options * options);
+
+void LM_InitializeReaderState(LM_ReaderState * state, const LM_Options * options)
+{
+	for (int i = 0; i < LM_TRACK_COUNT; i++)
+	{
+		memset(state->tracks[i].data, 0, LM_TRACKBUFFER_SIZE);
+		state->tracks[i].bitCount = 0;
+		state->tracks[i].packetSize = -1;
+		state->tracks[i].startTime = -1;
+		state->tracks[i].lastDataTime = -1;
+		state->tracks[i].lastPacketBits = 0;
+		state->tracks[i].timingHigh = -1;
+		state->tracks[i].leadPending = false;
+		state->tracks[i].leadMicros = LM_SPEED_UNTIMED;
+		state->tracks[i].timingGroupCount = 0;
+	}
+
+	state->deviceId = options->deviceId;
+	state->replayStats = NULL;
+	state->batchChunk = NULL;
+	state->timingTrack = -1;
+	state->streamTime = -1;
+	LM_InitializeReplyParser(&state->reply);
+}
+
+void LM_RecordReplayLatency(LM_ReplayStats * stats, long long latency)
+{
+	if (stats->swipeCount == stats->latencyCapacity)
+	{
+		long long capacity = stats->latencyCapacity ? stats->latencyCapacity * 2 : 4096;
+		long long * grown = (long long *)realloc(stats->latencies, (size_t)capacity * sizeof(long long));
+
+		if (!grown)
+			return;
+
+		stats->latencies = grown;
+		stats->latencyCapacity = capacity;
+	}
+
+	stats->latencies[stats->swipeCount++] = latency;
+}
+
+// Two timing packets follow each data packet from timing capture firmware
+// and time it, see LM_PacketFlags.h. The firmware queues all three at once,
+// so they arrive together even with both tracks being read.
+void LM_ProcessTimingByte(LM_ReaderState * state, int inputByte)
+{
+	if (state->timingTrack < 0)
+		return;
+
+	LM_TrackBuffer * buffer = &state->tracks[state->timingTrack];
+
+	if (buffer->timingHigh < 0)
+	{
+		buffer->timingHigh = inputByte & LM_PACKET_TIMING_BITS;
+		return;
+	}
+
+	int code = (buffer->timingHigh << 5) | (inputByte & LM_PACKET_TIMING_BITS);
+	buffer->timingHigh = -1;
+
+	// the first packet's card loaded time comes ahead of its own, in 16 us units
+	if (buffer->leadPending)
+	{
+		int lead = LM_DecodeTimingCode(code);
+
+		buffer->leadMicros = (lead == LM_SPEED_UNTIMED) ? LM_SPEED_UNTIMED : lead * 16;
+		buffer->leadPending = false;
+		return;
+	}
+
+	state->timingTrack = -1;
+
+	if (buffer->timingGroupCount == LM_SPEED_MAXGROUPS)
+		return;
+
+	LM_TimingGroup * group = &buffer->timingGroups[buffer->timingGroupCount];
+
+	// timing starts at the first edge, so the first packet has an interval fewer
+	group->micros = LM_DecodeTimingCode(code);
+	group->intervals = buffer->timingGroupCount ? buffer->lastPacketBits : buffer->lastPacketBits - 1;
+
+	if (group->intervals < 0)
+		group->intervals = 0;
+
+	buffer->timingGroupCount++;
+}
+
+// Trace span names for each track arriving, indexed by LM_Track.
+const char * LM_TRACEREAD[LM_TRACK_COUNT] = { "read track 1", "read track 2", "read track 3" };
+
+void LM_ProcessByte(LM_ReaderState * state, int inputByte, const LM_Options * options)
+{
+	const int printFlags = options->printFlags;
+	LM_MetricsSlot * metrics = options->metrics ? LM_MetricsThreadSlot(options->metrics) : NULL;
+
+	if (metrics)
+		LM_CountMetric(&metrics->bytes, 1);
+
+	if (options->logWriter && !state->batchChunk)
+		LM_LogRawByte(options->logWriter, (unsigned char)inputByte, (state->streamTime >= 0) ? state->streamTime : LM_MonotonicTime(), state->streamTime);
+
+	bool replyComplete;
+
+	if (LM_ParseReplyByte(&state->reply, inputByte, &replyComplete))
+	{
+		if (replyComplete && !state->batchChunk)
+			LM_HandleCommandReply(stderr, &state->reply, options->commandPort);
+		return;
+	}
+
+	if ((inputByte & LM_PACKET_TIMING_MASK) == LM_PACKET_FLAG_TIMING)
+	{
+		LM_ProcessTimingByte(state, inputByte);
+		return;
+	}
+
+	const LM_TrackInfo * trackInfo = &LM_TRACKINFO[LM_packetTracks[inputByte]];
+
+	char * track = state->tracks[LM_packetTracks[inputByte]].data;
+	int &bitCount = state->tracks[LM_packetTracks[inputByte]].bitCount;
+	int &packetSize = state->tracks[LM_packetTracks[inputByte]].packetSize;
+	long long &startTime = state->tracks[LM_packetTracks[inputByte]].startTime;
+	long long &lastDataTime = state->tracks[LM_packetTracks[inputByte]].lastDataTime;
+	LM_TrackBuffer * buffer = &state->tracks[LM_packetTracks[inputByte]];
+
+	if (inputByte & LM_PACKET_FLAG_STARTSTOPCONTROL)
+	{
+		if (inputByte & LM_PACKET_FLAG_START)
+		{
+			memset(track, 0, LM_TRACKBUFFER_SIZE);
+			bitCount = 0;
+			packetSize = -1;
+			startTime = ((options->latency || LM_TraceOn()) && !state->batchChunk) ? LM_MonotonicTime() : -1;
+			lastDataTime = -1;
+			buffer->timingHigh = -1;
+			buffer->leadPending = true;
+			buffer->leadMicros = LM_SPEED_UNTIMED;
+			buffer->timingGroupCount = 0;
+		}
+		else if (state->batchChunk)
+		{
+			if (printFlags & trackInfo->printFlag)
+				LM_StoreBatchTrack(state->batchChunk, LM_packetTracks[inputByte], track, bitCount, state->streamTime, options);
+		}
+		else
+		{
+			long long stopTime = (state->replayStats || options->output || options->latency || options->dedupeCache || metrics || LM_TraceOn()) ? LM_MonotonicTime() : -1;
+
+			// the START byte to here is the track arriving over the serial line
+			if (LM_TraceOn() && startTime >= 0)
+				LM_TraceRecord(LM_TRACEREAD[LM_packetTracks[inputByte]], startTime, stopTime);
+
+			if (options->logWriter)
+				LM_FlushLogRaw(options->logWriter);
+
+			// a table the reloader thread has loaded goes in between swipes; the
+			// live decoder is the only thread looking up, so the old index can
+			// go right away
+			if (options->binTable && !state->batchChunk)
+				LM_FreeBinIndex(LM_RefreshBinTable(options->binTable));
+
+			if (printFlags & trackInfo->printFlag)
+			{
+				if (options->printMode == LM_PRINTMODE_INTERPRET)
+				{
+					long long traceStart = LM_TraceBegin();
+
+					LM_Swipe swipe;
+					LM_InterpretSwipe(&swipe, track, bitCount, trackInfo, state->deviceId, options);
+					swipe.timing.start = startTime;
+					swipe.timing.lastData = lastDataTime;
+					swipe.timing.stop = stopTime;
+					swipe.timing.decoded = (options->latency || options->output || metrics) ? LM_MonotonicTime() : -1;
+					swipe.timing.flushed = -1;
+
+					// repeats are judged on the timeline the bytes were read on,
+					// which a fast replay compresses, and every sink stamps the
+					// swipe with when it was read rather than when it was replayed
+					swipe.time = (state->streamTime >= 0) ? state->streamTime : stopTime;
+					swipe.timestamp = (state->streamTime >= 0) ? state->streamTime : LM_WallClockTime();
+
+					LM_SwipeSpeed speed;
+					swipe.speed = NULL;
+
+					if (	printFlags & LM_PRINTFLAG_TIMING
+						&&	LM_AnalyzeSwipeSpeed(&speed, buffer->timingGroups, buffer->timingGroupCount, trackInfo->bitsPerInch, buffer->leadMicros))
+					{
+						swipe.speed = &speed;
+					}
+
+					if (options->wakeLatency && buffer->leadMicros != LM_SPEED_UNTIMED)
+						LM_RecordWakeLatency(options->wakeLatency, buffer->leadMicros / 1000000.0);
+
+					if (metrics)
+						LM_CountDecodeTime(metrics, swipe.timing.decoded - stopTime);
+
+					LM_OutputSwipe(&swipe, LM_packetTracks[inputByte], options);
+					LM_TraceEnd("swipe", traceStart);
+				}
+				else if (options->printMode == LM_PRINTMODE_BINARY)
+				{
+					if (printFlags & LM_PRINTFLAG_LABELS)
+						printf("%s", trackInfo->label);
+
+					LM_PrintBinary(track, bitCount);
+					printf("\n");
+				}
+
+				if (state->replayStats)
+					LM_RecordReplayLatency(state->replayStats, LM_MonotonicTime() - stopTime);
+			}
+		}
+	}
+	else
+	{
+		if (packetSize == -1)
+			packetSize = inputByte & 0x0F;
+		else
+		{
+			if (bitCount + packetSize > LM_TRACKBUFFER_SIZE * 8)
+			{
+				fprintf(stderr, "Track buffer overflow on %s.", trackInfo->name);
+
+				if (metrics)
+					LM_CountMetric(&metrics->overflows[LM_packetTracks[inputByte]], 1);
+			}
+			else
+			{
+				for (int i = 0; i < packetSize; i++)
+				{
+					if ((0x01 << (4 - i)) & inputByte)
+						track[bitCount / 8] |= 0x1 << (7 - (bitCount % 8));
+
+					bitCount++;
+				}
+			}
+			buffer->lastPacketBits = packetSize;
+			packetSize = -1;
+			state->timingTrack = LM_packetTracks[inputByte];
+
+			if (options->latency && !state->batchChunk)
+				lastDataTime = LM_MonotonicTime();
+		}
+	}
+}
+
+// Set by SIGINT or SIGTERM, or a console close on Windows, to end a session
+// through the same close path as the end of its input, so the open archive
+// block, the trace and the latency histograms are written out.
+volatile sig_atomic_t LM_stopRequested = 0;
+
+#ifdef WIN32
+
+HANDLE LM_stopHandle = INVALID_HANDLE_VALUE;		// the COM port, whose read is cancelled on a stop
+
+BOOL WINAPI LM_ConsoleStopHandler(DWORD event)
+{
+	LM_stopRequested = 1;
+
+	if (LM_stopHandle != INVALID_HANDLE_VALUE)
+		::CancelIoEx(LM_stopHandle, NULL);
+
+	// the process ends as soon as a close or shutdown handler returns
+	if (event == CTRL_CLOSE_EVENT || event == CTRL_LOGOFF_EVENT || event == CTRL_SHUTDOWN_EVENT)
+		::Sleep(INFINITE);
+
+	return TRUE;
+}
+
+void LM_CatchStopSignals()
+{
+	::SetConsoleCtrlHandler(LM_ConsoleStopHandler, TRUE);
+}
+
+void LM_AcceptStopSignals()
+{
+}
+
+#else
+
+void LM_StopSignalHandler(int)
+{
+	LM_stopRequested = 1;
+}
+
+// Called before any thread is started, so every thread but main leaves the
+// signals blocked. Without SA_RESTART, the read main is blocked in when one
+// comes then fails with EINTR and the loop ends.
+void LM_CatchStopSignals()
+{
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = LM_StopSignalHandler;
+	sigemptyset(&action.sa_mask);
+
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+}
+
+// Once the threads are started, lets main take the signals.
+void LM_AcceptStopSignals()
+{
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+}
+
+#endif
+
+// Sends the queued reader commands one at a time, each once the reply to
+// the one before has been read. Packets arriving meanwhile go through the
+// parser as usual, so a swipe read during the commands is not lost. Returns
+// false if a command could not be sent or went unanswered.
+bool LM_RunReaderCommands(LM_CommandPort * port, LM_ReaderState * state, const LM_Options * options)
+{
+	while (port->sentCount < port->queuedCount)
+	{
+		int command = port->queued[port->sentCount][0];
+
+		if (!LM_SendNextCommand(port))
+		{
+			fprintf(stderr, "Could not send commands to the reader.\n");
+			return false;
+		}
+
+		long long deadline = LM_MonotonicTime() + LM_COMMAND_REPLYTIMEOUT * LM_NANOSECONDS_PER_MILLISECOND;
+
+		while (port->awaitingReply)
+		{
+			long long remaining = deadline - LM_MonotonicTime();
+			int inputByte = (remaining > 0) ? LM_ReadPortByte(port, (int)(remaining / LM_NANOSECONDS_PER_MILLISECOND)) : -1;
+
+			if (inputByte < 0)
+			{
+				fprintf(stderr, "Reader did not answer command 0x%02X within %d ms; is its firmware built with LM_COMMANDCHANNEL?\n", command, LM_COMMAND_REPLYTIMEOUT);
+				port->awaitingReply = false;
+				return false;
+			}
+
+			LM_ProcessByte(state, inputByte, options);
+		}
+	}
+
+	return true;
+}
+
+void LM_MainLoop(FILE * inputStream, LM_ReaderState * state, const LM_Options * options)
+{
+	int inputByte;
+
+	while (!LM_stopRequested && (inputByte = fgetc(inputStream)) != EOF)
+		LM_ProcessByte(state, inputByte, options);
+}
+
+int LM_CompareLatencies(const void * a, const void * b)
+{
+	long long latencyA = *(const long long *)a;
+	long long latencyB = *(const long long *)b;
+
+	return (latencyA < latencyB) ? -1 : (latencyA > latencyB) ? 1 : 0;
+}
+
+void LM_PrintReplayStats(LM_ReplayStats * stats, long long elapsed)
+{
+	double seconds = (double)elapsed / LM_NANOSECONDS_PER_SECOND;
+
+	fprintf(stderr, "\nReplayed %lld swipes (%lld bytes) in %.3f s: %.0f swipes/s, %.0f bytes/s\n",
+		stats->swipeCount, stats->byteCount, seconds,
+		seconds > 0 ? stats->swipeCount / seconds : 0.0,
+		seconds > 0 ? stats->byteCount / seconds : 0.0);
+
+	if (!stats->swipeCount)
+		return;
+
+	qsort(stats->latencies, (size_t)stats->swipeCount, sizeof(long long), LM_CompareLatencies);
+
+	long long total = 0;
+	for (long long i = 0; i < stats->swipeCount; i++)
+		total += stats->latencies[i];
+
+	fprintf(stderr, "Swipe latency (STOP byte to output): min %.1f us, mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+		stats->latencies[0] / 1000.0,
+		(double)total / stats->swipeCount / 1000.0,
+		stats->latencies[stats->swipeCount / 2] / 1000.0,
+		stats->latencies[(stats->swipeCount * 99) / 100] / 1000.0,
+		stats->latencies[stats->swipeCount - 1] / 1000.0);
+}
+
+// Wall clock time a plain capture or head recording began, which neither
+// carries: taken as the file's modification time less its length.
+long long LM_RecordingStartTime(const char * path, long long duration)
+{
+	struct stat fileStatus;
+
+	if (stat(path, &fileStatus) != 0)
+		return LM_WallClockTime() - duration;
+
+	return (long long)fileStatus.st_mtime * LM_NANOSECONDS_PER_SECOND - duration;
+}
+
+// Replays a swipe log, or a plain capture of packet bytes, through the same
+// parser as live input. A speed of 1 keeps the recorded timing, N plays N
+// times faster and 0 feeds bytes as fast as they can be decoded. Plain
+// captures carry no timing and are paced at the serial line rate instead.
+bool LM_Replay(const char * path, double speed, const LM_Options * options)
+{
+	static LM_ReaderState state;
+	LM_InitializeReaderState(&state, options);
+
+	LM_ReplayStats stats;
+	memset(&stats, 0, sizeof(stats));
+	state.replayStats = &stats;
+
+	if (options->output)
+		options->output->timed = true;
+
+	long long started = LM_MonotonicTime();
+
+	LM_LogReader reader;
+
+	if (LM_OpenLogReader(&reader, path))
+	{
+		long long firstTimestamp = -1;
+
+		for (const LM_LogRecordHeader * record = LM_NextLogRecord(&reader, NULL); record; record = LM_NextLogRecord(&reader, record))
+		{
+			if (record->type != LM_LOGRECORD_RAW)
+				continue;
+
+			const LM_LogRawRecord * raw = (const LM_LogRawRecord *)record;
+			const uint32_t * offsets = LM_LogRawOffsets(raw);
+			const unsigned char * bytes = LM_LogRawBytes(raw);
+
+			if (firstTimestamp == -1)
+				firstTimestamp = record->timestamp;
+
+			state.deviceId = record->deviceId;
+
+			for (uint32_t i = 0; i < raw->byteCount && !LM_stopRequested; i++)
+			{
+				if (speed > 0)
+					LM_SleepUntil(started + (long long)((record->timestamp - firstTimestamp + offsets[i] * 1000LL) / speed));
+
+				state.streamTime = record->timestamp + offsets[i] * 1000LL;
+				LM_ProcessByte(&state, bytes[i], options);
+			}
+
+			stats.byteCount += raw->byteCount;
+		}
+
+		LM_CloseLogReader(&reader);
+	}
+	else
+	{
+		FILE * capture = fopen(path, "rb");
+
+		if (!capture)
+			return false;
+
+		fseek(capture, 0, SEEK_END);
+		long long recordingStart = LM_RecordingStartTime(path, ftell(capture) * LM_SERIAL_BYTE_TIME);
+		fseek(capture, 0, SEEK_SET);
+
+		int inputByte;
+
+		while (!LM_stopRequested && (inputByte = fgetc(capture)) != EOF)
+		{
+			if (speed > 0)
+				LM_SleepUntil(started + (long long)(stats.byteCount * LM_SERIAL_BYTE_TIME / speed));
+
+			state.streamTime = recordingStart + stats.byteCount * LM_SERIAL_BYTE_TIME;
+			LM_ProcessByte(&state, inputByte, options);
+			stats.byteCount++;
+		}
+
+		fclose(capture);
+	}
+
+	if (options->output)
+		LM_FlushOutputWriter(options->output);
+
+	fflush(stdout);
+
+	LM_PrintReplayStats(&stats, LM_MonotonicTime() - started);
+
+	if (options->output && options->output->recordCount)
+	{
+		double encodeSeconds = (double)options->output->encodeTime / LM_NANOSECONDS_PER_SECOND;
+
+		fprintf(stderr, "Encoded %lld records in %.3f s: %.0f records/s\n",
+			options->output->recordCount, encodeSeconds,
+			encodeSeconds > 0 ? options->output->recordCount / encodeSeconds : 0.0);
+	}
+
+	free(stats.latencies);
+
+	return true;
+}
+
+// Outputs one swipe found in a head recording. The recording carries no
+// track number, so each enabled track format is tried in turn, without
+// salvage first so a clean read is never taken for a salvaged one.
+struct LM_WavDecode
+{
+	const LM_Options *	options;
+	long long			recordingStart;		// see LM_RecordingStartTime
+};
+
+void LM_OutputF2FSwipe(const char * bits, int bitCount, double startSeconds, void * context)
+{
+	const LM_Options * options = ((const LM_WavDecode *)context)->options;
+
+	static char track[LM_TRACKBUFFER_SIZE];
+	memset(track, 0, sizeof(track));
+	memcpy(track, bits, (bitCount + 7) / 8);
+
+	int firstTrack = -1;
+
+	for (int candidate = 0; candidate < LM_TRACK_COUNT; candidate++)
+	{
+		if (options->printFlags & LM_TRACKINFO[candidate].printFlag)
+		{
+			firstTrack = candidate;
+			break;
+		}
+	}
+
+	if (firstTrack < 0)
+		return;
+
+	if (options->printMode == LM_PRINTMODE_BINARY)
+	{
+		if (options->printFlags & LM_PRINTFLAG_LABELS)
+			printf("%.3f s: ", startSeconds);
+
+		LM_PrintBinary(track, bitCount);
+		printf("\n");
+		return;
+	}
+
+	LM_Swipe swipe;
+	int swipeTrack = firstTrack;
+
+	swipe.valid = false;
+
+	for (int pass = 0; pass < 2 && !swipe.valid; pass++)
+	{
+		int maxSentinelDistance = pass ? options->maxSentinelDistance : 0;
+
+		if (pass && maxSentinelDistance <= 0)
+			break;
+
+		for (int candidate = 0; candidate < LM_TRACK_COUNT && !swipe.valid; candidate++)
+		{
+			if (!(options->printFlags & LM_TRACKINFO[candidate].printFlag))
+				continue;
+
+			if (LM_InterpretTrack(&swipe.decoded, track, bitCount, LM_TRACKINFO[candidate].format, maxSentinelDistance))
+			{
+				swipe.valid = true;
+				swipeTrack = candidate;
+			}
+		}
+	}
+
+	swipe.trackInfo = &LM_TRACKINFO[swipeTrack];
+	swipe.deviceId = options->deviceId;
+	swipe.timing.start = swipe.timing.lastData = swipe.timing.stop = -1;
+	swipe.timing.decoded = swipe.timing.flushed = -1;
+	swipe.speed = NULL;
+	swipe.time = (long long)(startSeconds * LM_NANOSECONDS_PER_SECOND);
+	swipe.timestamp = ((const LM_WavDecode *)context)->recordingStart + swipe.time;
+
+	LM_AnnotateSwipe(&swipe, options);
+	LM_OutputSwipe(&swipe, swipeTrack, options);
+}
+
+// Decodes a WAV recording of a read head's signal, see LM_F2FDecoder.h.
+bool LM_DecodeWav(const char * path, const LM_Options * options)
+{
+	LM_PcmSamples pcm;
+
+	if (!LM_ReadWavFile(path, &pcm))
+		return false;
+
+	long long started = LM_MonotonicTime();
+
+	LM_WavDecode decode;
+	decode.options = options;
+	decode.recordingStart = LM_RecordingStartTime(path, (long long)pcm.count * LM_NANOSECONDS_PER_SECOND / pcm.sampleRate);
+
+	LM_F2FStats stats;
+	LM_DecodeF2F(&pcm, LM_OutputF2FSwipe, &decode, &stats);
+
+	if (options->output)
+		LM_FlushOutputWriter(options->output);
+
+	fflush(stdout);
+
+	double seconds = (double)(LM_MonotonicTime() - started) / LM_NANOSECONDS_PER_SECOND;
+	double recorded = (double)pcm.count / pcm.sampleRate;
+
+	fprintf(stderr, "\nDecoded %lld swipes (%lld flux transitions) from %.1f s of audio at %u Hz in %.3f s, %.0f times real time\n",
+		stats.swipeCount, stats.transitionCount, recorded, pcm.sampleRate, seconds, seconds > 0 ? recorded / seconds : 0.0);
+
+	LM_FreePcmSamples(&pcm);
+
+	return true;
+}
+
+// One decoded track held by a batch chunk until it is merged.
+struct LM_BatchResult
+{
+	int		track;
+	bool	valid;
+	int		flags;
+	int		confidence;
+	int		length;			// characters, or bits in binary mode
+	size_t	dataOffset;		// into the chunk's text buffer
+	LM_ReadQuality	quality;
+	long long	time;		// recorded time of the STOP byte, see LM_BatchFile
+};
+
+// A capture file read whole; freed once its last chunk is merged.
+struct LM_BatchFile
+{
+	unsigned char *	bytes;
+	size_t			size;
+	long long		timeBase;		// recorded time of the first byte, after the files before
+	int				chunksPending;
+	bool			split;			// all chunks have been submitted
+};
+
+// A run of swipes decoded on its own. Chunks start at a START byte with no
+// track mid swipe, so decoding one needs no state from the chunk before.
+struct LM_BatchChunk
+{
+	LM_WorkItem			work;
+	LM_BatchFile *		file;
+	size_t				start;
+	size_t				end;
+	const LM_Options *	options;
+	LM_BatchResult *	results;
+	int					resultCount;
+	int					resultCapacity;
+	char *				text;
+	size_t				textSize;
+	size_t				textCapacity;
+};
+
+struct LM_BatchStats
+{
+	int			fileCount;
+	long long	byteCount;
+	long long	swipeCount;
+	long long	chunkCount;
+};
+
+static bool LM_GrowBatchChunk(LM_BatchChunk * chunk, size_t textNeeded)
+{
+	if (chunk->resultCount == chunk->resultCapacity)
+	{
+		int capacity = chunk->resultCapacity ? chunk->resultCapacity * 2 : 256;
+		LM_BatchResult * results = (LM_BatchResult *)realloc(chunk->results, capacity * sizeof(LM_BatchResult));
+
+		if (!results)
+			return false;
+
+		chunk->results = results;
+		chunk->resultCapacity = capacity;
+	}
+
+	if (chunk->textSize + textNeeded > chunk->textCapacity)
+	{
+		size_t capacity = chunk->textCapacity ? chunk->textCapacity * 2 : 16384;
+
+		while (capacity < chunk->textSize + textNeeded)
+			capacity *= 2;
+
+		char * text = (char *)realloc(chunk->text, capacity);
+
+		if (!text)
+			return false;
+
+		chunk->text = text;
+		chunk->textCapacity = capacity;
+	}
+
+	return true;
+}
+
+void LM_StoreBatchTrack(LM_BatchChunk * chunk, int track, const char * data, int bitCount, long long time, const LM_Options * options)
+{
+	const bool binary = options->printMode == LM_PRINTMODE_BINARY;
+	LM_DecodedTrack decoded;
+	bool valid = true;
+	int length;
+
+	if (binary)
+		length = bitCount;
+	else
+	{
+		LM_MetricsSlot * metrics = options->metrics ? LM_MetricsThreadSlot(options->metrics) : NULL;
+		long long started = metrics ? LM_MonotonicTime() : 0;
+
+		valid = LM_InterpretTrack(&decoded, data, bitCount, LM_TRACKINFO[track].format, options->maxSentinelDistance);
+		length = valid ? decoded.length : 0;
+
+		if (metrics)
+			LM_CountDecodeTime(metrics, LM_MonotonicTime() - started);
+	}
+
+	size_t textLength = binary ? (bitCount + 7) / 8 : length;
+
+	if (!LM_GrowBatchChunk(chunk, textLength))
+		return;
+
+	LM_BatchResult * result = &chunk->results[chunk->resultCount++];
+
+	result->track = track;
+	result->valid = valid;
+	result->flags = valid && !binary ? decoded.flags : 0;
+	result->confidence = valid && !binary ? decoded.confidence : 0;
+	result->length = length;
+	result->dataOffset = chunk->textSize;
+	result->time = time;
+
+	if (binary)
+		memset(&result->quality, 0, sizeof(result->quality));
+	else
+		result->quality = decoded.quality;
+
+	memcpy(chunk->text + chunk->textSize, binary ? data : decoded.data, textLength);
+	chunk->textSize += textLength;
+}
+
+// Check digits are tested once a chunk is decoded, all PANs of the chunk in
+// one batch so the vector check runs full.
+static void LM_CheckBatchLuhn(LM_BatchChunk * chunk)
+{
+	LM_Span * pans = (LM_Span *)malloc(chunk->resultCount * sizeof(LM_Span));
+	int * owners = (int *)malloc(chunk->resultCount * sizeof(int));
+	bool * results = (bool *)malloc(chunk->resultCount * sizeof(bool));
+	int count = 0;
+
+	if (pans && owners && results)
+	{
+		for (int i = 0; i < chunk->resultCount; i++)
+		{
+			LM_BatchResult * result = &chunk->results[i];
+			LM_TrackFields fields;
+
+			if (	result->valid
+				&&	LM_TRACKINFO[result->track].parseFields
+				&&	LM_TRACKINFO[result->track].parseFields(&fields, chunk->text + result->dataOffset, result->length))
+			{
+				pans[count] = fields.pan;
+				owners[count++] = i;
+			}
+		}
+
+		LM_CheckLuhnBatch(pans, count, results);
+
+		for (int i = 0; i < count; i++)
+		{
+			chunk->results[owners[i]].flags |= LM_DECODEFLAG_LUHNCHECKED;
+
+			if (results[i])
+				chunk->results[owners[i]].flags |= LM_DECODEFLAG_LUHNVALID;
+		}
+	}
+
+	free(pans);
+	free(owners);
+	free(results);
+}
+
+static void LM_DecodeBatchChunk(void * argument)
+{
+	LM_BatchChunk * chunk = (LM_BatchChunk *)argument;
+	LM_ReaderState * state = (LM_ReaderState *)malloc(sizeof(LM_ReaderState));
+
+	if (!state)
+		return;
+
+	long long traceStart = LM_TraceBegin();
+
+	LM_InitializeReaderState(state, chunk->options);
+	state->batchChunk = chunk;
+
+	for (size_t i = chunk->start; i < chunk->end; i++)
+	{
+		state->streamTime = chunk->file->timeBase + (long long)i * LM_SERIAL_BYTE_TIME;
+		LM_ProcessByte(state, chunk->file->bytes[i], chunk->options);
+	}
+
+	free(state);
+
+	if (chunk->options->printMode == LM_PRINTMODE_INTERPRET && chunk->options->printFlags & LM_PRINTFLAG_LUHN)
+		LM_CheckBatchLuhn(chunk);
+
+	LM_TraceEnd("decode chunk", traceStart);
+}
+
+// The position of the next packet byte of a track after from, or size.
+static size_t LM_NextTrackByte(const unsigned char * bytes, size_t size, size_t from, int track)
+{
+	LM_ReplyParser reply;
+	LM_InitializeReplyParser(&reply);
+
+	bool replyComplete;
+
+	for (size_t i = from; i < size; i++)
+	{
+		if (LM_ParseReplyByte(&reply, bytes[i], &replyComplete))
+			continue;
+
+		if ((bytes[i] & LM_PACKET_TIMING_MASK) != LM_PACKET_FLAG_TIMING && LM_packetTracks[bytes[i]] == track)
+			return i;
+	}
+
+	return size;
+}
+
+// Finds the end of a chunk: the first START byte at least minimumSize bytes
+// in at which no track is between its START and STOP. A track whose STOP
+// was lost counts as closed once its next byte is a START, or it sends no
+// more, since the decoder then throws its swipe away either way; otherwise
+// one lost STOP would make the rest of the file one chunk. Replies to reader
+// commands are passed over as LM_ProcessByte passes them, so their bytes are
+// never taken for packets and a chunk never starts inside one.
+static size_t LM_FindChunkEnd(const unsigned char * bytes, size_t size, size_t start, size_t minimumSize)
+{
+	int openTracks = 0;
+	size_t nextBytes[LM_TRACK_COUNT] = { 0 };	// of each open track, looked ahead from a START
+
+	LM_ReplyParser reply;
+	LM_InitializeReplyParser(&reply);
+
+	bool replyComplete;
+
+	for (size_t i = start; i < size; i++)
+	{
+		if (LM_ParseReplyByte(&reply, bytes[i], &replyComplete))
+			continue;
+
+		if (!(bytes[i] & LM_PACKET_FLAG_STARTSTOPCONTROL))
+			continue;
+
+		int trackMask = 1 << LM_packetTracks[bytes[i]];
+
+		if (bytes[i] & LM_PACKET_FLAG_START)
+		{
+			// a START on an open track means its STOP was lost; the decoder
+			// starts the track over here, so the swipe before has ended
+			openTracks &= ~trackMask;
+
+			if (i - start >= minimumSize)
+			{
+				for (int track = 0; track < LM_TRACK_COUNT; track++)
+				{
+					if (!(openTracks & (1 << track)))
+						continue;
+
+					if (nextBytes[track] <= i)
+						nextBytes[track] = LM_NextTrackByte(bytes, size, i + 1, track);
+
+					size_t next = nextBytes[track];
+
+					if (next == size || (bytes[next] & (LM_PACKET_FLAG_STARTSTOPCONTROL | LM_PACKET_FLAG_START)) == (LM_PACKET_FLAG_STARTSTOPCONTROL | LM_PACKET_FLAG_START))
+						openTracks &= ~(1 << track);
+				}
+
+				if (!openTracks)
+					return i;
+			}
+
+			openTracks |= trackMask;
+		}
+		else
+			openTracks &= ~trackMask;
+	}
+
+	return size;
+}
+
+static void LM_MergeBatchChunk(LM_WorkPool * pool, LM_BatchChunk * chunk, LM_BatchStats * stats)
+{
+	const LM_Options * options = chunk->options;
+
+	LM_WaitForWork(pool, &chunk->work);
+
+	long long traceStart = LM_TraceBegin();
+
+	for (int i = 0; i < chunk->resultCount; i++)
+	{
+		const LM_BatchResult * result = &chunk->results[i];
+		const char * text = chunk->text + result->dataOffset;
+
+		if (options->printMode == LM_PRINTMODE_BINARY)
+		{
+			if (options->printFlags & LM_PRINTFLAG_LABELS)
+				printf("%s", LM_TRACKINFO[result->track].label);
+
+			LM_PrintBinary(text, result->length);
+			printf("\n");
+		}
+		else
+		{
+			LM_Swipe swipe;
+
+			swipe.trackInfo = &LM_TRACKINFO[result->track];
+			swipe.deviceId = options->deviceId;
+			swipe.valid = result->valid;
+			swipe.decoded.flags = result->flags;
+			swipe.decoded.confidence = result->confidence;
+			swipe.decoded.quality = result->quality;
+			swipe.decoded.length = result->length;
+			memcpy(swipe.decoded.data, text, result->length);
+			swipe.decoded.data[result->length] = 0;
+			swipe.timing.start = swipe.timing.lastData = swipe.timing.stop = -1;
+			swipe.timing.decoded = swipe.timing.flushed = -1;
+			swipe.speed = NULL;
+			swipe.time = result->time;
+			swipe.timestamp = result->time;
+
+			LM_AnnotateSwipe(&swipe, options);
+			LM_OutputSwipe(&swipe, result->track, options);
+		}
+	}
+
+	stats->swipeCount += chunk->resultCount;
+
+	LM_TraceEnd("merge chunk", traceStart);
+
+	LM_BatchFile * file = chunk->file;
+
+	if (--file->chunksPending == 0 && file->split)
+	{
+		free(file->bytes);
+		free(file);
+	}
+
+	free(chunk->results);
+	free(chunk->text);
+	free(chunk);
+}
+
+static LM_BatchFile * LM_ReadBatchFile(const char * path)
+{
+	FILE * capture = fopen(path, "rb");
+
+	if (!capture)
+		return NULL;
+
+	LM_BatchFile * file = (LM_BatchFile *)calloc(1, sizeof(LM_BatchFile));
+
+	if (file)
+	{
+		fseek(capture, 0, SEEK_END);
+		long size = ftell(capture);
+		fseek(capture, 0, SEEK_SET);
+
+		file->bytes = (unsigned char *)malloc(size > 0 ? size : 1);
+
+		if (size < 0 || !file->bytes || fread(file->bytes, 1, size, capture) != (size_t)size)
+		{
+			free(file->bytes);
+			free(file);
+			file = NULL;
+		}
+		else
+			file->size = size;
+	}
+
+	fclose(capture);
+
+	return file;
+}
+
+// Decodes capture files on a work-stealing pool. Each file is split into
+// chunks at swipe boundaries, chunks are decoded in parallel, and results
+// are merged on this thread in file and chunk order, so output is the same
+// as feeding the files through the main loop one after another. At most a
+// few chunks per thread are in flight, which bounds the decoded results
+// held in memory to those of the chunks waiting to be merged.
+bool LM_Batch(const char * const * paths, int pathCount, int threadCount, const LM_Options * options)
+{
+	LM_WorkPool * pool = LM_CreateWorkPool(threadCount);
+
+	if (!pool)
+		return false;
+
+	int window = threadCount * LM_BATCH_CHUNKSPERTHREAD;
+	LM_BatchChunk ** inFlight = (LM_BatchChunk **)malloc(window * sizeof(LM_BatchChunk *));
+	int first = 0;
+	int count = 0;
+	bool success = inFlight != NULL;
+
+	LM_BatchStats stats;
+	memset(&stats, 0, sizeof(stats));
+
+	long long started = LM_MonotonicTime();
+	long long recordingStart = -1;
+
+	for (int i = 0; success && i < pathCount && !LM_stopRequested; i++)
+	{
+		LM_BatchFile * file = LM_ReadBatchFile(paths[i]);
+
+		if (!file)
+		{
+			fprintf(stderr, "Could not read capture %s.\n", paths[i]);
+			continue;
+		}
+
+		// files are timed as if read one after another from when the first
+		// began, as --replay would time the first
+		if (recordingStart < 0)
+			recordingStart = LM_RecordingStartTime(paths[i], (long long)file->size * LM_SERIAL_BYTE_TIME);
+
+		file->timeBase = recordingStart + stats.byteCount * LM_SERIAL_BYTE_TIME;
+
+		stats.fileCount++;
+		stats.byteCount += file->size;
+
+		for (size_t start = 0; start < file->size && !LM_stopRequested; )
+		{
+			LM_BatchChunk * chunk = (LM_BatchChunk *)calloc(1, sizeof(LM_BatchChunk));
+
+			if (!chunk)
+			{
+				success = false;
+				break;
+			}
+
+			if (count == window)
+			{
+				LM_MergeBatchChunk(pool, inFlight[first], &stats);
+				first = (first + 1) % window;
+				count--;
+			}
+
+			chunk->file = file;
+			chunk->start = start;
+			chunk->end = LM_FindChunkEnd(file->bytes, file->size, start, LM_BATCH_CHUNKSIZE);
+			chunk->options = options;
+			chunk->work.function = LM_DecodeBatchChunk;
+			chunk->work.argument = chunk;
+
+			file->chunksPending++;
+			stats.chunkCount++;
+
+			LM_SubmitWork(pool, &chunk->work);
+
+			inFlight[(first + count++) % window] = chunk;
+			start = chunk->end;
+		}
+
+		file->split = true;
+
+		if (!file->chunksPending)
+		{
+			free(file->bytes);
+			free(file);
+		}
+	}
+
+	for (; count > 0; count--)
+	{
+		LM_MergeBatchChunk(pool, inFlight[first], &stats);
+		first = (first + 1) % window;
+	}
+
+	LM_DestroyWorkPool(pool);
+	free(inFlight);
+
+	fflush(stdout);
+
+	double seconds = (double)(LM_MonotonicTime() - started) / LM_NANOSECONDS_PER_SECOND;
+
+	fprintf(stderr, "\nDecoded %lld swipes from %d files (%lld bytes, %lld chunks) in %.3f s on %d threads: %.1f MB/s\n",
+		stats.swipeCount, stats.fileCount, stats.byteCount, stats.chunkCount, seconds, threadCount,
+		seconds > 0 ? stats.byteCount / seconds / (1024 * 1024) : 0.0);
+
+	return success;
+}
+
+// A regression check of the decoder against a corpus of captures. Each
+// capture is run through LM_ProcessByte as live input is, and what that
+// prints is compared line by line with <capture>.expected. The time per
+// track of each stage is then measured against a calibration loop timed in
+// the same run, and held as a ratio to it against a baseline file of
+// "<stage> <ratio>" lines, so a baseline carries from one machine to
+// another. A stage more than the tolerance over its baseline fails, as
+// does any line printed differently. A missing baseline is recorded from
+// the run; --record writes the expected files and the baseline from the
+// decoder as it is.
+
+#define LM_VERIFY_ROUNDS			5			// a stage's time is the best of this many
+#define LM_VERIFY_ROUNDTIME			(100 * LM_NANOSECONDS_PER_MILLISECOND)	// at least, each
+#define LM_VERIFY_RETRIES			3			// times a stage over budget is timed again
+#define LM_VERIFY_TOLERANCE			20			// default percent a stage may run over its baseline
+#define LM_VERIFY_LINESIZE			4096
+
+enum LM_VerifyStage
+{
+	LM_VERIFYSTAGE_CALIBRATE = 0,	// a fixed table walk, which the others are held against
+	LM_VERIFYSTAGE_PARSE,			// LM_ProcessByte over the captures, no decoding
+	LM_VERIFYSTAGE_DECODE,			// LM_InterpretTrack on every track
+	LM_VERIFYSTAGE_REVERSE,			// LM_ReverseTrackData on every track
+
+	LM_VERIFYSTAGE_COUNT,
+};
+
+const char * LM_VERIFYSTAGES[LM_VERIFYSTAGE_COUNT] = { "calibrate", "parse", "decode", "reverse" };
+
+// A track as it arrived, padded out to a whole track buffer as the decoder expects.
+struct LM_VerifyTrack
+{
+	int		track;
+	int		bitCount;
+	char	data[LM_TRACKBUFFER_SIZE];
+};
+
+struct LM_VerifyCorpus
+{
+	LM_BatchFile **		files;
+	int					fileCount;
+	LM_VerifyTrack *	tracks;
+	int					trackCount;
+	int					trackCapacity;
+	LM_ReaderState *	state;
+};
+
+volatile unsigned int LM_verifyCalibration;		// kept so the calibration loop is not optimized away
+
+// Runs the packet parser over every capture through the batch path, so
+// tracks go to the chunk, when options select any, and nothing is printed.
+static void LM_ParseVerifyCorpus(LM_VerifyCorpus * corpus, LM_BatchChunk * chunk, const LM_Options * options)
+{
+	for (int i = 0; i < corpus->fileCount; i++)
+	{
+		LM_InitializeReaderState(corpus->state, options);
+		corpus->state->batchChunk = chunk;
+
+		for (size_t j = 0; j < corpus->files[i]->size; j++)
+			LM_ProcessByte(corpus->state, corpus->files[i]->bytes[j], options);
+	}
+}
+
+static void LM_RunVerifyStage(LM_VerifyCorpus * corpus, int stage, LM_BatchChunk * chunk, const LM_Options * options)
+{
+	static char reversed[LM_TRACKBUFFER_SIZE];
+	LM_DecodedTrack decoded;
+	unsigned int calibration = 0;
+
+	switch (stage)
+	{
+	case LM_VERIFYSTAGE_CALIBRATE:
+		// dependent table lookups over every byte, the kind of work the
+		// parser and decoder do, with nothing of theirs in it to change
+		for (int i = 0; i < corpus->trackCount; i++)
+		{
+			const unsigned char * data = (const unsigned char *)corpus->tracks[i].data;
+
+			for (int j = 0; j < LM_TRACKBUFFER_SIZE; j++)
+				calibration = calibration * 31 + LM_packetTracks[(data[j] ^ calibration) & 0xFF];
+		}
+
+		LM_verifyCalibration = calibration;
+		break;
+
+	case LM_VERIFYSTAGE_PARSE:
+		LM_ParseVerifyCorpus(corpus, chunk, options);
+		break;
+
+	case LM_VERIFYSTAGE_DECODE:
+		for (int i = 0; i < corpus->trackCount; i++)
+			LM_InterpretTrack(&decoded, corpus->tracks[i].data, corpus->tracks[i].bitCount, LM_TRACKINFO[corpus->tracks[i].track].format, options->maxSentinelDistance);
+		break;
+
+	case LM_VERIFYSTAGE_REVERSE:
+		for (int i = 0; i < corpus->trackCount; i++)
+			LM_ReverseTrackData(reversed, corpus->tracks[i].data, corpus->tracks[i].bitCount);
+		break;
+	}
+}
+
+// Nanoseconds per track, the best of several rounds so a busy machine
+// reads slow less often than it reads fast.
+static long long LM_TimeVerifyStage(LM_VerifyCorpus * corpus, int stage, LM_BatchChunk * chunk, const LM_Options * options)
+{
+	long long best = LLONG_MAX;
+
+	for (int round = 0; round < LM_VERIFY_ROUNDS; round++)
+	{
+		long long started = LM_MonotonicTime();
+		long long elapsed;
+		long long runs = 0;
+
+		do
+		{
+			LM_RunVerifyStage(corpus, stage, chunk, options);
+			runs++;
+		}
+		while ((elapsed = LM_MonotonicTime() - started) < LM_VERIFY_ROUNDTIME);
+
+		long long perTrack = elapsed / (runs * corpus->trackCount);
+
+		if (perTrack < best)
+			best = perTrack;
+	}
+
+	return (best > 0) ? best : 1;
+}
+
+// Runs a capture through LM_ProcessByte as LM_MainLoop runs live input, with
+// standard output, where the swipes are printed, sent to output and
+// standard error, where read errors are, sent to errors.
+static bool LM_PrintVerifyCapture(const LM_BatchFile * file, LM_ReaderState * state, FILE * output, FILE * errors, const LM_Options * options)
+{
+	fflush(stdout);
+	fflush(stderr);
+
+	int savedStdout = dup(fileno(stdout));
+	int savedStderr = dup(fileno(stderr));
+	bool redirected = savedStdout >= 0 && savedStderr >= 0 && dup2(fileno(output), fileno(stdout)) >= 0 && dup2(fileno(errors), fileno(stderr)) >= 0;
+
+	if (redirected)
+	{
+		LM_InitializeReaderState(state, options);
+
+		for (size_t i = 0; i < file->size; i++)
+			LM_ProcessByte(state, file->bytes[i], options);
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+
+	if (savedStdout >= 0)
+	{
+		dup2(savedStdout, fileno(stdout));
+		close(savedStdout);
+	}
+
+	if (savedStderr >= 0)
+	{
+		dup2(savedStderr, fileno(stderr));
+		close(savedStderr);
+	}
+
+	return redirected;
+}
+
+// Ends a line at its newline, dropping a carriage return before it, so
+// captures printed where stdout is text mode compare the same.
+static void LM_TrimVerifyLine(char * line)
+{
+	size_t length = strlen(line);
+
+	while (length && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+		line[--length] = 0;
+}
+
+// Compares what a capture prints with its expected file, or writes it.
+static bool LM_VerifyCapture(const char * path, const LM_BatchFile * file, LM_ReaderState * state, bool record, const LM_Options * options)
+{
+	char expectedPath[1024];
+	snprintf(expectedPath, sizeof(expectedPath), "%s.expected", path);
+
+	FILE * printed = tmpfile();
+	FILE * errors = tmpfile();
+	bool captured = printed && errors && LM_PrintVerifyCapture(file, state, printed, errors, options);
+
+	// what went to standard error follows what was printed, after a line
+	// of its own, so read errors are checked too
+	if (captured && ftell(errors) > 0)
+	{
+		char buffer[LM_VERIFY_LINESIZE];
+		size_t size;
+
+		fprintf(printed, "-- stderr --\n");
+		rewind(errors);
+
+		while ((size = fread(buffer, 1, sizeof(buffer), errors)) > 0)
+			fwrite(buffer, 1, size, printed);
+
+		fprintf(printed, "\n");
+	}
+
+	if (errors)
+		fclose(errors);
+
+	if (!captured)
+	{
+		fprintf(stderr, "%s: could not capture what it prints.\n", path);
+
+		if (printed)
+			fclose(printed);
+		return false;
+	}
+
+	rewind(printed);
+
+	FILE * expected = fopen(expectedPath, record ? "w" : "r");
+
+	if (!expected)
+	{
+		fprintf(stderr, "%s: could not open %s.\n", path, expectedPath);
+		fclose(printed);
+		return false;
+	}
+
+	static char line[LM_VERIFY_LINESIZE];
+	static char expectedLine[LM_VERIFY_LINESIZE];
+	int lineCount = 0;
+	int mismatches = 0;
+
+	while (fgets(line, sizeof(line), printed))
+	{
+		lineCount++;
+
+		if (record)
+		{
+			fputs(line, expected);
+			continue;
+		}
+
+		if (!fgets(expectedLine, sizeof(expectedLine), expected))
+		{
+			fprintf(stderr, "%s: printed more than the %d lines expected.\n", path, lineCount - 1);
+			mismatches++;
+			break;
+		}
+
+		LM_TrimVerifyLine(line);
+		LM_TrimVerifyLine(expectedLine);
+
+		if (strcmp(line, expectedLine))
+		{
+			if (!mismatches)
+				fprintf(stderr, "%s: line %d printed differently.\n  expected %s\n  printed  %s\n", path, lineCount, expectedLine, line);
+
+			mismatches++;
+		}
+	}
+
+	if (!record && !mismatches && fgets(expectedLine, sizeof(expectedLine), expected))
+	{
+		fprintf(stderr, "%s: printed %d lines, more expected.\n", path, lineCount);
+		mismatches++;
+	}
+
+	fclose(expected);
+	fclose(printed);
+
+	if (mismatches)
+		fprintf(stderr, "%s: %d of %d lines wrong.\n", path, mismatches, lineCount);
+
+	return mismatches == 0;
+}
+
+static bool LM_ReadVerifyBaseline(const char * path, double * baseline)
+{
+	FILE * file = fopen(path, "r");
+
+	if (!file)
+		return false;
+
+	char line[256];
+
+	while (fgets(line, sizeof(line), file))
+	{
+		char name[64];
+		double ratio;
+
+		if (line[0] == '#' || sscanf(line, "%63s %lf", name, &ratio) != 2)
+			continue;
+
+		for (int i = LM_VERIFYSTAGE_PARSE; i < LM_VERIFYSTAGE_COUNT; i++)
+		{
+			if (!strcmp(name, LM_VERIFYSTAGES[i]))
+				baseline[i] = ratio;
+		}
+	}
+
+	fclose(file);
+
+	return true;
+}
+
+static bool LM_WriteVerifyBaseline(const char * path, const double * measured)
+{
+	FILE * file = fopen(path, "w");
+
+	if (!file)
+		return false;
+
+	fprintf(file, "# launchmag --verify baseline: time per track of each stage over the calibration loop's\n");
+
+	for (int i = LM_VERIFYSTAGE_PARSE; i < LM_VERIFYSTAGE_COUNT; i++)
+		fprintf(file, "%s %.4f\n", LM_VERIFYSTAGES[i], measured[i]);
+
+	return fclose(file) == 0;
+}
+
+// Returns true if every capture prints as expected and every stage is
+// within its budget.
+bool LM_Verify(const char * const * paths, int pathCount, const char * baselinePath, int tolerance, bool record, const LM_Options * options)
+{
+	LM_VerifyCorpus corpus;
+	memset(&corpus, 0, sizeof(corpus));
+
+	LM_BatchChunk * chunk = (LM_BatchChunk *)calloc(1, sizeof(LM_BatchChunk));
+	corpus.files = (LM_BatchFile **)calloc(pathCount > 0 ? pathCount : 1, sizeof(LM_BatchFile *));
+	corpus.state = (LM_ReaderState *)malloc(sizeof(LM_ReaderState));
+
+	bool loaded = chunk && corpus.files && corpus.state;
+	bool passed = loaded;
+
+	// raw tracks come from the batch path in binary mode, and the parse
+	// stage runs it with no track selected so it stores nothing
+	LM_Options rawOptions;
+	memset(&rawOptions, 0, sizeof(rawOptions));
+	rawOptions.printMode = LM_PRINTMODE_BINARY;
+	rawOptions.printFlags = LM_PRINTFLAG_TRACK1 | LM_PRINTFLAG_TRACK2 | LM_PRINTFLAG_TRACK3;
+	rawOptions.maxSentinelDistance = options->maxSentinelDistance;
+
+	LM_Options parseOptions = rawOptions;
+	parseOptions.printFlags = 0;
+
+	// every capture is checked, so one run lists all that print wrong
+	for (int i = 0; loaded && i < pathCount; i++)
+	{
+		LM_BatchFile * file = LM_ReadBatchFile(paths[i]);
+
+		if (!file)
+		{
+			fprintf(stderr, "Could not read capture %s.\n", paths[i]);
+			loaded = passed = false;
+			break;
+		}
+
+		corpus.files[corpus.fileCount++] = file;
+
+		chunk->resultCount = 0;
+		chunk->textSize = 0;
+
+		LM_VerifyCorpus single = corpus;
+		single.files = &corpus.files[i];
+		single.fileCount = 1;
+		LM_ParseVerifyCorpus(&single, chunk, &rawOptions);
+
+		if (corpus.trackCount + chunk->resultCount > corpus.trackCapacity)
+		{
+			int capacity = corpus.trackCapacity ? corpus.trackCapacity : 256;
+
+			while (capacity < corpus.trackCount + chunk->resultCount)
+				capacity *= 2;
+
+			LM_VerifyTrack * tracks = (LM_VerifyTrack *)realloc(corpus.tracks, capacity * sizeof(LM_VerifyTrack));
+
+			if (!tracks)
+			{
+				loaded = passed = false;
+				break;
+			}
+
+			corpus.tracks = tracks;
+			corpus.trackCapacity = capacity;
+		}
+
+		for (int j = 0; j < chunk->resultCount; j++)
+		{
+			LM_VerifyTrack * track = &corpus.tracks[corpus.trackCount++];
+
+			track->track = chunk->results[j].track;
+			track->bitCount = chunk->results[j].length;
+			memset(track->data, 0, LM_TRACKBUFFER_SIZE);
+			memcpy(track->data, chunk->text + chunk->results[j].dataOffset, (track->bitCount + 7) / 8);
+		}
+
+		if (!LM_VerifyCapture(paths[i], file, corpus.state, record, options))
+			passed = false;
+	}
+
+	// reversing twice has to give back the track, or every reversed swipe
+	// decodes wrong however the expected files were recorded
+	static char reversed[LM_TRACKBUFFER_SIZE];
+	static char restored[LM_TRACKBUFFER_SIZE];
+
+	for (int i = 0; passed && i < corpus.trackCount; i++)
+	{
+		LM_ReverseTrackData(reversed, corpus.tracks[i].data, corpus.tracks[i].bitCount);
+		LM_ReverseTrackData(restored, reversed, corpus.tracks[i].bitCount);
+
+		if (memcmp(restored, corpus.tracks[i].data, LM_TRACKBUFFER_SIZE))
+		{
+			fprintf(stderr, "Track %d of the corpus does not survive reversing twice.\n", i + 1);
+			passed = false;
+		}
+	}
+
+	if (passed && corpus.trackCount)
+	{
+		double baseline[LM_VERIFYSTAGE_COUNT];
+		double measured[LM_VERIFYSTAGE_COUNT];
+
+		for (int i = 0; i < LM_VERIFYSTAGE_COUNT; i++)
+			baseline[i] = -1;
+
+		// a first run on a machine records the baseline it is held to after
+		struct stat status;
+		bool recordBaseline = record || stat(baselinePath, &status) != 0;
+
+		if (!recordBaseline && !LM_ReadVerifyBaseline(baselinePath, baseline))
+		{
+			fprintf(stderr, "Could not read baseline %s.\n", baselinePath);
+			passed = false;
+		}
+
+		long long calibration = LM_TimeVerifyStage(&corpus, LM_VERIFYSTAGE_CALIBRATE, chunk, options);
 
-		char * track = (inputByte & LM_PACKET_FLAG_TRACK2) ? track2 : track1;
-		int &bitCount = (inputByte & LM_PACKET_FLAG_TRACK2) ? track2BitCount : track1BitCount;
-		int &packetSize = (inputByte & LM_PACKET_FLAG_TRACK2) ? track2PacketSize : track1PacketSize;
+		fprintf(stderr, "%-9s %8lld ns/track\n", LM_VERIFYSTAGES[LM_VERIFYSTAGE_CALIBRATE], calibration);
 
-		if (inputByte & LM_PACKET_FLAG_STARTSTOPCONTROL)
+		for (int i = LM_VERIFYSTAGE_PARSE; i < LM_VERIFYSTAGE_COUNT; i++)
 		{
-			if (inputByte & LM_PACKET_FLAG_START)
+			long long time = LM_TimeVerifyStage(&corpus, i, chunk, (i == LM_VERIFYSTAGE_PARSE) ? &parseOptions : options);
+
+			measured[i] = (double)time / calibration;
+
+			if (recordBaseline || baseline[i] < 0)
 			{
-				memset(track, 0, LM_TRACKBUFFER_SIZE);
-				bitCount = 0;
-				packetSize = -1;
+				fprintf(stderr, "%-9s %8lld ns/track, %.3f x calibration\n", LM_VERIFYSTAGES[i], time, measured[i]);
+				continue;
 			}
-			else
+
+			double budget = baseline[i] * (100 + tolerance) / 100;
+
+			// a stage over budget is timed again before it fails, as a busy
+			// machine slows a stretch of rounds now and then
+			for (int retry = 0; retry < LM_VERIFY_RETRIES && measured[i] > budget; retry++)
 			{
-				if (	(inputByte & LM_PACKET_FLAG_TRACK2 && printFlags & LM_PRINTFLAG_TRACK2)
-					||	(!(inputByte & LM_PACKET_FLAG_TRACK2) && printFlags & LM_PRINTFLAG_TRACK1))
-				{
-					if (printFlags & LM_PRINTFLAG_LABELS)
-						printf("%s", (inputByte & LM_PACKET_FLAG_TRACK2) ? "Track 2: " : "Track 1: ");
+				long long again = LM_TimeVerifyStage(&corpus, i, chunk, (i == LM_VERIFYSTAGE_PARSE) ? &parseOptions : options);
 
-					if (printMode == LM_PRINTMODE_INTERPRET)
-					{
-						if (!LM_PrintInterpret(track, bitCount, printFlags & ~((inputByte & LM_PACKET_FLAG_TRACK2) ? LM_PRINTFLAG_TRACK1 : LM_PRINTFLAG_TRACK2)))
-						{
-							char reversedTrack[LM_TRACKBUFFER_SIZE];
-							LM_ReverseTrackData(reversedTrack, track, bitCount);
-							if (!LM_PrintInterpret(reversedTrack, bitCount, printFlags & ~((inputByte & LM_PACKET_FLAG_TRACK2) ? LM_PRINTFLAG_TRACK1 : LM_PRINTFLAG_TRACK2)))
-							{
-								fprintf(stderr, "data read error");
-							}
-						}
-					}
-					else if (printMode == LM_PRINTMODE_BINARY)
-					{
-						LM_PrintBinary(track, bitCount);
-					}
-					printf("\n");
+				if (again < time)
+				{
+					time = again;
+					measured[i] = (double)time / calibration;
 				}
 			}
+
+			bool withinBudget = measured[i] <= budget;
+
+			fprintf(stderr, "%-9s %8lld ns/track, %.3f x calibration, baseline %.3f, budget %.3f: %s\n", LM_VERIFYSTAGES[i], time, measured[i], baseline[i], budget, withinBudget ? "ok" : "OVER BUDGET");
+
+			if (!withinBudget)
+				passed = false;
 		}
-		else
+
+		if (recordBaseline)
 		{
-			if (packetSize == -1)
-				packetSize = inputByte & 0x0F;
+			if (LM_WriteVerifyBaseline(baselinePath, measured))
+				fprintf(stderr, "Recorded baseline %s.\n", baselinePath);
 			else
 			{
-				if (bitCount / 8 >= LM_TRACKBUFFER_SIZE)
-				{
-					fprintf(stderr, "Track buffer overflow on %s.", (inputByte & LM_PACKET_FLAG_TRACK2) ? "track2" : "track1");
-				}
-				else
-				{
-					for (int i = 0; i < packetSize; i++)
-					{
-						if ((0x01 << (4 - i)) & inputByte)
-							track[bitCount / 8] |= 0x1 << (7 - (bitCount % 8));
-
-						bitCount++;
-					}
-				}
-				packetSize = -1;
+				fprintf(stderr, "Could not write baseline %s.\n", baselinePath);
+				passed = false;
 			}
 		}
 	}
+
+	fprintf(stderr, "\n%s %d tracks from %d captures: %s\n", record ? "Recorded" : "Verified", corpus.trackCount, corpus.fileCount, passed ? "passed" : "FAILED");
+
+	for (int i = 0; i < corpus.fileCount; i++)
+	{
+		free(corpus.files[i]->bytes);
+		free(corpus.files[i]);
+	}
+
+	if (chunk)
+	{
+		free(chunk->results);
+		free(chunk->text);
+	}
+
+	free(chunk);
+	free(corpus.files);
+	free(corpus.tracks);
+	free(corpus.state);
+
+	return passed;
+}
+
+bool LM_PrintLog(const char * path)
+{
+	LM_LogReader reader;
+
+	if (!LM_OpenLogReader(&reader, path))
+		return false;
+
+	for (const LM_LogRecordHeader * record = LM_NextLogRecord(&reader, NULL); record; record = LM_NextLogRecord(&reader, record))
+	{
+		if (record->type != LM_LOGRECORD_SWIPE)
+			continue;
+
+		const LM_LogSwipeRecord * swipe = (const LM_LogSwipeRecord *)record;
+
+		LM_PrintStoredSwipe(stdout, record->timestamp, record->deviceId, swipe->track, swipe->valid != 0, swipe->flags, swipe->confidence, LM_LogSwipeData(swipe), swipe->length);
+	}
+
+	LM_CloseLogReader(&reader);
+
+	return true;
+}
+
+// context is the FILE to print to.
+void LM_PrintArchivedSwipe(const LM_ArchiveRecord * record, void * context)
+{
+	LM_PrintStoredSwipe((FILE *)context, record->timestamp, record->deviceId, record->track, record->valid != 0, record->flags, record->confidence, LM_ArchiveRecordData(record), record->length);
 }
 
 int main(int argc, char* argv[])
@@ -318,6 +2626,51 @@ int main(int argc, char* argv[])
 	struct arg_lit  *printNoLabelsArg				= arg_lit0("n", "no-labels",         "do not print track labels");
 	struct arg_lit  *printTrack2Arg				    = arg_lit0("2", "print-2",           "print track 2");
 	struct arg_lit  *printTrack1Arg				    = arg_lit0("1", "print-1",           "print track 1");
+	struct arg_lit  *printTrack3Arg				    = arg_lit0("3", "print-3",           "print track 3");
+	struct arg_lit  *printFieldsArg					= arg_lit0("f", "fields",            "print PAN, name, expiration and service code");
+	struct arg_lit  *luhnArg						= arg_lit0("k", "luhn",              "verify the PAN check digit");
+	struct arg_file *binTableArg					= arg_file0("i", "bin-table", "<file>", "annotate swipes with issuer data from a BIN range CSV");
+	struct arg_int  *deviceIdArg					= arg_int0("d", "device-id", "<n>",  "device ID recorded with each swipe");
+	struct arg_int  *dedupeWindowArg				= arg_int0("w", "dedupe-window", "<ms>", "drop repeat swipes of a card within ms of the first");
+	struct arg_lit  *tagDuplicatesArg				= arg_lit0(NULL, "tag-duplicates",   "print repeat swipes marked as duplicates instead of dropping them");
+	struct arg_file *logArg							= arg_file0("o", "log", "<file>",   "append raw packets and decoded swipes to a binary log");
+	struct arg_file *printLogArg					= arg_file0(NULL, "print-log", "<file>", "print the swipes recorded in a binary log and exit");
+	struct arg_file *archiveArg						= arg_file0("a", "archive", "<file>", "add decoded swipes to an indexed archive");
+	struct arg_str  *ringArg						= arg_str0(NULL, "ring", "<name>",   "publish swipes to a shared memory ring for local consumers");
+	struct arg_file *serveArg						= arg_file0(NULL, "serve", "<socket>", "send swipes to every client of a Unix domain socket");
+	struct arg_file *queryArg						= arg_filen(NULL, "query", "<archive>", 0, 256, "print archived swipes matching --pan, --from and --to, and exit");
+	struct arg_str  *panPrefixArg					= arg_str0(NULL, "pan", "<digits>",  "query swipes whose PAN starts with these digits");
+	struct arg_str  *fromArg						= arg_str0(NULL, "from", "<time>",   "query swipes at or after this UTC time (YYYY-MM-DD HH:MM:SS)");
+	struct arg_str  *toArg							= arg_str0(NULL, "to", "<time>",     "query swipes before this UTC time");
+	struct arg_file *replayArg						= arg_file0(NULL, "replay", "<file>",  "decode a swipe log or raw capture instead of live input");
+	struct arg_dbl  *speedArg						= arg_dbl0(NULL, "speed", "<n>",     "replay at n times recorded speed (default 0, as fast as possible)");
+	struct arg_file *wavArg							= arg_file0(NULL, "wav", "<file>",    "decode a WAV recording of a magnetic head's signal instead of live input");
+	struct arg_lit  *batchArg						= arg_lit0(NULL, "batch",            "decode the capture files given in parallel, output in file order");
+	struct arg_int  *threadsArg						= arg_int0("j", "threads", "<n>",    "batch decoding threads (default one per processor)");
+	struct arg_file *captureFilesArg				= arg_filen(NULL, NULL, "<file>", 0, 4096, "raw capture files for --batch or --verify");
+	struct arg_file *verifyArg						= arg_file0(NULL, "verify", "<baseline>", "check what the capture files print against their .expected files, and each stage against the baseline (recorded if missing)");
+	struct arg_lit  *recordArg						= arg_lit0(NULL, "record",           "with --verify, write the .expected files and baseline instead");
+	struct arg_int  *toleranceArg					= arg_int0(NULL, "tolerance", "<pct>", "percent a stage may run over its baseline (default 20)");
+	struct arg_lit  *latencyArg						= arg_lit0(NULL, "latency",          "time each swipe from START byte to output; histograms on SIGUSR1 and at exit");
+	struct arg_str  *metricsArg						= arg_str0(NULL, "metrics", "<port|socket>", "serve Prometheus metrics on a loopback TCP port or Unix socket");
+	struct arg_file *traceArg						= arg_file0(NULL, "trace", "<file>", "record pipeline spans and write them as Chrome trace JSON when the run ends");
+	struct arg_int  *traceEventsArg					= arg_int0(NULL, "trace-events", "<n>", "spans --trace keeps per thread (default 65536, 24 bytes each)");
+	struct arg_str  *formatArg						= arg_str0(NULL, "format", "<format>", "print swipes as text (default), jsonl, csv or binary records");
+	struct arg_lit  *qualityArg						= arg_lit0("q", "quality",           "print how cleanly each track read");
+	struct arg_lit  *timingArg						= arg_lit0(NULL, "timing",           "print swipe speed, acceleration and jitter from timing capture firmware");
+	struct arg_int  *sentinelDistanceArg			= arg_int0("s", "salvage", "<n>",    "salvage reads with up to n sentinel bit errors (default 0, off; try 2)");
+#ifndef WIN32
+	struct arg_file *deviceArg						= arg_file0(NULL, "device", "<tty>",  "read from a serial device or pty instead of standard input");
+#endif
+	struct arg_int  *baudArg						= arg_int0(NULL, "baud", "<rate>",    "serial port rate (default 9600)");
+	struct arg_lit  *fwVersionArg					= arg_lit0(NULL, "fw-version",       "ask the reader for its firmware version and settings");
+	struct arg_lit  *fwOverflowsArg					= arg_lit0(NULL, "fw-overflows",     "ask the reader how many bytes its buffers have dropped");
+	struct arg_lit  *fwClearOverflowsArg			= arg_lit0(NULL, "fw-clear-overflows", "as --fw-overflows, then zero the counts");
+	struct arg_str  *fwTracksArg					= arg_str0(NULL, "fw-tracks", "<1|2|12>", "tracks the reader sends");
+	struct arg_lit  *fwFilterArg					= arg_lit0(NULL, "fw-filter",        "have the reader send only the tracks printed (-1, -2)");
+	struct arg_str  *fwTimingArg					= arg_str0(NULL, "fw-timing", "<on|off>", "timing packets from timing capture firmware");
+	struct arg_int  *fwBaudArg						= arg_int0(NULL, "fw-baud", "<rate>", "move the reader and serial port to 9600, 19200, 38400 or 57600 baud");
+	struct arg_str  *fwFramingArg					= arg_str0(NULL, "fw-framing", "<legacy>", "packet framing the reader sends");
 	struct arg_lit  *helpArg						= arg_lit0("h", "help",              "print this help and exit");
 	struct arg_end  *endArg							= arg_end(20);
 
@@ -330,6 +2683,51 @@ int main(int argc, char* argv[])
 		printNoLabelsArg,
 		printTrack2Arg,
 		printTrack1Arg,
+		printTrack3Arg,
+		printFieldsArg,
+		luhnArg,
+		binTableArg,
+		deviceIdArg,
+		dedupeWindowArg,
+		tagDuplicatesArg,
+		logArg,
+		printLogArg,
+		archiveArg,
+		ringArg,
+		serveArg,
+		queryArg,
+		panPrefixArg,
+		fromArg,
+		toArg,
+		replayArg,
+		speedArg,
+		wavArg,
+		batchArg,
+		threadsArg,
+		captureFilesArg,
+		verifyArg,
+		recordArg,
+		toleranceArg,
+		formatArg,
+		latencyArg,
+		metricsArg,
+		traceArg,
+		traceEventsArg,
+		qualityArg,
+		timingArg,
+		sentinelDistanceArg,
+#ifndef WIN32
+		deviceArg,
+#endif
+		baudArg,
+		fwVersionArg,
+		fwOverflowsArg,
+		fwClearOverflowsArg,
+		fwTracksArg,
+		fwFilterArg,
+		fwTimingArg,
+		fwBaudArg,
+		fwFramingArg,
 		helpArg, 
 		endArg};
 		const char* progname = "launchmag";
@@ -358,8 +2756,96 @@ int main(int argc, char* argv[])
 				throw 0;
 			}
 
+			if (printLogArg->count)
+			{
+				if (!LM_PrintLog(printLogArg->filename[0]))
+					fprintf(stderr, "Could not read swipe log %s.\n", printLogArg->filename[0]);
+				throw 1;
+			}
+
+			if (queryArg->count)
+			{
+				LM_ArchiveQuery query;
+				memset(&query, 0, sizeof(query));
+
+				query.from = LLONG_MIN;
+				query.to = LLONG_MAX;
+
+				if (fromArg->count && !LM_ParseUtcTime(fromArg->sval[0], &query.from))
+				{
+					fprintf(stderr, "Could not read time %s.\n", fromArg->sval[0]);
+					throw 0;
+				}
+
+				if (toArg->count && !LM_ParseUtcTime(toArg->sval[0], &query.to))
+				{
+					fprintf(stderr, "Could not read time %s.\n", toArg->sval[0]);
+					throw 0;
+				}
+
+				if (panPrefixArg->count)
+				{
+					query.panPrefix = panPrefixArg->sval[0];
+					query.panPrefixLength = (int)strlen(panPrefixArg->sval[0]);
+				}
+
+				for (int i = 0; i < queryArg->count; i++)
+				{
+					LM_ArchiveQueryStats stats;
+
+					if (!LM_QueryArchive(queryArg->filename[i], &query, LM_PrintArchivedSwipe, stdout, &stats))
+						fprintf(stderr, "Could not query archive %s.\n", queryArg->filename[i]);
+
+					fflush(stdout);
+					fprintf(stderr, "%s: %llu of %llu swipes read matched, %u of %u blocks read\n", queryArg->filename[i],
+						(unsigned long long)stats.recordsMatched, (unsigned long long)stats.recordsRead, stats.blocksRead, stats.blockCount);
+				}
+
+				throw 1;
+			}
+
+			if (captureFilesArg->count && !batchArg->count && !verifyArg->count)
+			{
+				fprintf(stderr, "Capture files are only read with --batch or --verify.\n");
+				throw 0;
+			}
+
+			if (verifyArg->count && (batchArg->count || !captureFilesArg->count))
+			{
+				fprintf(stderr, "--verify takes capture files and no --batch.\n");
+				throw 0;
+			}
+
+			if (recordArg->count && !verifyArg->count)
+			{
+				fprintf(stderr, "--record only goes with --verify.\n");
+				throw 0;
+			}
+
+#ifdef WIN32
+			// both servers are built on poll and Unix domain sockets
+			if (metricsArg->count || serveArg->count)
+			{
+				fprintf(stderr, "--metrics and --serve are not available on Windows.\n");
+				throw 0;
+			}
+#endif
+
+			LM_InitializePacketTracks();
+
 			FILE * inputStream = stdin;
 
+			static LM_CommandPort commandPort;
+			LM_CommandPort * port = NULL;
+
+			commandPort.baudRate = baudArg->count ? baudArg->ival[0] : 9600;
+
+			if (LM_BaudIndex(commandPort.baudRate) < 0)
+			{
+				fprintf(stderr, "Readers run at 9600, 19200, 38400 or 57600 baud.\n");
+				throw 0;
+			}
+
 #ifdef WIN32
 			if (listCOMPortsArg->count > 0)
 			{
@@ -417,7 +2903,7 @@ int main(int argc, char* argv[])
 			dcb.fNull = FALSE;
 			dcb.fAbortOnError = FALSE;
 
-			dcb.BaudRate = DWORD(CBR_9600);
+			dcb.BaudRate = DWORD(commandPort.baudRate);
 			dcb.ByteSize = BYTE(8);
 			dcb.Parity   = BYTE(NOPARITY);
 			dcb.StopBits = BYTE(ONESTOPBIT);
@@ -462,33 +2948,383 @@ int main(int argc, char* argv[])
 				_close(libraryHandle);
 				return false;
 			}
+
+			commandPort.handle = hPort;
+			port = &commandPort;
+			LM_stopHandle = hPort;
+#else
+			if (deviceArg->count)
+			{
+				int fd = LM_OpenSerialDevice(deviceArg->filename[0], commandPort.baudRate);
+
+				if (fd < 0)
+				{
+					fprintf(stderr, "Could not open %s: %s.\n", deviceArg->filename[0], strerror(errno));
+					throw 0;
+				}
+
+				inputStream = fdopen(fd, "rb");
+				commandPort.fd = fd;
+				port = &commandPort;
+			}
 #endif
 
-			LM_PrintMode printMode = LM_PRINTMODE_INTERPRET;
+			LM_Options options;
+			memset(&options, 0, sizeof(options));
 
-			if (printBinaryArg->count)
-				printMode = LM_PRINTMODE_BINARY;
+			options.commandPort = port;
 
-			int printFlags = 0;
+			options.printMode = LM_PRINTMODE_INTERPRET;
+
+			if (printBinaryArg->count)
+				options.printMode = LM_PRINTMODE_BINARY;
 
 			if (	!printTrack1Arg->count
-				&&	!printTrack2Arg->count)
+				&&	!printTrack2Arg->count
+				&&	!printTrack3Arg->count)
 			{
-				printFlags |= LM_PRINTFLAG_TRACK2 | LM_PRINTFLAG_TRACK1;
+				options.printFlags |= LM_PRINTFLAG_TRACK2 | LM_PRINTFLAG_TRACK1 | LM_PRINTFLAG_TRACK3;
 			}
 			else
 			{
 				if (printTrack1Arg->count)
-					printFlags |= LM_PRINTFLAG_TRACK1;
+					options.printFlags |= LM_PRINTFLAG_TRACK1;
 
 				if (printTrack2Arg->count)
-					printFlags |= LM_PRINTFLAG_TRACK2;
+					options.printFlags |= LM_PRINTFLAG_TRACK2;
+
+				if (printTrack3Arg->count)
+					options.printFlags |= LM_PRINTFLAG_TRACK3;
 			}
 
 			if (!printNoLabelsArg->count)
-				printFlags |= LM_PRINTFLAG_LABELS;
+				options.printFlags |= LM_PRINTFLAG_LABELS;
+
+			if (printFieldsArg->count)
+				options.printFlags |= LM_PRINTFLAG_FIELDS;
+
+			if (luhnArg->count)
+				options.printFlags |= LM_PRINTFLAG_LUHN;
+
+			options.maxSentinelDistance = LM_SENTINEL_MAXDISTANCE;
+
+			if (sentinelDistanceArg->count)
+				options.maxSentinelDistance = sentinelDistanceArg->ival[0];
+
+			if (deviceIdArg->count)
+				options.deviceId = deviceIdArg->ival[0];
+
+			// 0 tells a build script the decoder passed, 2 that it regressed
+			if (verifyArg->count)
+			{
+				int tolerance = toleranceArg->count ? toleranceArg->ival[0] : LM_VERIFY_TOLERANCE;
+				bool passed = LM_Verify(captureFilesArg->filename, captureFilesArg->count, verifyArg->filename[0], tolerance, recordArg->count > 0, &options);
+
+				arg_freetable(argtable, sizeof(argtable)/sizeof(argtable[0]));
+				return passed ? 0 : 2;
+			}
+
+			if (tagDuplicatesArg->count)
+				options.printFlags |= LM_PRINTFLAG_DUPLICATES;
+
+			static LM_WakeLatency wakeLatency;
+
+			if (timingArg->count)
+			{
+				options.printFlags |= LM_PRINTFLAG_TIMING;
+				options.wakeLatency = &wakeLatency;
+			}
+
+			if (qualityArg->count)
+				options.printFlags |= LM_PRINTFLAG_QUALITY;
+
+			// ahead of every thread, see LM_CatchStopSignals
+			LM_CatchStopSignals();
+
+			static LM_SwipeLatency latency;
+
+			if (latencyArg->count)
+			{
+				// before the server and batch threads start, so they leave
+				// SIGUSR1 to the thread that dumps the histograms
+				LM_InitializeSwipeLatency(&latency);
+				LM_DumpSwipeLatencyOnSignal(&latency);
+				options.latency = &latency;
+			}
+
+			int threadCount = threadsArg->count ? threadsArg->ival[0] : LM_ProcessorCount();
+
+			if (threadCount < 1)
+				threadCount = 1;
+
+			// the main thread, and the workers of a batch
+			if (traceArg->count && !LM_StartTrace(1 + (batchArg->count ? threadCount : 0), traceEventsArg->count ? traceEventsArg->ival[0] : LM_TRACE_EVENTSPERTHREAD))
+				fprintf(stderr, "Could not allocate trace buffers; not tracing.\n");
+
+			static LM_Metrics metrics;
+			LM_MetricsServer * metricsServer = NULL;
+
+			if (metricsArg->count)
+			{
+				LM_InitializeMetrics(&metrics);
+				metricsServer = LM_OpenMetricsServer(&metrics, metricsArg->sval[0]);
+
+				if (!metricsServer)
+				{
+					fprintf(stderr, "Could not serve metrics on %s.\n", metricsArg->sval[0]);
+					throw 0;
+				}
+
+				options.metrics = &metrics;
+			}
+
+			static LM_DedupeCache dedupeCache;
+
+			if (dedupeWindowArg->count && dedupeWindowArg->ival[0] > 0)
+			{
+				LM_InitializeDedupeCache(&dedupeCache, dedupeWindowArg->ival[0] * LM_NANOSECONDS_PER_MILLISECOND);
+				options.dedupeCache = &dedupeCache;
+			}
+
+			LM_BinTable binTable;
+
+			if (binTableArg->count)
+			{
+				if (!LM_OpenBinTable(&binTable, binTableArg->filename[0]))
+				{
+					fprintf(stderr, "Could not load BIN table %s.\n", binTableArg->filename[0]);
+					throw 0;
+				}
+
+				options.binTable = &binTable;
+			}
+
+			static LM_ArchiveWriter archiveWriter;
+
+			if (archiveArg->count)
+			{
+				if (!LM_OpenArchiveWriter(&archiveWriter, archiveArg->filename[0]))
+				{
+					fprintf(stderr, "Could not open swipe archive %s.\n", archiveArg->filename[0]);
+					throw 0;
+				}
+
+				options.archiveWriter = &archiveWriter;
+			}
+
+			static LM_RingProducer ring;
+
+			if (ringArg->count)
+			{
+				if (!LM_OpenRingProducer(&ring, ringArg->sval[0]))
+				{
+					fprintf(stderr, "Could not open swipe ring %s.\n", ringArg->sval[0]);
+					throw 0;
+				}
+
+				options.ring = &ring;
+			}
+
+			if (serveArg->count)
+			{
+				options.server = LM_OpenSwipeServer(serveArg->filename[0]);
+
+				if (!options.server)
+				{
+					fprintf(stderr, "Could not listen on %s.\n", serveArg->filename[0]);
+					throw 0;
+				}
+			}
+
+			static LM_OutputWriter outputWriter;
+			LM_OutputFormat outputFormat = LM_OUTPUTFORMAT_TEXT;
+
+			if (formatArg->count && !LM_ParseOutputFormat(formatArg->sval[0], &outputFormat))
+			{
+				fprintf(stderr, "Unknown output format %s.\n", formatArg->sval[0]);
+				throw 0;
+			}
+
+			if (outputFormat != LM_OUTPUTFORMAT_TEXT)
+			{
+				if (options.printMode == LM_PRINTMODE_BINARY)
+				{
+					fprintf(stderr, "--format does not apply to -b.\n");
+					throw 0;
+				}
+
+#ifdef WIN32
+				if (outputFormat == LM_OUTPUTFORMAT_BINARY)
+					_setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+				// live swipes go out as they are read; replays and batches
+				// only write when the buffer fills
+				LM_OpenOutputWriter(&outputWriter, stdout, outputFormat, !batchArg->count && !replayArg->count && !wavArg->count, options.latency != NULL);
+				options.output = &outputWriter;
+			}
+
+			static LM_LogWriter logWriter;
+
+			if (logArg->count)
+			{
+				if (!LM_OpenLogWriter(&logWriter, logArg->filename[0], options.deviceId))
+				{
+					fprintf(stderr, "Could not open swipe log %s.\n", logArg->filename[0]);
+					throw 0;
+				}
+
+				options.logWriter = &logWriter;
+			}
+
+			// the live parser starts with the reader commands, whose replies
+			// come in the packet stream
+			static LM_ReaderState liveState;
+			LM_InitializeReaderState(&liveState, &options);
+
+			// each command is answered in the packet stream and the next goes
+			// once it has been, a baud change last so the replies ahead of it
+			// come at the rate the port is set to
+			if (	fwVersionArg->count || fwOverflowsArg->count || fwClearOverflowsArg->count || fwTracksArg->count
+				||	fwFilterArg->count || fwTimingArg->count || fwBaudArg->count || fwFramingArg->count)
+			{
+				if (!port || batchArg->count || wavArg->count || replayArg->count)
+				{
+#ifdef WIN32
+					fprintf(stderr, "Reader commands need a live reader on a COM port.\n");
+#else
+					fprintf(stderr, "Reader commands need a live reader; give its serial device with --device.\n");
+#endif
+					throw 0;
+				}
+
+				int tracks = 0;
+
+				if (fwTracksArg->count && fwFilterArg->count)
+				{
+					fprintf(stderr, "Give --fw-tracks or --fw-filter, not both.\n");
+					throw 0;
+				}
+
+				// tracks not printed need not cross the serial line at all
+				if (fwFilterArg->count)
+				{
+					if (options.printFlags & LM_PRINTFLAG_TRACK1)
+						tracks |= LM_TRACKMASK_TRACK1;
+
+					if (options.printFlags & LM_PRINTFLAG_TRACK2)
+						tracks |= LM_TRACKMASK_TRACK2;
+				}
+
+				if (fwTracksArg->count)
+				{
+					for (const char * c = fwTracksArg->sval[0]; *c; c++)
+					{
+						if (*c == '1')
+							tracks |= LM_TRACKMASK_TRACK1;
+						else if (*c == '2')
+							tracks |= LM_TRACKMASK_TRACK2;
+						else
+						{
+							fprintf(stderr, "Readers send tracks 1 and 2 only.\n");
+							throw 0;
+						}
+					}
+				}
+
+				if (fwTimingArg->count && strcmp(fwTimingArg->sval[0], "on") && strcmp(fwTimingArg->sval[0], "off"))
+				{
+					fprintf(stderr, "--fw-timing takes on or off.\n");
+					throw 0;
+				}
+
+				if (fwFramingArg->count && strcmp(fwFramingArg->sval[0], "legacy"))
+				{
+					fprintf(stderr, "Unknown framing %s; readers send legacy framing only.\n", fwFramingArg->sval[0]);
+					throw 0;
+				}
+
+				int baudIndex = fwBaudArg->count ? LM_BaudIndex(fwBaudArg->ival[0]) : -1;
+
+				if (fwBaudArg->count && baudIndex < 0)
+				{
+					fprintf(stderr, "Readers run at 9600, 19200, 38400 or 57600 baud.\n");
+					throw 0;
+				}
+
+				if (fwFramingArg->count)
+					LM_QueueCommand(port, LM_COMMAND_FRAMING, LM_FRAMING_LEGACY);
+
+				if (fwTracksArg->count || fwFilterArg->count)
+					LM_QueueCommand(port, LM_COMMAND_TRACKS, tracks);
+
+				if (fwTimingArg->count)
+					LM_QueueCommand(port, LM_COMMAND_TIMING, !strcmp(fwTimingArg->sval[0], "on"));
+
+				if (fwOverflowsArg->count || fwClearOverflowsArg->count)
+					LM_QueueCommand(port, LM_COMMAND_OVERFLOWS, fwClearOverflowsArg->count ? 1 : 0);
+
+				if (fwVersionArg->count)
+					LM_QueueCommand(port, LM_COMMAND_VERSION, 0);
+
+				if (fwBaudArg->count)
+					LM_QueueCommand(port, LM_COMMAND_BAUD, baudIndex);
+
+				if (!LM_RunReaderCommands(port, &liveState, &options))
+					throw 1;
+			}
+
+			LM_AcceptStopSignals();
+
+			if (batchArg->count)
+			{
+				if (!LM_Batch(captureFilesArg->filename, captureFilesArg->count, threadCount, &options))
+					fprintf(stderr, "Batch decoding failed.\n");
+			}
+			else if (wavArg->count)
+			{
+				if (!LM_DecodeWav(wavArg->filename[0], &options))
+					fprintf(stderr, "Could not read WAV file %s.\n", wavArg->filename[0]);
+			}
+			else if (replayArg->count)
+			{
+				if (!LM_Replay(replayArg->filename[0], speedArg->count ? speedArg->dval[0] : 0, &options))
+					fprintf(stderr, "Could not open capture %s.\n", replayArg->filename[0]);
+			}
+			else
+			{
+				LM_MainLoop(inputStream, &liveState, &options);
+			}
+
+			if (options.output)
+				LM_CloseOutputWriter(options.output);
+
+			if (options.latency)
+				LM_PrintSwipeLatency(stderr, options.latency);
+
+			if (options.wakeLatency)
+				LM_PrintWakeLatency(stderr, options.wakeLatency);
+
+			if (traceArg->count && !LM_WriteTrace(traceArg->filename[0]))
+				fprintf(stderr, "Could not write trace %s.\n", traceArg->filename[0]);
+
+			if (options.logWriter)
+				LM_CloseLogWriter(options.logWriter);
+
+			if (options.archiveWriter)
+				LM_CloseArchiveWriter(options.archiveWriter);
+
+			if (options.ring)
+				LM_CloseRingProducer(options.ring);
+
+			if (options.server)
+				LM_CloseSwipeServer(options.server);
+
+			if (metricsServer)
+				LM_CloseMetricsServer(metricsServer);
 
-			LM_MainLoop(inputStream, printMode, printFlags);
+			if (options.binTable)
+				LM_CloseBinTable(options.binTable);
 		}
 		catch (int e)
 		{
@@ -0,0 +1,733 @@
+// Emulates launchmag readers on pseudo-terminals, so the console's serial
+// path can be load tested without hardware. Each virtual device is a pty
+// whose slave end is given to "launchmag --device"; the emulator writes the
+// packets a reader would send for each swipe, paced at the serial rate, and
+// answers reader commands (see LM_Commands.h) as command channel firmware
+// does. Every track sent is reported as a JSON line with its data and the
+// wall clock time its STOP byte went out, so a harness can match it to the
+// console's --format jsonl output for accuracy and end to end latency.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "argtable/argtable2.h"
+
+#include "../launchmag_firmware/LM_PacketFlags.h"
+#include "../launchmag_firmware/LM_Commands.h"
+
+#include "LM_Clock.h"
+
+#define LM_EMULATOR_MAXDEVICES		64
+#define LM_EMULATOR_LEADINGZEROS	20		// clocking zeros either side of the data
+#define LM_EMULATOR_MAXBITS			1024
+#define LM_EMULATOR_MAXEVENTS		1024	// packet bytes of one swipe, both tracks
+#define LM_EMULATOR_DATASIZE		96
+#define LM_EMULATOR_MILLIMETRESPERINCH	25.4
+
+struct LM_EmulatorOptions
+{
+	long long	count;				// swipes per device, 0 to run until killed
+	double		rate;				// swipes per second per device
+	int			baudRate;			// 0 sends as fast as the console reads
+	double		speed;				// millimetres per second
+	int			trackMask;			// LM_TRACKMASK_ flags
+	double		reversePercent;		// of swipes
+	double		noisePercent;		// of tracks, with one data bit flipped
+	double		dropPercent;		// of bytes
+};
+
+// One track of the card, 0 for Track 1 and 1 for Track 2 as LM_TRACKMASK_ bits.
+struct LM_EmulatedTrackFormat
+{
+	int				number;
+	int				bitsPerCharacter;
+	int				characterOffset;
+	int				bitsPerInch;
+	unsigned char	dataFlag;
+	unsigned char	controlFlag;
+};
+
+const LM_EmulatedTrackFormat LM_EMULATEDTRACKS[2] = {
+	{ 1, 7, 0x20, 210, LM_PACKET_FLAG_TRACK1, LM_PACKET_FLAG_TRACK1 },
+	{ 2, 5, 0x30, 75, LM_PACKET_FLAG_TRACK2, LM_PACKET_FLAG_TRACK2 },
+};
+
+struct LM_EmulatedTrack
+{
+	char			data[LM_EMULATOR_DATASIZE];
+	unsigned char	bits[LM_EMULATOR_MAXBITS];
+	int				bitCount;
+	int				noiseBit;			// bit flipped, or -1
+	int				droppedBytes;
+	long long		started;			// wall clock of the START byte
+	long long		stopped;			// and of the STOP byte, -1 if it was dropped
+};
+
+// A packet byte and when the reader would queue it, from card loaded.
+struct LM_PacketEvent
+{
+	long long		time;
+	int				track;
+	int				order;				// queued, to keep a size and bits packet together
+	unsigned char	byte;
+};
+
+struct LM_EmulatedDevice
+{
+	int							index;
+	int							master;
+	int							slave;			// held open so the pty stays up and raw
+	char						path[64];
+	unsigned int				seed;
+	int							baudRate;		// LM_COMMAND_BAUD changes it
+	int							trackMask;		// and LM_COMMAND_TRACKS this
+	unsigned char				command[LM_COMMAND_LENGTH];
+	int							commandLength;
+	unsigned int				dropped[2];		// answered as the overflow counts
+	const LM_EmulatorOptions *	options;
+	pthread_t					thread;
+	long long					swipeCount;
+	long long					byteCount;
+	long long					droppedCount;
+};
+
+const int LM_EMULATORBAUDRATES[LM_BAUD_COUNT] = { 9600, 19200, 38400, 57600 };
+
+pthread_mutex_t LM_reportLock = PTHREAD_MUTEX_INITIALIZER;
+FILE * LM_report;
+
+bool LM_Chance(LM_EmulatedDevice * device, double percent)
+{
+	return percent > 0 && rand_r(&device->seed) < percent / 100.0 * ((double)RAND_MAX + 1);
+}
+
+// Bits of a track as they pass the head, leading zeros first, each
+// character low bit first with odd parity, then the LRC.
+int LM_EncodeTrack(const LM_EmulatedTrackFormat * format, const char * data, unsigned char * bits)
+{
+	int dataBits = format->bitsPerCharacter - 1;
+	int dataMask = (1 << dataBits) - 1;
+	int count = 0;
+	int lrc = 0;
+
+	for (int i = 0; i < LM_EMULATOR_LEADINGZEROS; i++)
+		bits[count++] = 0;
+
+	for (const char * c = data; ; c++)
+	{
+		int value = *c ? ((*c - format->characterOffset) & dataMask) : lrc;
+		int ones = 0;
+
+		lrc ^= value;
+
+		for (int i = 0; i < dataBits; i++)
+		{
+			bits[count++] = (value >> i) & 1;
+			ones += (value >> i) & 1;
+		}
+
+		bits[count++] = !(ones & 1);
+
+		if (!*c)
+			break;
+	}
+
+	for (int i = 0; i < LM_EMULATOR_LEADINGZEROS; i++)
+		bits[count++] = 0;
+
+	return count;
+}
+
+// A Luhn valid test PAN, with the device and swipe in the discretionary
+// data so every swipe is unique and can be matched to what the console
+// printed.
+void LM_MakeCard(LM_EmulatedDevice * device, long long sequence, LM_EmulatedTrack * tracks)
+{
+	char pan[17];
+	int sum = 0;
+
+	pan[0] = '4';
+	for (int i = 1; i < 15; i++)
+		pan[i] = (char)('0' + rand_r(&device->seed) % 10);
+
+	for (int i = 14; i >= 0; i--)
+	{
+		int digit = pan[i] - '0';
+
+		if ((14 - i) % 2 == 0)
+		{
+			digit *= 2;
+			if (digit > 9)
+				digit -= 9;
+		}
+
+		sum += digit;
+	}
+
+	pan[15] = (char)('0' + (10 - sum % 10) % 10);
+	pan[16] = 0;
+
+	snprintf(tracks[0].data, LM_EMULATOR_DATASIZE, "%%B%s^EMULATED/READER^2512101%02d%08lld?", pan, device->index % 100, sequence % 100000000);
+	snprintf(tracks[1].data, LM_EMULATOR_DATASIZE, ";%s=2512101%02d%08lld?", pan, device->index % 100, sequence % 100000000);
+}
+
+int LM_CompareEvents(const void * a, const void * b)
+{
+	const LM_PacketEvent * eventA = (const LM_PacketEvent *)a;
+	const LM_PacketEvent * eventB = (const LM_PacketEvent *)b;
+
+	if (eventA->time != eventB->time)
+		return (eventA->time < eventB->time) ? -1 : 1;
+
+	return eventA->order - eventB->order;
+}
+
+// Packets of one track timed by where its bits are on the stripe, the way
+// the firmware queues a packet on every fifth clock edge.
+int LM_QueueTrackEvents(const LM_EmulatedTrackFormat * format, const LM_EmulatedTrack * track, double speed, int trackIndex, LM_PacketEvent * events)
+{
+	long long bitTime = (long long)(LM_NANOSECONDS_PER_SECOND / (speed * format->bitsPerInch / LM_EMULATOR_MILLIMETRESPERINCH));
+	int count = 0;
+
+	events[count].time = 0;
+	events[count].track = trackIndex;
+	events[count++].byte = format->controlFlag | LM_PACKET_FLAG_STARTSTOPCONTROL | LM_PACKET_FLAG_START;
+
+	for (int i = 0; i < track->bitCount; i += 5)
+	{
+		int size = (track->bitCount - i < 5) ? track->bitCount - i : 5;
+		unsigned char packet = 0;
+
+		for (int j = 0; j < size; j++)
+		{
+			if (track->bits[i + j])
+				packet |= 0x01 << (4 - j);
+		}
+
+		events[count].time = (i + size) * bitTime;
+		events[count].track = trackIndex;
+		events[count++].byte = format->dataFlag | size;
+		events[count].time = (i + size) * bitTime;
+		events[count].track = trackIndex;
+		events[count++].byte = format->dataFlag | packet;
+	}
+
+	events[count].time = (track->bitCount + 1) * bitTime;
+	events[count].track = trackIndex;
+	events[count++].byte = format->controlFlag | LM_PACKET_FLAG_STARTSTOPCONTROL | LM_PACKET_FLAG_STOP;
+
+	return count;
+}
+
+bool LM_WriteAll(int fd, const unsigned char * bytes, int count)
+{
+	while (count > 0)
+	{
+		ssize_t written = write(fd, bytes, count);
+
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		bytes += written;
+		count -= (int)written;
+	}
+
+	return true;
+}
+
+void LM_RunEmulatedCommand(LM_EmulatedDevice * device, int command, int argument)
+{
+	unsigned char reply[LM_REPLY_MAXLENGTH];
+	int length = 0;
+
+	reply[length++] = LM_REPLY_MARKER;
+	reply[length++] = 0;
+	reply[length++] = (unsigned char)command;
+	reply[length++] = LM_STATUS_OK;
+
+	int baudRate = device->baudRate;
+
+	switch (command)
+	{
+	case LM_COMMAND_VERSION:
+		reply[length++] = 1;
+		reply[length++] = 1;
+		reply[length++] = 0;
+		reply[length++] = (unsigned char)device->trackMask;
+		reply[length] = LM_BAUD_9600;
+
+		for (int i = 0; i < LM_BAUD_COUNT; i++)
+		{
+			if (device->baudRate == LM_EMULATORBAUDRATES[i])
+				reply[length] = (unsigned char)i;
+		}
+
+		length++;
+		reply[length++] = LM_FRAMING_LEGACY;
+		break;
+
+	case LM_COMMAND_OVERFLOWS:
+		reply[length++] = device->dropped[0] & 0xFF;
+		reply[length++] = (device->dropped[0] >> 8) & 0xFF;
+		reply[length++] = device->dropped[1] & 0xFF;
+		reply[length++] = (device->dropped[1] >> 8) & 0xFF;
+		reply[length++] = 0;		// commands come whole through the pty
+		reply[length++] = 0;
+
+		if (argument)
+			device->dropped[0] = device->dropped[1] = 0;
+		break;
+
+	case LM_COMMAND_TRACKS:
+		if (argument & ~(LM_TRACKMASK_TRACK1 | LM_TRACKMASK_TRACK2))
+			reply[3] = LM_STATUS_BADARGUMENT;
+		else
+			device->trackMask = argument;
+		break;
+
+	case LM_COMMAND_TIMING:
+		reply[3] = LM_STATUS_NOTBUILT;
+		break;
+
+	case LM_COMMAND_BAUD:
+		if (argument >= LM_BAUD_COUNT)
+			reply[3] = LM_STATUS_BADARGUMENT;
+		else
+			baudRate = LM_EMULATORBAUDRATES[argument];
+		break;
+
+	case LM_COMMAND_FRAMING:
+		if (argument != LM_FRAMING_LEGACY)
+			reply[3] = LM_STATUS_BADARGUMENT;
+		break;
+
+	default:
+		reply[3] = LM_STATUS_UNKNOWNCOMMAND;
+		break;
+	}
+
+	reply[1] = (unsigned char)(length - 2);
+	LM_WriteAll(device->master, reply, length);
+
+	// as the firmware does, the reply goes at the old rate
+	if (device->options->baudRate)
+		device->baudRate = baudRate;
+}
+
+// Reads and answers any commands waiting, or waits up to timeout
+// milliseconds for one. Returns false once the console side has gone.
+bool LM_ServeCommands(LM_EmulatedDevice * device, int timeout)
+{
+	struct pollfd poller;
+	poller.fd = device->master;
+	poller.events = POLLIN;
+
+	if (poll(&poller, 1, timeout) <= 0 || !(poller.revents & POLLIN))
+		return true;
+
+	unsigned char bytes[64];
+	ssize_t count = read(device->master, bytes, sizeof(bytes));
+
+	if (count < 0)
+		return errno == EINTR || errno == EAGAIN || errno == EIO;	// EIO until a console opens the slave
+
+	for (ssize_t i = 0; i < count; i++)
+	{
+		if (!device->commandLength && bytes[i] != LM_COMMAND_SYNC)
+			continue;
+
+		device->command[device->commandLength++] = bytes[i];
+
+		if (device->commandLength < LM_COMMAND_LENGTH)
+			continue;
+
+		device->commandLength = 0;
+
+		if ((device->command[1] ^ device->command[2]) != device->command[3])
+		{
+			unsigned char reply[4] = { LM_REPLY_MARKER, 2, device->command[1], LM_STATUS_BADCHECK };
+			LM_WriteAll(device->master, reply, sizeof(reply));
+		}
+		else
+			LM_RunEmulatedCommand(device, device->command[1], device->command[2]);
+	}
+
+	return true;
+}
+
+void LM_WaitUntil(LM_EmulatedDevice * device, long long deadline)
+{
+	long long remaining;
+
+	while ((remaining = deadline - LM_MonotonicTime()) > 0)
+		LM_ServeCommands(device, (int)((remaining + LM_NANOSECONDS_PER_MILLISECOND - 1) / LM_NANOSECONDS_PER_MILLISECOND));
+}
+
+void LM_ReportTrack(LM_EmulatedDevice * device, long long sequence, int trackIndex, const LM_EmulatedTrack * track, bool reversed)
+{
+	pthread_mutex_lock(&LM_reportLock);
+
+	fprintf(LM_report, "{\"sequence\":%lld,\"device\":%d,\"track\":%d,\"reversed\":%s,\"noise_bit\":%d,\"dropped_bytes\":%d,\"start_ns\":%lld,\"stop_ns\":%lld,\"data\":\"%s\"}\n",
+		sequence, device->index, LM_EMULATEDTRACKS[trackIndex].number, reversed ? "true" : "false", track->noiseBit, track->droppedBytes,
+		track->started, track->stopped, track->data);
+	fflush(LM_report);
+
+	pthread_mutex_unlock(&LM_reportLock);
+}
+
+void LM_SendSwipe(LM_EmulatedDevice * device, long long sequence)
+{
+	const LM_EmulatorOptions * options = device->options;
+	LM_PacketEvent events[LM_EMULATOR_MAXEVENTS];
+	LM_EmulatedTrack tracks[2];
+	int eventCount = 0;
+
+	LM_MakeCard(device, sequence, tracks);
+
+	bool reversed = LM_Chance(device, options->reversePercent);
+
+	for (int i = 0; i < 2; i++)
+	{
+		LM_EmulatedTrack * track = &tracks[i];
+
+		track->bitCount = LM_EncodeTrack(&LM_EMULATEDTRACKS[i], track->data, track->bits);
+		track->noiseBit = -1;
+		track->droppedBytes = 0;
+		track->started = -1;
+		track->stopped = -1;
+
+		if (!(device->trackMask & (1 << i)))
+			continue;
+
+		if (LM_Chance(device, options->noisePercent))
+		{
+			track->noiseBit = LM_EMULATOR_LEADINGZEROS + rand_r(&device->seed) % (track->bitCount - 2 * LM_EMULATOR_LEADINGZEROS);
+			track->bits[track->noiseBit] ^= 1;
+		}
+
+		if (reversed)
+		{
+			for (int j = 0; j < track->bitCount / 2; j++)
+			{
+				unsigned char bit = track->bits[j];
+				track->bits[j] = track->bits[track->bitCount - 1 - j];
+				track->bits[track->bitCount - 1 - j] = bit;
+			}
+		}
+
+		eventCount += LM_QueueTrackEvents(&LM_EMULATEDTRACKS[i], track, options->speed, i, events + eventCount);
+	}
+
+	for (int i = 0; i < eventCount; i++)
+		events[i].order = i;
+
+	qsort(events, eventCount, sizeof(LM_PacketEvent), LM_CompareEvents);
+
+	long long cardLoaded = LM_MonotonicTime();
+	long long lineFree = cardLoaded;
+
+	for (int i = 0; i < eventCount; i++)
+	{
+		const LM_PacketEvent * event = &events[i];
+		LM_EmulatedTrack * track = &tracks[event->track];
+		long long due = cardLoaded + event->time;
+
+		// a byte goes out once it is queued and the line is free
+		if (device->baudRate)
+		{
+			if (due < lineFree)
+				due = lineFree;
+
+			lineFree = due + 10 * LM_NANOSECONDS_PER_SECOND / device->baudRate;
+		}
+
+		LM_WaitUntil(device, due);
+
+		bool control = (event->byte & LM_PACKET_FLAG_STARTSTOPCONTROL) != 0;
+
+		if (LM_Chance(device, options->dropPercent))
+		{
+			track->droppedBytes++;
+			device->dropped[event->track]++;
+			device->droppedCount++;
+			continue;
+		}
+
+		if (!LM_WriteAll(device->master, &event->byte, 1))
+			return;
+
+		device->byteCount++;
+
+		if (control)
+		{
+			if (event->byte & LM_PACKET_FLAG_START)
+				track->started = LM_WallClockTime();
+			else
+				track->stopped = LM_WallClockTime();
+		}
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (device->trackMask & (1 << i))
+			LM_ReportTrack(device, sequence, i, &tracks[i], reversed);
+	}
+
+	device->swipeCount++;
+}
+
+void * LM_RunDevice(void * context)
+{
+	LM_EmulatedDevice * device = (LM_EmulatedDevice *)context;
+	const LM_EmulatorOptions * options = device->options;
+	long long interval = (long long)(LM_NANOSECONDS_PER_SECOND / options->rate);
+	long long next = LM_MonotonicTime();
+
+	for (long long sequence = 1; !options->count || sequence <= options->count; sequence++)
+	{
+		LM_WaitUntil(device, next);
+		LM_SendSwipe(device, sequence);
+
+		// a rate the line cannot carry sends swipes back to back
+		next += interval;
+		if (next < LM_MonotonicTime())
+			next = LM_MonotonicTime();
+	}
+
+	return NULL;
+}
+
+bool LM_OpenEmulatedDevice(LM_EmulatedDevice * device)
+{
+	device->master = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if (device->master < 0 || grantpt(device->master) < 0 || unlockpt(device->master) < 0)
+		return false;
+
+	const char * path = ptsname(device->master);
+
+	if (!path)
+		return false;
+
+	snprintf(device->path, sizeof(device->path), "%s", path);
+
+	// raw from the start, so nothing is echoed or translated before the
+	// console opens it
+	device->slave = open(device->path, O_RDWR | O_NOCTTY);
+
+	if (device->slave < 0)
+		return false;
+
+	struct termios settings;
+
+	if (tcgetattr(device->slave, &settings) < 0)
+		return false;
+
+	cfmakeraw(&settings);
+	return tcsetattr(device->slave, TCSANOW, &settings) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+	struct arg_int  *devicesArg						= arg_int0("n", "devices", "<n>",    "virtual readers, each on its own pty (default 1)");
+	struct arg_int  *countArg						= arg_int0("c", "count", "<n>",      "swipes per reader, then exit (default: until killed)");
+	struct arg_dbl  *rateArg						= arg_dbl0("r", "rate", "<n>",       "swipes per second per reader (default 1)");
+	struct arg_int  *baudArg						= arg_int0(NULL, "baud", "<rate>",   "serial rate to pace bytes at, 0 for as fast as read (default 9600)");
+	struct arg_dbl  *speedArg						= arg_dbl0(NULL, "speed", "<mm/s>",  "card speed past the head (default 500)");
+	struct arg_str  *tracksArg						= arg_str0(NULL, "tracks", "<1|2|12>", "tracks on each card (default 12)");
+	struct arg_dbl  *reverseArg						= arg_dbl0(NULL, "reverse", "<pct>", "percent of swipes made backwards");
+	struct arg_dbl  *noiseArg						= arg_dbl0(NULL, "noise", "<pct>",   "percent of tracks with a data bit flipped");
+	struct arg_dbl  *dropArg						= arg_dbl0(NULL, "drop", "<pct>",    "percent of bytes lost on the line");
+	struct arg_int  *seedArg						= arg_int0(NULL, "seed", "<n>",      "random seed, for a repeatable run");
+	struct arg_int  *delayArg						= arg_int0(NULL, "delay", "<ms>",    "wait before the first swipe, to start consoles (default 1000)");
+	struct arg_int  *lingerArg						= arg_int0(NULL, "linger", "<ms>",   "keep the ptys open after the last swipe (default 1000)");
+	struct arg_file *reportArg						= arg_file0("o", "report", "<file>", "write the report here instead of standard output");
+	struct arg_lit  *helpArg						= arg_lit0("h", "help",              "print this help and exit");
+	struct arg_end  *endArg							= arg_end(20);
+
+	void* argtable[] = {
+		devicesArg,
+		countArg,
+		rateArg,
+		baudArg,
+		speedArg,
+		tracksArg,
+		reverseArg,
+		noiseArg,
+		dropArg,
+		seedArg,
+		delayArg,
+		lingerArg,
+		reportArg,
+		helpArg,
+		endArg};
+		const char* progname = "launchmag_emulator";
+
+		try
+		{
+			if (arg_nullcheck(argtable) != 0)
+			{
+				fprintf(stderr, "%s: insufficient memory\n", progname);
+				throw 1;
+			}
+
+			int nErrors = arg_parse(argc, argv, argtable);
+
+			if (helpArg->count > 0)
+			{
+				fprintf(stderr, "Usage: %s\n", progname);
+				throw 0;
+			}
+
+			if (nErrors > 0)
+			{
+				arg_print_errors(stderr, endArg, progname);
+				throw 0;
+			}
+
+			LM_EmulatorOptions options;
+			memset(&options, 0, sizeof(options));
+
+			options.count = countArg->count ? countArg->ival[0] : 0;
+			options.rate = rateArg->count ? rateArg->dval[0] : 1.0;
+			options.baudRate = baudArg->count ? baudArg->ival[0] : 9600;
+			options.speed = speedArg->count ? speedArg->dval[0] : 500.0;
+			options.trackMask = LM_TRACKMASK_TRACK1 | LM_TRACKMASK_TRACK2;
+			options.reversePercent = reverseArg->count ? reverseArg->dval[0] : 0.0;
+			options.noisePercent = noiseArg->count ? noiseArg->dval[0] : 0.0;
+			options.dropPercent = dropArg->count ? dropArg->dval[0] : 0.0;
+
+			if (tracksArg->count)
+			{
+				options.trackMask = 0;
+
+				for (const char * c = tracksArg->sval[0]; *c; c++)
+				{
+					if (*c == '1')
+						options.trackMask |= LM_TRACKMASK_TRACK1;
+					else if (*c == '2')
+						options.trackMask |= LM_TRACKMASK_TRACK2;
+					else
+					{
+						fprintf(stderr, "Readers send tracks 1 and 2 only.\n");
+						throw 0;
+					}
+				}
+			}
+
+			int deviceCount = devicesArg->count ? devicesArg->ival[0] : 1;
+
+			if (deviceCount < 1 || deviceCount > LM_EMULATOR_MAXDEVICES)
+			{
+				fprintf(stderr, "Emulate 1 to %d readers.\n", LM_EMULATOR_MAXDEVICES);
+				throw 0;
+			}
+
+			if (options.rate <= 0 || options.speed <= 0 || options.baudRate < 0)
+			{
+				fprintf(stderr, "--rate, --speed and --baud must be positive.\n");
+				throw 0;
+			}
+
+			LM_report = stdout;
+
+			if (reportArg->count && !(LM_report = fopen(reportArg->filename[0], "w")))
+			{
+				fprintf(stderr, "Could not open report %s.\n", reportArg->filename[0]);
+				throw 1;
+			}
+
+			unsigned int seed = seedArg->count ? (unsigned int)seedArg->ival[0] : (unsigned int)LM_WallClockTime();
+			static LM_EmulatedDevice devices[LM_EMULATOR_MAXDEVICES];
+
+			for (int i = 0; i < deviceCount; i++)
+			{
+				LM_EmulatedDevice * device = &devices[i];
+
+				device->index = i;
+				device->seed = seed + i * 7919;
+				device->baudRate = options.baudRate;
+				device->trackMask = options.trackMask;
+				device->options = &options;
+
+				if (!LM_OpenEmulatedDevice(device))
+				{
+					fprintf(stderr, "Could not open a pty: %s.\n", strerror(errno));
+					throw 1;
+				}
+
+				fprintf(LM_report, "{\"device\":%d,\"pty\":\"%s\"}\n", i, device->path);
+				fprintf(stderr, "Reader %d on %s\n", i, device->path);
+			}
+
+			fflush(LM_report);
+
+			struct timespec delay;
+			int delayMilliseconds = delayArg->count ? delayArg->ival[0] : 1000;
+			delay.tv_sec = delayMilliseconds / 1000;
+			delay.tv_nsec = (delayMilliseconds % 1000) * 1000000L;
+			nanosleep(&delay, NULL);
+
+			long long started = LM_MonotonicTime();
+
+			for (int i = 0; i < deviceCount; i++)
+			{
+				if (pthread_create(&devices[i].thread, NULL, LM_RunDevice, &devices[i]))
+				{
+					fprintf(stderr, "Could not start reader %d.\n", i);
+					throw 1;
+				}
+			}
+
+			for (int i = 0; i < deviceCount; i++)
+				pthread_join(devices[i].thread, NULL);
+
+			double seconds = (double)(LM_MonotonicTime() - started) / LM_NANOSECONDS_PER_SECOND;
+
+			for (int i = 0; i < deviceCount; i++)
+			{
+				fprintf(stderr, "Reader %d: %lld swipes, %lld bytes sent, %lld dropped in %.3f s\n",
+					i, devices[i].swipeCount, devices[i].byteCount, devices[i].droppedCount, seconds);
+			}
+
+			// what is still in a pty when the master closes is lost
+			int lingerMilliseconds = lingerArg->count ? lingerArg->ival[0] : 1000;
+			delay.tv_sec = lingerMilliseconds / 1000;
+			delay.tv_nsec = (lingerMilliseconds % 1000) * 1000000L;
+			nanosleep(&delay, NULL);
+
+			for (int i = 0; i < deviceCount; i++)
+			{
+				close(devices[i].slave);
+				close(devices[i].master);
+			}
+
+			if (LM_report != stdout)
+				fclose(LM_report);
+		}
+		catch (int e)
+		{
+			if (e == 0)
+			{
+				fprintf(stderr, "\n");
+				arg_print_syntax(stderr, argtable, "\n");
+				arg_print_glossary(stderr, argtable, "  %-25s %s\n");
+			}
+			arg_freetable(argtable, sizeof(argtable)/sizeof(argtable[0]));
+			return e;
+		}
+		arg_freetable(argtable, sizeof(argtable)/sizeof(argtable[0]));
+		return 0;
+}
@@ -0,0 +1,205 @@
+#pragma warning( disable : 4996 )
+
+// Reference consumer for the shared memory swipe ring published by
+// "launchmag --ring <name>". Prints swipes as they arrive, or with --bench
+// measures the time from publish to read and prints its distribution.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "argtable/argtable2.h"
+
+#include "LM_Clock.h"
+#include "LM_SwipeRing.h"
+
+#ifdef WIN32
+#include <Windows.h>
+#endif
+
+#define LM_RINGTAP_IDLEPOLLS		4096	// empty polls before sleeping
+#define LM_RINGTAP_IDLESLEEP		50		// microseconds
+
+void LM_IdleSleep()
+{
+#ifdef WIN32
+	Sleep(0);
+#else
+	struct timespec duration;
+	duration.tv_sec = 0;
+	duration.tv_nsec = LM_RINGTAP_IDLESLEEP * 1000;
+	nanosleep(&duration, NULL);
+#endif
+}
+
+void LM_PrintRingRecord(const LM_RingRecord * record)
+{
+	time_t seconds = (time_t)(record->timestamp / LM_NANOSECONDS_PER_SECOND);
+	char timeText[32];
+	strftime(timeText, sizeof(timeText), "%Y-%m-%d %H:%M:%S", gmtime(&seconds));
+
+	printf("%s.%03d device %u track %d: ", timeText, (int)((record->timestamp % LM_NANOSECONDS_PER_SECOND) / LM_NANOSECONDS_PER_MILLISECOND), record->deviceId, record->track + 1);
+
+	if (record->valid)
+		printf("%.*s%s\n", record->length, record->data, record->truncated ? "..." : "");
+	else
+		printf("data read error\n");
+}
+
+int LM_CompareLatencies(const void * a, const void * b)
+{
+	long long latencyA = *(const long long *)a;
+	long long latencyB = *(const long long *)b;
+
+	return (latencyA < latencyB) ? -1 : (latencyA > latencyB) ? 1 : 0;
+}
+
+void LM_PrintLatencies(long long * latencies, long long count, unsigned long long lost)
+{
+	fprintf(stderr, "%lld swipes read, %llu lost\n", count, lost);
+
+	if (!count)
+		return;
+
+	qsort(latencies, (size_t)count, sizeof(long long), LM_CompareLatencies);
+
+	long long total = 0;
+	for (long long i = 0; i < count; i++)
+		total += latencies[i];
+
+	fprintf(stderr, "Publish to read latency: min %.2f us, mean %.2f us, p50 %.2f us, p99 %.2f us, p99.9 %.2f us, max %.2f us\n",
+		latencies[0] / 1000.0,
+		(double)total / count / 1000.0,
+		latencies[count / 2] / 1000.0,
+		latencies[(count * 99) / 100] / 1000.0,
+		latencies[(count * 999) / 1000] / 1000.0,
+		latencies[count - 1] / 1000.0);
+}
+
+int main(int argc, char* argv[])
+{
+	struct arg_str  *ringArg						= arg_str1(NULL, "ring", "<name>",   "ring to read, as given to launchmag --ring");
+	struct arg_int  *countArg						= arg_int0("c", "count", "<n>",      "exit after n swipes");
+	struct arg_lit  *benchArg						= arg_lit0(NULL, "bench",            "measure publish to read latency instead of printing swipes (implies --spin)");
+	struct arg_lit  *spinArg						= arg_lit0(NULL, "spin",             "poll without sleeping while the ring is idle");
+	struct arg_lit  *helpArg						= arg_lit0("h", "help",              "print this help and exit");
+	struct arg_end  *endArg							= arg_end(20);
+
+	void* argtable[] = {
+		ringArg,
+		countArg,
+		benchArg,
+		spinArg,
+		helpArg,
+		endArg};
+		const char* progname = "launchmag_ringtap";
+
+		try
+		{
+			if (arg_nullcheck(argtable) != 0)
+			{
+				fprintf(stderr, "%s: insufficient memory\n", progname);
+				throw 1;
+			}
+
+			int nErrors = arg_parse(argc, argv, argtable);
+
+			if (helpArg->count > 0)
+			{
+				fprintf(stderr, "Usage: %s\n", progname);
+				throw 0;
+			}
+
+			if (nErrors > 0)
+			{
+				arg_print_errors(stderr, endArg, progname);
+				throw 0;
+			}
+
+			LM_RingConsumer consumer;
+
+			if (!LM_OpenRingConsumer(&consumer, ringArg->sval[0]))
+			{
+				fprintf(stderr, "Could not attach to swipe ring %s. Is launchmag running with --ring?\n", ringArg->sval[0]);
+				throw 1;
+			}
+
+			long long limit = countArg->count ? countArg->ival[0] : -1;
+			long long count = 0;
+			long long * latencies = NULL;
+
+			if (benchArg->count)
+			{
+				if (limit < 0)
+				{
+					fprintf(stderr, "--bench needs --count.\n");
+					throw 0;
+				}
+
+				latencies = (long long *)malloc((size_t)(limit > 0 ? limit : 1) * sizeof(long long));
+
+				if (!latencies)
+					throw 1;
+			}
+
+			int idlePolls = 0;
+
+			while (limit < 0 || count < limit)
+			{
+				const LM_RingRecord * shared = LM_PeekRing(&consumer);
+
+				if (!shared)
+				{
+					if (!spinArg->count && !benchArg->count && ++idlePolls >= LM_RINGTAP_IDLEPOLLS)
+						LM_IdleSleep();
+
+					continue;
+				}
+
+				idlePolls = 0;
+
+				if (latencies)
+				{
+					// read in place; only the publish time is needed
+					long long latency = LM_MonotonicTime() - shared->published;
+
+					if (LM_ReleaseRing(&consumer))
+						latencies[count++] = latency;
+				}
+				else
+				{
+					LM_RingRecord record;
+					memcpy(&record, shared, sizeof(record));
+
+					if (LM_ReleaseRing(&consumer))
+					{
+						LM_PrintRingRecord(&record);
+						fflush(stdout);
+						count++;
+					}
+				}
+			}
+
+			if (latencies)
+			{
+				LM_PrintLatencies(latencies, count, (unsigned long long)consumer.lost);
+				free(latencies);
+			}
+
+			LM_CloseRingConsumer(&consumer);
+		}
+		catch (int e)
+		{
+			if (e == 0)
+			{
+				fprintf(stderr, "\n");
+				arg_print_syntax(stderr, argtable, "\n");
+				arg_print_glossary(stderr, argtable, "  %-25s %s\n");
+			}
+			arg_freetable(argtable, sizeof(argtable)/sizeof(argtable[0]));
+			return e;
+		}
+		arg_freetable(argtable, sizeof(argtable)/sizeof(argtable[0]));
+		return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef LM_COMMANDS_H_
+#define LM_COMMANDS_H_
+
+// Host to firmware commands, received by firmware built with
+// LM_COMMANDCHANNEL. Every command is four bytes: LM_COMMAND_SYNC, the
+// command, its argument and a check byte of command ^ argument. Anything
+// else is skipped until the next LM_COMMAND_SYNC.
+//
+// Every command is answered in the packet stream: LM_REPLY_MARKER, a count
+// of the bytes that follow, the command, an LM_STATUS_ code and any payload.
+// No packet uses a control byte with the low bits of LM_REPLY_MARKER set
+// (see LM_PacketFlags.h), and the firmware sends a reply whole and between
+// packets, so a parser that knows the marker takes the count and skips the
+// reply before it can be mistaken for track data.
+
+#define LM_COMMAND_SYNC				0xA5
+#define LM_COMMAND_LENGTH			4
+
+#define LM_COMMAND_VERSION			0x01	// payload: major, minor, LM_FEATURE_ flags, LM_TRACKMASK_, baud index, framing
+#define LM_COMMAND_OVERFLOWS		0x02	// payload: Track 1, Track 2 then command bytes dropped, 16 bits each, low byte first; a nonzero argument clears them
+#define LM_COMMAND_TRACKS			0x03	// argument: LM_TRACKMASK_ flags of the tracks to read and send, the rest are not even read
+#define LM_COMMAND_TIMING			0x04	// argument: nonzero sends timing packets, LM_TIMINGCAPTURE builds only
+#define LM_COMMAND_BAUD				0x05	// argument: LM_BAUD_ index, taken up once the reply is sent
+#define LM_COMMAND_FRAMING			0x06	// argument: LM_FRAMING_
+
+#define LM_REPLY_MARKER				0x4F
+#define LM_REPLY_MAXLENGTH			16		// count byte included
+
+#define LM_STATUS_OK				0x00
+#define LM_STATUS_UNKNOWNCOMMAND	0x01
+#define LM_STATUS_BADARGUMENT		0x02
+#define LM_STATUS_NOTBUILT			0x03	// the firmware was built without what the command needs
+#define LM_STATUS_BADCHECK			0x04	// the check byte did not match, nothing was done
+
+#define LM_FEATURE_TIMINGCAPTURE	0x01	// built with LM_TIMINGCAPTURE
+#define LM_FEATURE_TIMINGON			0x02	// timing packets are being sent
+
+#define LM_TRACKMASK_TRACK1			0x01
+#define LM_TRACKMASK_TRACK2			0x02
+
+#define LM_BAUD_9600				0
+#define LM_BAUD_19200				1
+#define LM_BAUD_38400				2
+#define LM_BAUD_57600				3
+#define LM_BAUD_COUNT				4
+
+#define LM_FRAMING_LEGACY			0		// the packets of LM_PacketFlags.h, the only framing so far
+
+#endif /*LM_COMMANDS_H_*/
@@ -7,4 +7,26 @@
 #define LM_PACKET_FLAG_START    			0x20
 #define LM_PACKET_FLAG_STOP    				0x00
 
+// Track 3 extension. Data and size packets never use bit 5 and control
+// packets never use bit 4, so a Track 3 packet is marked with whichever bit
+// is free for its kind and Track 1/2 streams stay byte for byte the same.
+#define LM_PACKET_FLAG_TRACK3				0x20	// data and size packets
+#define LM_PACKET_FLAG_CONTROLTRACK3		0x10	// start/stop control packets
+
+// Timing packets, sent by firmware built with LM_TIMINGCAPTURE. No other
+// packet sets the Track 2 and Track 3 bits together, so 0xA0 to 0xBF are
+// free. Two follow each data packet, high 5 bits first, with a 10 bit code
+// for the time its clock edges spanned, from the edge before its first bit
+// (the first packet of a swipe has one interval fewer than it has bits).
+// The code is 3 bits of exponent and 7 of mantissa: microseconds are the
+// mantissa for an exponent of 0, else (128 + mantissa) << (exponent - 1),
+// so every time up to 16 ms is kept to within 1%. LM_TIMING_SATURATED
+// stands for anything longer. The first data packet of a swipe has one
+// more code ahead of its own, in 16 microsecond units: the time from the
+// card loaded edge to the first clock edge.
+#define LM_PACKET_FLAG_TIMING				0xA0
+#define LM_PACKET_TIMING_MASK				0xE0
+#define LM_PACKET_TIMING_BITS				0x1F
+#define LM_TIMING_SATURATED					0x3FF
+
 #endif /*LM_PACKETFLAGS_H_*/
@@ -4,6 +4,7 @@
 #include "DCO_Library.h"
 
 #include "LM_PacketFlags.h"
+#include "LM_Commands.h"
 
 // ********************************************************************************
 // START UART
@@ -30,17 +31,50 @@
 #define		UART_TXD             	BIT1    // UART_TXD on P1.1
 #define		UART_RXD				BIT2	// UART_RXD on P1.2
 
+#ifdef LM_COMMANDCHANNEL
+#define     Bit_time    		    UART_bitTime		// LM_COMMAND_BAUD changes it
+#define		Bit_time_5			    (UART_bitTime >> 1)
+#else
 #define     Bit_time    		    1664//104		// 9600 Baud, SMCLK=1MHz (1MHz/9600)=104
 #define		Bit_time_5			    832//52			// Time for half a bit.
+#endif
+
+// Timing capture builds count Timer A wraps, so TAIE stays set through every byte.
+#ifdef LM_TIMINGCAPTURE
+#define		UART_TIMERCONTROL		(TASSEL_2 + MC_2 + TAIE)
+#else
+#define		UART_TIMERCONTROL		(TASSEL_2 + MC_2)
+#endif
+
+// Timer A keeps running between bytes when it times edges or listens for commands.
+#if defined(LM_TIMINGCAPTURE) || defined(LM_COMMANDCHANNEL)
+#define		UART_TIMERFREERUNNING
+#endif
 
 unsigned char UART_BitCnt;					// Bit count, used when transmitting byte
 unsigned int  UART_TXByte;					// Value recieved once hasRecieved is set
 
+#ifdef LM_COMMANDCHANNEL
+#define		UART_RXBUFFER_SIZE		8
+
+const unsigned int UART_BITTIMES[LM_BAUD_COUNT] = { 1664, 832, 416, 277 };	// indexed by LM_BAUD_
+
+unsigned int  UART_bitTime = 1664;
+unsigned char UART_RXBitCnt;
+unsigned char UART_RXByte;
+
+unsigned char UART_RXBuffer[UART_RXBUFFER_SIZE];
+
+volatile unsigned char UART_RXReadLocation  = 0;
+volatile unsigned char UART_RXWriteLocation = 0;
+volatile unsigned int  UART_rxOverflows = 0;	// command bytes dropped with the buffer full
+#endif
+
 // Function Transmits Character from UART_TXByte 
 void UART_TransmitByte()
 { 
   	CCTL0 = OUT;						// UART_TXD Idle as Mark
-  	TACTL = TASSEL_2 + MC_2;			// SMCLK, continuous mode
+  	TACTL = UART_TIMERCONTROL;			// SMCLK, continuous mode
 
   	UART_BitCnt = 0xA;					// Load Bit counter, 8 bits + ST/SP
   	CCR0 = TAR;							// Initialize compare register
@@ -60,7 +94,9 @@ __interrupt void Timer_A (void)
 	CCR0 += Bit_time;			// Add Offset to CCR0  
 	if ( UART_BitCnt == 0)		// If all bits TXed
 	{
+#ifndef UART_TIMERFREERUNNING
 		TACTL = TASSEL_2;		// SMCLK, timer off (for power consumption)
+#endif
 		CCTL0 &= ~CCIE ;		// Disable interrupt
 	}
 	else
@@ -73,12 +109,57 @@ __interrupt void Timer_A (void)
 	}
 }
 
+#ifdef LM_COMMANDCHANNEL
+// Called from the Timer A1 ISR for CCR1. CCR1 captures the falling edge of
+// a start bit on UART_RXD, then compares to sample the middle of each data
+// bit. Returns true once a byte is in UART_RXBuffer.
+bool UART_ReceiveBit()
+{
+	CCR1 += Bit_time;
+	if (CCTL1 & CAP)					// start bit
+	{
+		CCTL1 &= ~CAP;					// compare from here on
+		CCR1 += Bit_time_5;				// to the middle of the first data bit
+		UART_RXBitCnt = 8;
+		return false;
+	}
+	
+	UART_RXByte = UART_RXByte >> 1;
+	if (CCTL1 & SCCI)					// UART_RXD as latched by the compare
+		UART_RXByte |= 0x80;
+	if (--UART_RXBitCnt)
+		return false;
+	
+	CCTL1 |= CAP;						// wait for the next start bit
+	
+	unsigned char next = UART_RXWriteLocation + 1;
+	
+	if (next >= UART_RXBUFFER_SIZE)
+		next = 0;
+	if (next == UART_RXReadLocation)	// full, main has not kept up
+	{
+		UART_rxOverflows++;
+		return true;
+	}
+	UART_RXBuffer[UART_RXWriteLocation] = UART_RXByte;
+	UART_RXWriteLocation = next;
+	return true;
+}
+#endif
+
 void UART_Initialize()
 {
 	volatile unsigned int i;
 
 	P1SEL |= UART_TXD;
 	P1DIR |= UART_TXD;
+	
+#ifdef LM_COMMANDCHANNEL
+	P1SEL |= UART_RXD;					// CCI1A
+	P1DIR &= ~UART_RXD;
+	TACTL = UART_TIMERCONTROL;			// SMCLK, continuous mode, to catch a start bit at any time
+	CCTL1 = SCS + CM1 + CAP + CCIE;		// synchronous capture of falling edges
+#endif
   
 	__bis_SR_register(GIE);			// interrupts enabled
 	
@@ -102,9 +183,15 @@ void UART_TransmitString(const char * string)
 // START MAG STRIPE READER (MSR)
 // ********************************************************************************
 
+// Built with LM_COMMANDCHANNEL, UART_RXD takes P1.2 back for commands from
+// the host, so Track 2 card loaded moves to P1.0 and the status LED goes.
+#ifdef LM_COMMANDCHANNEL
+#define LM_STATUSLED			0
+#define LM_T2_CARD_LOADED		BIT0 // track 2 card loaded
+#else
 #define LM_STATUSLED			BIT0
-
 #define LM_T2_CARD_LOADED		BIT2 // track 2 card loaded 
+#endif
 #define LM_T2_CLOCK			    BIT4 // track 2 clock
 #define LM_T2_DATA				BIT5 // track 2 data
 
@@ -112,6 +199,10 @@ void UART_TransmitString(const char * string)
 #define LM_T1_CLOCK			    BIT6 // track 1 clock
 #define LM_T1_DATA				BIT7 // track 1 data
 
+// Track 3 packets (LM_PACKET_FLAG_TRACK3) need another card loaded, clock and
+// data line; every P1 pin is taken on the G2231 and P2 holds the crystal, so
+// only parts with a free port can source them.
+
 #define LM_T2DATABUFFER_SIZE				32
 #define LM_T1DATABUFFER_SIZE				16
 
@@ -128,6 +219,37 @@ volatile unsigned char LM_t2DataCurrentBit    = 0;
 volatile unsigned char LM_t1DataCurrentByte   = 0;
 volatile unsigned char LM_t1DataCurrentBit    = 0;
 
+volatile unsigned int  LM_t2Overflows = 0;		// bytes dropped with the buffer full
+volatile unsigned int  LM_t1Overflows = 0;
+
+#ifdef LM_COMMANDCHANNEL
+unsigned char LM_trackMask = LM_TRACKMASK_TRACK1 | LM_TRACKMASK_TRACK2;	// set by LM_COMMAND_TRACKS
+#endif
+
+// Built with LM_TIMINGCAPTURE, every clock edge is timed against Timer A,
+// which then runs whenever the device is awake rather than only while a
+// byte goes out, and each data packet is followed by the time its edges
+// spanned (see LM_PacketFlags.h). The first packet of a swipe also carries
+// the time from the card loaded edge that woke the device to the first
+// clock edge. That doubles the bytes sent per bit, so it is for looking at
+// a reader on the bench rather than for running a lane.
+#ifdef LM_TIMINGCAPTURE
+volatile unsigned int  LM_timerWraps;			// Timer A overflows, the high word of LM_TimerNow
+volatile unsigned long LM_t2WakeTime;			// LM_TimerNow of the card loaded edge
+volatile unsigned long LM_t2LeadTicks;			// card loaded to the first clock edge, until sent
+volatile bool          LM_t2LeadPending;
+volatile unsigned long LM_t2LastEdge;
+volatile unsigned long LM_t2EdgeTicks;			// SMCLK ticks spanned by the bits not yet flushed
+volatile bool          LM_t2EdgeSeen;			// an edge of this swipe has been latched
+volatile unsigned long LM_t1WakeTime;
+volatile unsigned long LM_t1LeadTicks;
+volatile bool          LM_t1LeadPending;
+volatile unsigned long LM_t1LastEdge;
+volatile unsigned long LM_t1EdgeTicks;
+volatile bool          LM_t1EdgeSeen;
+volatile bool          LM_timingEnabled = true;	// set by LM_COMMAND_TIMING
+#endif
+
 void LM_Initialize()
 {
 	P1DIR |= LM_STATUSLED;         	    // Set LM_STATUSLED to output direction
@@ -148,16 +270,54 @@ void LM_Initialize()
 	P1IFG &= ~LM_T1_CARD_LOADED;		// Clear (flag) before enabling interrupt
 	P1IE  |= LM_T1_CARD_LOADED;		    // Enable interrupt
 	
+#ifdef LM_TIMINGCAPTURE
+	TACTL = UART_TIMERCONTROL;			// SMCLK, continuous mode, for the edge times
+#endif
+	
 	__bis_SR_register(GIE);			    // interrupts enabled
 	
-	P1OUT |= LM_STATUSLED;              // Card reader ready to rumble
+	P1OUT &= ~LM_STATUSLED;             // Lit only while a card is read, so idle draws nothing
+}
+
+// Bytes that can be queued before the buffer is full.
+unsigned char LM_QueueSpace(volatile unsigned char *writeLocation, volatile unsigned char *readLocation, unsigned char dataBufferSize)
+{
+	unsigned char write = *writeLocation;
+	unsigned char read = *readLocation;
+	
+	return (read > write) ? read - write - 1 : dataBufferSize - write + read - 1;
 }
 
-void LM_QueueByte(unsigned char *dataBuffer, volatile unsigned char *writeLocation, unsigned char dataBufferSize, unsigned char byte)
+// Queues a byte LM_QueueSpace has already found room for.
+void LM_PutByte(unsigned char *dataBuffer, volatile unsigned char *writeLocation, unsigned char dataBufferSize, unsigned char byte)
 {
-	dataBuffer[(*writeLocation)++] = byte;
-	if ((*writeLocation) >= dataBufferSize)
-		(*writeLocation) = 0;
+	unsigned char next = (*writeLocation) + 1;
+	
+	if (next >= dataBufferSize)
+		next = 0;
+	dataBuffer[*writeLocation] = byte;
+	(*writeLocation) = next;
+}
+
+// A full buffer drops the byte and counts it, where writing on would lose
+// everything queued ahead of it.
+void LM_QueueByte(unsigned char *dataBuffer, volatile unsigned char *writeLocation, volatile unsigned char *readLocation, volatile unsigned int *overflows, unsigned char dataBufferSize, unsigned char byte)
+{
+	if (!LM_QueueSpace(writeLocation, readLocation, dataBufferSize))
+	{
+		(*overflows)++;
+		return;
+	}
+	LM_PutByte(dataBuffer, writeLocation, dataBufferSize, byte);
+}
+
+bool LM_BytesQueued()
+{
+#ifdef LM_COMMANDCHANNEL
+	if (UART_RXReadLocation != UART_RXWriteLocation)
+		return true;
+#endif
+	return LM_t2DataReadLocation != LM_t2DataWriteLocation || LM_t1DataReadLocation != LM_t1DataWriteLocation;
 }
 
 void LM_SendQueuedBytes()
@@ -181,13 +341,115 @@ void LM_SendQueuedBytes()
 	}	
 }
 
+#ifdef LM_TIMINGCAPTURE
+// SMCLK ticks, 32 bits wide. Called with interrupts disabled, so a wrap not
+// yet counted shows as TAIFG still set.
+unsigned long LM_TimerNow()
+{
+	unsigned int wraps = LM_timerWraps;
+	unsigned int now = TAR;
+	
+	if ((TACTL & TAIFG) && now < 0x8000)
+		wraps++;
+	return ((unsigned long)wraps << 16) | now;
+}
+
+void LM_LatchEdge(volatile unsigned long *lastEdge, volatile unsigned long *edgeTicks, volatile bool *edgeSeen, volatile unsigned long *wakeTime, volatile unsigned long *leadTicks)
+{
+	unsigned long now = LM_TimerNow();
+	
+	if (*edgeSeen)
+		(*edgeTicks) += now - *lastEdge;
+	else
+		*leadTicks = now - *wakeTime;
+	*lastEdge = now;
+	*edgeSeen = true;
+}
+
+// Queues a time in the units of its code, microseconds for packets, into
+// room LM_QueueSpace has already found.
+void LM_QueueTiming(unsigned char *dataBuffer, volatile unsigned char *writeLocation, unsigned char dataBufferSize, unsigned long time)
+{
+	unsigned int code;
+	
+	if (time >= 16320)
+		code = LM_TIMING_SATURATED;
+	else
+	{
+		unsigned int mantissa = (unsigned int)time;
+		unsigned char exponent = 0;
+		
+		while (mantissa >= 256)
+		{
+			mantissa >>= 1;
+			exponent++;
+		}
+		if (mantissa >= 128)
+		{
+			mantissa -= 128;
+			exponent++;
+		}
+		code = (exponent << 7) | mantissa;
+	}
+	
+	LM_PutByte(dataBuffer, writeLocation, dataBufferSize, LM_PACKET_FLAG_TIMING | (code >> 5));
+	LM_PutByte(dataBuffer, writeLocation, dataBufferSize, LM_PACKET_FLAG_TIMING | (code & LM_PACKET_TIMING_BITS));
+}
+#endif
+
+#if defined(LM_TIMINGCAPTURE) || defined(LM_COMMANDCHANNEL)
+// Timer A1 interrupt service routine, for CCR1 and TAIFG
+#pragma vector=TIMERA1_VECTOR
+__interrupt void Timer_A1(void)
+{
+	switch (TAIV)					// reading TAIV clears the flag it reports
+	{
+#ifdef LM_COMMANDCHANNEL
+	case 2:
+		if (UART_ReceiveBit())
+			__bic_SR_register_on_exit(LPM3_bits);	// let main take the byte
+		break;
+#endif
+#ifdef LM_TIMINGCAPTURE
+	case 10:
+		LM_timerWraps++;
+		break;
+#endif
+	}
+}
+#endif
+
 void LM_FlushT2Byte()
 {
 	LM_t2DataCurrentBit  |= LM_PACKET_FLAG_TRACK2;
 	LM_t2DataCurrentByte |= LM_PACKET_FLAG_TRACK2;
 	
-	LM_QueueByte(LM_t2DataBuffer, &LM_t2DataWriteLocation, LM_T2DATABUFFER_SIZE, LM_t2DataCurrentBit);
-	LM_QueueByte(LM_t2DataBuffer, &LM_t2DataWriteLocation, LM_T2DATABUFFER_SIZE, LM_t2DataCurrentByte);
+	// the size and data bytes, and their timing, go whole or not at all
+	unsigned char needed = 2;
+#ifdef LM_TIMINGCAPTURE
+	if (LM_timingEnabled)
+		needed += LM_t2LeadPending ? 4 : 2;
+#endif
+	
+	if (LM_QueueSpace(&LM_t2DataWriteLocation, &LM_t2DataReadLocation, LM_T2DATABUFFER_SIZE) < needed)
+		LM_t2Overflows += needed;
+	else
+	{
+		LM_PutByte(LM_t2DataBuffer, &LM_t2DataWriteLocation, LM_T2DATABUFFER_SIZE, LM_t2DataCurrentBit);
+		LM_PutByte(LM_t2DataBuffer, &LM_t2DataWriteLocation, LM_T2DATABUFFER_SIZE, LM_t2DataCurrentByte);
+#ifdef LM_TIMINGCAPTURE
+		if (LM_timingEnabled)
+		{
+			if (LM_t2LeadPending)
+				LM_QueueTiming(LM_t2DataBuffer, &LM_t2DataWriteLocation, LM_T2DATABUFFER_SIZE, LM_t2LeadTicks >> 8);	// 16 us units
+			LM_QueueTiming(LM_t2DataBuffer, &LM_t2DataWriteLocation, LM_T2DATABUFFER_SIZE, LM_t2EdgeTicks >> 4);	// 16 SMCLK ticks per microsecond
+		}
+#endif
+	}
+#ifdef LM_TIMINGCAPTURE
+	LM_t2LeadPending = false;
+	LM_t2EdgeTicks = 0;
+#endif
 	LM_t2DataCurrentByte = 0;
 	LM_t2DataCurrentBit = 0;	
 }
@@ -207,8 +469,32 @@ void LM_FlushT1Byte()
 	//LM_t2DataCurrentBit  |= LM_PACKET_FLAG_TRACK1;
 	//LM_t2DataCurrentByte |= LM_PACKET_FLAG_TRACK1; 
 	
-	LM_QueueByte(LM_t1DataBuffer, &LM_t1DataWriteLocation, LM_T1DATABUFFER_SIZE, LM_t1DataCurrentBit);
-	LM_QueueByte(LM_t1DataBuffer, &LM_t1DataWriteLocation, LM_T1DATABUFFER_SIZE, LM_t1DataCurrentByte);
+	// the size and data bytes, and their timing, go whole or not at all
+	unsigned char needed = 2;
+#ifdef LM_TIMINGCAPTURE
+	if (LM_timingEnabled)
+		needed += LM_t1LeadPending ? 4 : 2;
+#endif
+	
+	if (LM_QueueSpace(&LM_t1DataWriteLocation, &LM_t1DataReadLocation, LM_T1DATABUFFER_SIZE) < needed)
+		LM_t1Overflows += needed;
+	else
+	{
+		LM_PutByte(LM_t1DataBuffer, &LM_t1DataWriteLocation, LM_T1DATABUFFER_SIZE, LM_t1DataCurrentBit);
+		LM_PutByte(LM_t1DataBuffer, &LM_t1DataWriteLocation, LM_T1DATABUFFER_SIZE, LM_t1DataCurrentByte);
+#ifdef LM_TIMINGCAPTURE
+		if (LM_timingEnabled)
+		{
+			if (LM_t1LeadPending)
+				LM_QueueTiming(LM_t1DataBuffer, &LM_t1DataWriteLocation, LM_T1DATABUFFER_SIZE, LM_t1LeadTicks >> 8);	// 16 us units
+			LM_QueueTiming(LM_t1DataBuffer, &LM_t1DataWriteLocation, LM_T1DATABUFFER_SIZE, LM_t1EdgeTicks >> 4);	// 16 SMCLK ticks per microsecond
+		}
+#endif
+	}
+#ifdef LM_TIMINGCAPTURE
+	LM_t1LeadPending = false;
+	LM_t1EdgeTicks = 0;
+#endif
 	LM_t1DataCurrentByte = 0;
 	LM_t1DataCurrentBit = 0;	
 }
@@ -229,8 +515,13 @@ void LM_ReadT1Bit(bool bit)
 #pragma vector=PORT1_VECTOR
 __interrupt void PORT1_ISR(void)
 {  	
-	if (P1IFG & LM_T2_CLOCK)
+	unsigned char flags = P1IFG & P1IE;		// a track turned off still sets its flags
+	
+	if (flags & LM_T2_CLOCK)
 	{		
+#ifdef LM_TIMINGCAPTURE
+		LM_LatchEdge(&LM_t2LastEdge, &LM_t2EdgeTicks, &LM_t2EdgeSeen, &LM_t2WakeTime, &LM_t2LeadTicks);
+#endif
 		P1IE  &= ~LM_T2_CLOCK;			// Disable LM_T2_CLOCK interrupt
 		P1IFG &= ~LM_T2_CLOCK;			// Clear LM_T2_CLOCK IFG (interrupt flag)
 		
@@ -238,8 +529,11 @@ __interrupt void PORT1_ISR(void)
 		
 		P1IE  |= LM_T2_CLOCK;			// Enable interrupt
 	}
-	else if (P1IFG & LM_T1_CLOCK)
+	else if (flags & LM_T1_CLOCK)
 	{		
+#ifdef LM_TIMINGCAPTURE
+		LM_LatchEdge(&LM_t1LastEdge, &LM_t1EdgeTicks, &LM_t1EdgeSeen, &LM_t1WakeTime, &LM_t1LeadTicks);
+#endif
 		P1IE  &= ~LM_T1_CLOCK;			// Disable LM_T1_CLOCK interrupt
 		P1IFG &= ~LM_T1_CLOCK;			// Clear LM_T1_CLOCK IFG (interrupt flag)
 		
@@ -247,7 +541,7 @@ __interrupt void PORT1_ISR(void)
 		
 		P1IE  |= LM_T1_CLOCK;			// Enable interrupt
 	}
-	if (P1IFG & LM_T2_CARD_LOADED)
+	if (flags & LM_T2_CARD_LOADED)
 	{		
 		P1IE  &= ~LM_T2_CARD_LOADED;			// Disable LM_T2_CARD_LOADED interrupt
 		P1IFG &= ~LM_T2_CARD_LOADED;			// Clear LM_T2_CARD_LOADED IFG (interrupt flag)
@@ -258,9 +552,16 @@ __interrupt void PORT1_ISR(void)
 			P1IES &= ~LM_T2_CARD_LOADED;		// lo/hi edge interrupt
 			P1IE  |= LM_T2_CARD_LOADED;			// Enable interrupt
 			
-			LM_QueueByte(LM_t2DataBuffer, &LM_t2DataWriteLocation, LM_T2DATABUFFER_SIZE, LM_PACKET_FLAG_TRACK2 | LM_PACKET_FLAG_STARTSTOPCONTROL | LM_PACKET_FLAG_START);
+			LM_QueueByte(LM_t2DataBuffer, &LM_t2DataWriteLocation, &LM_t2DataReadLocation, &LM_t2Overflows, LM_T2DATABUFFER_SIZE, LM_PACKET_FLAG_TRACK2 | LM_PACKET_FLAG_STARTSTOPCONTROL | LM_PACKET_FLAG_START);
+#ifdef LM_TIMINGCAPTURE
+			LM_t2WakeTime = LM_TimerNow();
+			LM_t2LeadTicks = 0xFFFFFFFF;		// saturates unless a clock edge comes
+			LM_t2LeadPending = true;
+			LM_t2EdgeSeen = false;
+			LM_t2EdgeTicks = 0;
+#endif
 			 
-			P1OUT &= ~LM_STATUSLED;				// Read started	
+			P1OUT |= LM_STATUSLED;				// Read started	
 		}
 		else
 		{
@@ -269,12 +570,12 @@ __interrupt void PORT1_ISR(void)
 			P1IE  |= LM_T2_CARD_LOADED;			// Enable interrupt
 			
 			LM_FlushT2Byte();
-			LM_QueueByte(LM_t2DataBuffer, &LM_t2DataWriteLocation, LM_T2DATABUFFER_SIZE, LM_PACKET_FLAG_TRACK2 | LM_PACKET_FLAG_STARTSTOPCONTROL | LM_PACKET_FLAG_STOP);						
+			LM_QueueByte(LM_t2DataBuffer, &LM_t2DataWriteLocation, &LM_t2DataReadLocation, &LM_t2Overflows, LM_T2DATABUFFER_SIZE, LM_PACKET_FLAG_TRACK2 | LM_PACKET_FLAG_STARTSTOPCONTROL | LM_PACKET_FLAG_STOP);						
 			
-			P1OUT |= LM_STATUSLED;              // Read complete
+			P1OUT &= ~LM_STATUSLED;             // Read complete
 		}
 	}
-	else if (P1IFG & LM_T1_CARD_LOADED)
+	else if (flags & LM_T1_CARD_LOADED)
 	{		
 		P1IE  &= ~LM_T1_CARD_LOADED;			// Disable LM_T1_CARD_LOADED interrupt
 		P1IFG &= ~LM_T1_CARD_LOADED;			// Clear LM_T1_CARD_LOADED IFG (interrupt flag)
@@ -285,9 +586,16 @@ __interrupt void PORT1_ISR(void)
 			P1IES &= ~LM_T1_CARD_LOADED;		// lo/hi edge interrupt
 			P1IE  |= LM_T1_CARD_LOADED;		// Enable interrupt
 			
-			LM_QueueByte(LM_t1DataBuffer, &LM_t1DataWriteLocation, LM_T1DATABUFFER_SIZE, LM_PACKET_FLAG_TRACK1 | LM_PACKET_FLAG_STARTSTOPCONTROL | LM_PACKET_FLAG_START);
+			LM_QueueByte(LM_t1DataBuffer, &LM_t1DataWriteLocation, &LM_t1DataReadLocation, &LM_t1Overflows, LM_T1DATABUFFER_SIZE, LM_PACKET_FLAG_TRACK1 | LM_PACKET_FLAG_STARTSTOPCONTROL | LM_PACKET_FLAG_START);
+#ifdef LM_TIMINGCAPTURE
+			LM_t1WakeTime = LM_TimerNow();
+			LM_t1LeadTicks = 0xFFFFFFFF;		// saturates unless a clock edge comes
+			LM_t1LeadPending = true;
+			LM_t1EdgeSeen = false;
+			LM_t1EdgeTicks = 0;
+#endif
 			 
-			P1OUT &= ~LM_STATUSLED;				// Read started			
+			P1OUT |= LM_STATUSLED;				// Read started			
 		}
 		else
 		{
@@ -296,11 +604,234 @@ __interrupt void PORT1_ISR(void)
 			P1IE  |= LM_T1_CARD_LOADED;			// Enable interrupt
 			
 			LM_FlushT1Byte();
-			LM_QueueByte(LM_t1DataBuffer, &LM_t1DataWriteLocation, LM_T1DATABUFFER_SIZE, LM_PACKET_FLAG_TRACK1 | LM_PACKET_FLAG_STARTSTOPCONTROL | LM_PACKET_FLAG_STOP);						
+			LM_QueueByte(LM_t1DataBuffer, &LM_t1DataWriteLocation, &LM_t1DataReadLocation, &LM_t1Overflows, LM_T1DATABUFFER_SIZE, LM_PACKET_FLAG_TRACK1 | LM_PACKET_FLAG_STARTSTOPCONTROL | LM_PACKET_FLAG_STOP);						
 			
-			P1OUT |= LM_STATUSLED;              // Read complete
+			P1OUT &= ~LM_STATUSLED;             // Read complete
 		}
 	}
+	
+	__bic_SR_register_on_exit(LPM3_bits);		// let main send what was queued
+}
+
+// ********************************************************************************
+// START COMMAND CHANNEL
+// ********************************************************************************
+
+// Commands from the host, see LM_Commands.h. Each is run and answered from
+// the main loop, after the packets queued so far have gone out, so a reply
+// never splits a packet. Sending one holds up the track buffers for a few
+// byte times, so hosts configure a reader between swipes.
+#ifdef LM_COMMANDCHANNEL
+#define LM_FIRMWARE_VERSION_MAJOR	1
+#define LM_FIRMWARE_VERSION_MINOR	1
+
+unsigned char LM_command[LM_COMMAND_LENGTH];
+unsigned char LM_commandLength = 0;
+unsigned char LM_baud = LM_BAUD_9600;
+
+// A track the host does not want is not read at all: its clock and card
+// loaded interrupts are off, so its edges cost no ISR time and nothing is
+// queued or sent for it. A track turned back on starts clean at the next
+// card loaded edge.
+void LM_ApplyTrackMask()
+{
+	__bic_SR_register(GIE);
+	
+	if (LM_trackMask & LM_TRACKMASK_TRACK2)
+	{
+		if (!(P1IE & LM_T2_CLOCK))
+		{
+			LM_t2DataCurrentByte = 0;
+			LM_t2DataCurrentBit = 0;
+			P1IES |= LM_T2_CARD_LOADED;		// hi/lo edge interrupt
+			P1IFG &= ~(LM_T2_CLOCK | LM_T2_CARD_LOADED);
+			P1IE  |= LM_T2_CLOCK | LM_T2_CARD_LOADED;
+		}
+	}
+	else
+		P1IE &= ~(LM_T2_CLOCK | LM_T2_CARD_LOADED);
+	
+	if (LM_trackMask & LM_TRACKMASK_TRACK1)
+	{
+		if (!(P1IE & LM_T1_CLOCK))
+		{
+			LM_t1DataCurrentByte = 0;
+			LM_t1DataCurrentBit = 0;
+			P1IES |= LM_T1_CARD_LOADED;		// hi/lo edge interrupt
+			P1IFG &= ~(LM_T1_CLOCK | LM_T1_CARD_LOADED);
+			P1IE  |= LM_T1_CLOCK | LM_T1_CARD_LOADED;
+		}
+	}
+	else
+		P1IE &= ~(LM_T1_CLOCK | LM_T1_CARD_LOADED);
+	
+	__bis_SR_register(GIE);
+}
+
+void LM_SendReply(unsigned char command, unsigned char status, const unsigned char *payload, unsigned char payloadLength)
+{
+	unsigned char i;
+	
+	UART_TXByte = LM_REPLY_MARKER;
+	UART_TransmitByte();
+	UART_TXByte = payloadLength + 2;
+	UART_TransmitByte();
+	UART_TXByte = command;
+	UART_TransmitByte();
+	UART_TXByte = status;
+	UART_TransmitByte();
+	
+	for (i = 0; i < payloadLength; i++)
+	{
+		UART_TXByte = payload[i];
+		UART_TransmitByte();
+	}
+}
+
+void LM_RunCommand(unsigned char command, unsigned char argument)
+{
+	unsigned char payload[6];
+	unsigned char payloadLength = 0;
+	unsigned char status = LM_STATUS_OK;
+	unsigned char baud = LM_baud;
+	
+	switch (command)
+	{
+	case LM_COMMAND_VERSION:
+		payload[0] = LM_FIRMWARE_VERSION_MAJOR;
+		payload[1] = LM_FIRMWARE_VERSION_MINOR;
+		payload[2] = 0;
+#ifdef LM_TIMINGCAPTURE
+		payload[2] |= LM_FEATURE_TIMINGCAPTURE;
+		if (LM_timingEnabled)
+			payload[2] |= LM_FEATURE_TIMINGON;
+#endif
+		payload[3] = LM_trackMask;
+		payload[4] = LM_baud;
+		payload[5] = LM_FRAMING_LEGACY;
+		payloadLength = 6;
+		break;
+		
+	case LM_COMMAND_OVERFLOWS:
+		__bic_SR_register(GIE);			// none counted between reading and clearing
+		payload[0] = LM_t1Overflows & 0xFF;
+		payload[1] = LM_t1Overflows >> 8;
+		payload[2] = LM_t2Overflows & 0xFF;
+		payload[3] = LM_t2Overflows >> 8;
+		payload[4] = UART_rxOverflows & 0xFF;
+		payload[5] = UART_rxOverflows >> 8;
+		if (argument)
+		{
+			LM_t1Overflows = 0;
+			LM_t2Overflows = 0;
+			UART_rxOverflows = 0;
+		}
+		__bis_SR_register(GIE);
+		payloadLength = 6;
+		break;
+		
+	case LM_COMMAND_TRACKS:
+		if (argument & ~(LM_TRACKMASK_TRACK1 | LM_TRACKMASK_TRACK2))
+			status = LM_STATUS_BADARGUMENT;
+		else
+		{
+			LM_trackMask = argument;
+			LM_ApplyTrackMask();
+		}
+		break;
+		
+	case LM_COMMAND_TIMING:
+#ifdef LM_TIMINGCAPTURE
+		LM_timingEnabled = (argument != 0);
+#else
+		status = LM_STATUS_NOTBUILT;
+#endif
+		break;
+		
+	case LM_COMMAND_BAUD:
+		if (argument >= LM_BAUD_COUNT)
+			status = LM_STATUS_BADARGUMENT;
+		else
+			baud = argument;
+		break;
+		
+	case LM_COMMAND_FRAMING:
+		if (argument != LM_FRAMING_LEGACY)
+			status = LM_STATUS_BADARGUMENT;
+		break;
+		
+	default:
+		status = LM_STATUS_UNKNOWNCOMMAND;
+		break;
+	}
+	
+	LM_SendReply(command, status, payload, payloadLength);
+	
+	// the reply goes at the old rate, so the host knows when to follow
+	LM_baud = baud;
+	UART_bitTime = UART_BITTIMES[baud];
+}
+
+void LM_ReceiveCommands()
+{
+	while (UART_RXReadLocation != UART_RXWriteLocation)
+	{
+		unsigned char byte = UART_RXBuffer[UART_RXReadLocation++];
+		
+		if (UART_RXReadLocation >= UART_RXBUFFER_SIZE)
+			UART_RXReadLocation = 0;
+		
+		if (!LM_commandLength && byte != LM_COMMAND_SYNC)
+			continue;
+		
+		LM_command[LM_commandLength++] = byte;
+		if (LM_commandLength < LM_COMMAND_LENGTH)
+			continue;
+		
+		LM_commandLength = 0;
+		if ((LM_command[1] ^ LM_command[2]) != LM_command[3])
+			LM_SendReply(LM_command[1], LM_STATUS_BADCHECK, 0, 0);
+		else
+			LM_RunCommand(LM_command[1], LM_command[2]);
+	}
+}
+#endif
+
+// ********************************************************************************
+// START LOW POWER IDLE
+// ********************************************************************************
+
+// Sleeps until an interrupt has queued something to send. With no card in
+// the reader that is LPM3, with only the watch crystal running: the card
+// loaded edge wakes the device, and the DCO keeps its calibrated 16 MHz
+// setting through LPM3 and is running again within a couple of
+// microseconds, long before a card travels from the card loaded switch to
+// its first clock edge. Timing capture builds sleep in LPM0 during a read
+// instead, so SMCLK keeps Timer A counting between edges, and command
+// channel builds always do, as it takes Timer A to catch a start bit: they
+// give up the LPM3 idle savings for it.
+void LM_Sleep()
+{
+	__bic_SR_register(GIE);				// nothing may be queued between the check and sleeping
+	
+	if (LM_BytesQueued())
+	{
+		__bis_SR_register(GIE);
+		return;
+	}
+	
+#ifdef LM_COMMANDCHANNEL
+	__bis_SR_register(LPM0_bits + GIE);
+	return;
+#elif defined(LM_TIMINGCAPTURE)
+	if ((P1IN & (LM_T2_CARD_LOADED | LM_T1_CARD_LOADED)) != (LM_T2_CARD_LOADED | LM_T1_CARD_LOADED))
+	{
+		__bis_SR_register(LPM0_bits + GIE);
+		return;
+	}
+#endif
+	
+	__bis_SR_register(LPM3_bits + GIE);	// GIE set with the sleep, so no wake is missed
 }
 
 #define		DCO_SETTING			TI_DCO_16MHZ		// see DCO_Library.h for more settings
@@ -308,14 +839,20 @@ __interrupt void PORT1_ISR(void)
 void sDCO()
 {
 	volatile unsigned int I;
-	P1DIR |= BIT0; 									// P1.0 output
+#ifndef LM_COMMANDCHANNEL
+	P1DIR |= BIT0; 									// P1.0 output, Track 2 card loaded in command channel builds
+#endif
 	BCSCTL1 &= ~XTS;								// external source is LF;
 	BCSCTL3 &= ~(LFXT1S0 + LFXT1S1);  				// watch crystal mode
 	BCSCTL3 |= XCAP0 + XCAP1; 						// ~12.5 pf cap on the watch crystal as recommended
 
 	for( I = 0; I < 0xFFFF; I++){} 					// delay for ACLK startup
 	if(TI_SetDCO(DCO_SETTING) == TI_DCO_NO_ERROR)	// if setting the clock was successful,
+	{
+#ifndef LM_COMMANDCHANNEL
 		P1OUT |= BIT0; 								// bring P1.0 high (Launchpad red LED)
+#endif
+	}
 	else
 		while(1);									// trap if setting the clock isn't successful
 }
@@ -331,5 +868,11 @@ void main(void)
 	LM_Initialize();
 	
 	while(1)
+	{
 		LM_SendQueuedBytes();
+#ifdef LM_COMMANDCHANNEL
+		LM_ReceiveCommands();
+#endif
+		LM_Sleep();
+	}
 }